@@ -0,0 +1,333 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Asynchronous line output: producers hand complete lines to a lock-free
+// queue and return immediately; a writer thread drains it into a buffered
+// stdio stream, flushing per batch or on a timer, and can rotate files by
+// size and age.
+//
+// This keeps a slow consumer (a pipe into another tool, a network mount)
+// from stalling the threads that produce results.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+// Unbounded multi-producer single-consumer queue (Vyukov's linked-list MPSC).
+//
+// push() is one atomic exchange plus a store, so it never blocks. pop() runs
+// on a single consumer thread and may briefly report empty while a producer
+// is between its exchange and its store; the consumer simply retries later.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head_(new Node), tail_(head_.load()) {}
+
+    ~MpscQueue()
+    {
+        T discard;
+        while (pop(discard)) {
+        }
+        delete tail_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value)
+    {
+        Node* node = new Node;
+        node->value = std::move(value);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T& out)
+    {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        out = std::move(next->value);
+        delete tail_;
+        tail_ = next;   // `next` becomes the new stub node
+        return true;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value{};
+    };
+
+    std::atomic<Node*> head_;   // last pushed node (producers)
+    Node* tail_;                // stub node before the oldest entry (consumer)
+};
+
+struct AsyncLineWriterOptions {
+    std::string path;                 // empty or "-" = stdout
+    uint64_t rotateBytes = 0;         // rotate before exceeding this size; 0 = never
+    double rotateSec = 0.0;           // rotate files older than this; 0 = never
+    double flushIntervalSec = 0.0;    // 0 = flush after every drained batch
+    size_t maxPending = 10000;        // lines beyond this are dropped, not queued
+};
+
+// Writes lines (without trailing newline) in push order per producer.
+//
+// Files are opened in append mode. On rotation the current file is renamed
+// to "<stem>.<YYYYmmdd-HHMMSS><ext>" (local time it was opened) and a new one
+// is started at the original path, so readers can always follow that path.
+class AsyncLineWriter {
+public:
+    explicit AsyncLineWriter(AsyncLineWriterOptions options) : options_(std::move(options)) {}
+
+    ~AsyncLineWriter() { close(); }
+
+    AsyncLineWriter(const AsyncLineWriter&) = delete;
+    AsyncLineWriter& operator=(const AsyncLineWriter&) = delete;
+
+    bool open(std::string& error)
+    {
+        if (!openFile(error)) {
+            return false;
+        }
+        thread_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    // Queue one line. Returns false (and counts it) if the backlog is full.
+    bool push(std::string line)
+    {
+        if (pending_.fetch_add(1, std::memory_order_relaxed) >= options_.maxPending) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        queue_.push(std::move(line));
+        // Lock-free notify: a wakeup lost to the race with wait_for() costs
+        // at most one idle timeout.
+        wake_.notify_one();
+        return true;
+    }
+
+    // Write everything queued so far, then stop the writer thread.
+    void close()
+    {
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+        closeFile();
+    }
+
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t rotations() const { return rotations_.load(std::memory_order_relaxed); }
+
+    // Whether a write, flush or open failed, i.e. lines may be missing from
+    // the output although dropped() is zero. Final once close() returned.
+    bool failed() const { return failed_.load(std::memory_order_relaxed); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    bool toStdout() const { return options_.path.empty() || options_.path == "-"; }
+
+    bool openFile(std::string& error)
+    {
+        if (toStdout()) {
+            file_ = stdout;
+            return true;
+        }
+        file_ = std::fopen(options_.path.c_str(), "ab");
+        if (file_ == nullptr) {
+            error = "cannot open " + options_.path + " for writing";
+            return false;
+        }
+        std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(options_.path, ec);
+        fileBytes_ = ec ? 0 : size;
+        openedAt_ = Clock::now();
+        openedWall_ = std::time(nullptr);
+        return true;
+    }
+
+    void closeFile()
+    {
+        if (file_ == nullptr) {
+            return;
+        }
+        // ferror() also catches a failed earlier flush whose data is gone.
+        bool ok = std::fflush(file_) == 0 && std::ferror(file_) == 0;
+        if (file_ != stdout) {
+            ok = std::fclose(file_) == 0 && ok;
+        }
+        file_ = nullptr;
+        if (!ok) {
+            reportError("write failed on " + (toStdout() ? std::string("stdout") : options_.path));
+        }
+    }
+
+    std::string rotatedPath() const
+    {
+        std::tm tm{};
+#ifdef _WIN32
+        localtime_s(&tm, &openedWall_);
+#else
+        localtime_r(&openedWall_, &tm);
+#endif
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+        const std::filesystem::path path(options_.path);
+        const std::string base =
+            (path.parent_path() / path.stem()).string() + "." + stamp;
+        std::string candidate = base + path.extension().string();
+        for (int i = 1; std::filesystem::exists(candidate); ++i) {
+            candidate = base + "-" + std::to_string(i) + path.extension().string();
+        }
+        return candidate;
+    }
+
+    void rotateIfDue(size_t nextLineBytes)
+    {
+        if (file_ == nullptr) {
+            // Reopening after the last rotation failed; try again, the
+            // lines in between are dropped.
+            std::string error;
+            if (openFile(error)) {
+                std::fprintf(stderr, "[INFO] Output writer: %s reopened\n", options_.path.c_str());
+            }
+            return;
+        }
+        if (file_ == stdout || fileBytes_ == 0) {
+            return;
+        }
+        const bool bySize =
+            options_.rotateBytes > 0 && fileBytes_ + nextLineBytes > options_.rotateBytes;
+        const bool byAge =
+            options_.rotateSec > 0.0 &&
+            std::chrono::duration<double>(Clock::now() - openedAt_).count() >= options_.rotateSec;
+        if (!bySize && !byAge) {
+            return;
+        }
+
+        closeFile();
+        std::error_code ec;
+        std::filesystem::rename(options_.path, rotatedPath(), ec);
+        std::string error;
+        if (!openFile(error)) {
+            reportError(error);
+            return;
+        }
+        rotations_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reportError(const std::string& error)
+    {
+        failed_.store(true, std::memory_order_relaxed);
+        if (!errorReported_) {
+            std::fprintf(stderr, "[ERROR] Output writer: %s\n", error.c_str());
+            errorReported_ = true;
+        }
+    }
+
+    void run()
+    {
+        const auto idleWait = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(
+                options_.flushIntervalSec > 0.0 ? options_.flushIntervalSec : 0.1));
+        auto lastFlush = Clock::now();
+        bool unflushed = false;
+        std::string line;
+
+        for (;;) {
+            bool stopping = false;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                wake_.wait_for(lock, idleWait, [this] {
+                    return stop_ || pending_.load(std::memory_order_relaxed) > 0;
+                });
+                stopping = stop_;
+            }
+
+            // Producers have finished by the time close() is called, so after
+            // `stop_` one more drain empties the queue.
+            while (queue_.pop(line)) {
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                line.push_back('\n');
+                rotateIfDue(line.size());
+                if (file_ == nullptr) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (std::fwrite(line.data(), 1, line.size(), file_) != line.size()) {
+                    reportError("write failed on " + (toStdout() ? std::string("stdout") : options_.path));
+                }
+                fileBytes_ += line.size();
+                written_.fetch_add(1, std::memory_order_relaxed);
+                unflushed = true;
+            }
+
+            const auto now = Clock::now();
+            if (unflushed && file_ != nullptr &&
+                (options_.flushIntervalSec <= 0.0 || stopping ||
+                 std::chrono::duration<double>(now - lastFlush).count() >= options_.flushIntervalSec)) {
+                if (std::fflush(file_) != 0) {
+                    reportError("flush failed on " + (toStdout() ? std::string("stdout") : options_.path));
+                }
+                lastFlush = now;
+                unflushed = false;
+            }
+
+            if (stopping && pending_.load(std::memory_order_relaxed) == 0) {
+                return;
+            }
+        }
+    }
+
+    AsyncLineWriterOptions options_;
+    MpscQueue<std::string> queue_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> rotations_{0};
+    std::atomic<bool> failed_{false};
+
+    std::mutex mtx_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::thread thread_;
+
+    // Writer thread only (and open/close around it).
+    std::FILE* file_ = nullptr;
+    uint64_t fileBytes_ = 0;
+    Clock::time_point openedAt_{};
+    std::time_t openedWall_ = 0;
+    bool errorReported_ = false;
+};
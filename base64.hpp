@@ -0,0 +1,248 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Base64 encoding of JPEG payloads into caller-provided buffers.
+//
+// The pipeline embeds every sampled frame as a data URL, so the encoder runs
+// on every request. The vectorized kernels follow the well-known pshufb
+// approach (W. Muła, D. Lemire): reshuffle 3-byte groups into 4 lanes, split
+// them into 6-bit indices with two multiplies, and map indices to ASCII with a
+// 16-entry offset table. The best kernel for the running CPU is chosen once at
+// first use; non-x86 builds use the scalar kernel.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define V2K_BASE64_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC/Clang need per-function target attributes to emit SSSE3/AVX2 code
+// without raising the baseline ISA of the whole program. MSVC does not.
+#if defined(V2K_BASE64_X86) && (defined(__GNUC__) || defined(__clang__))
+#define V2K_TARGET(isa) __attribute__((target(isa)))
+#else
+#define V2K_TARGET(isa)
+#endif
+
+// Number of characters produced for n input bytes (with '=' padding).
+inline size_t base64EncodedLength(size_t n)
+{
+    return ((n + 2) / 3) * 4;
+}
+
+// Scalar kernel. Also used for the tail left over by the vector kernels.
+inline void base64EncodeScalar(const uint8_t* src, size_t n, char* dst)
+{
+    static const char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t i = 0;
+    while (i + 2 < n) {
+        const uint32_t triple =
+            (static_cast<uint32_t>(src[i]) << 16) |
+            (static_cast<uint32_t>(src[i + 1]) << 8) |
+            static_cast<uint32_t>(src[i + 2]);
+
+        dst[0] = table[(triple >> 18) & 0x3F];
+        dst[1] = table[(triple >> 12) & 0x3F];
+        dst[2] = table[(triple >> 6) & 0x3F];
+        dst[3] = table[triple & 0x3F];
+        dst += 4;
+        i += 3;
+    }
+
+    const size_t rem = n - i;
+    if (rem == 1) {
+        const uint32_t triple = (static_cast<uint32_t>(src[i]) << 16);
+        dst[0] = table[(triple >> 18) & 0x3F];
+        dst[1] = table[(triple >> 12) & 0x3F];
+        dst[2] = '=';
+        dst[3] = '=';
+    } else if (rem == 2) {
+        const uint32_t triple =
+            (static_cast<uint32_t>(src[i]) << 16) |
+            (static_cast<uint32_t>(src[i + 1]) << 8);
+        dst[0] = table[(triple >> 18) & 0x3F];
+        dst[1] = table[(triple >> 12) & 0x3F];
+        dst[2] = table[(triple >> 6) & 0x3F];
+        dst[3] = '=';
+    }
+}
+
+#ifdef V2K_BASE64_X86
+
+// 12 input bytes -> 16 characters per iteration. Each iteration loads 16
+// bytes, so the loop stops while at least 16 bytes remain readable.
+V2K_TARGET("ssse3")
+inline void base64EncodeSsse3(const uint8_t* src, size_t n, char* dst)
+{
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shiftLut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+
+    while (n >= 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        in = _mm_shuffle_epi8(in, shuffle);
+
+        const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        const __m128i indices = _mm_or_si128(t1, t3);
+
+        __m128i lut = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        const __m128i lessThan26 = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        lut = _mm_or_si128(lut, _mm_and_si128(lessThan26, _mm_set1_epi8(13)));
+        const __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(shiftLut, lut), indices);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), chars);
+        src += 12;
+        n -= 12;
+        dst += 16;
+    }
+
+    base64EncodeScalar(src, n, dst);
+}
+
+// 24 input bytes -> 32 characters per iteration. pshufb works within 128-bit
+// lanes, so each lane is loaded separately with its 12 bytes at offset 0;
+// the second load reads up to src + 28.
+V2K_TARGET("avx2")
+inline void base64EncodeAvx2(const uint8_t* src, size_t n, char* dst)
+{
+    const __m256i shuffle = _mm256_broadcastsi128_si256(
+        _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i shiftLut = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0));
+
+    while (n >= 28) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+
+        const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i lut = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i lessThan26 = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        lut = _mm256_or_si256(lut, _mm256_and_si256(lessThan26, _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shiftLut, lut), indices);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), chars);
+        src += 24;
+        n -= 24;
+        dst += 32;
+    }
+
+    base64EncodeSsse3(src, n, dst);
+}
+
+// Runtime CPU feature checks.
+inline bool base64CpuHasSsse3()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+inline bool base64CpuHasAvx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // V2K_BASE64_X86
+
+using Base64Kernel = void (*)(const uint8_t*, size_t, char*);
+
+// Name and function of the kernel selected for this CPU.
+struct Base64KernelInfo {
+    const char* name;
+    Base64Kernel encode;
+};
+
+inline const Base64KernelInfo& base64SelectedKernel()
+{
+    static const Base64KernelInfo selected = [] {
+#ifdef V2K_BASE64_X86
+        if (base64CpuHasAvx2()) {
+            return Base64KernelInfo{"avx2", &base64EncodeAvx2};
+        }
+        if (base64CpuHasSsse3()) {
+            return Base64KernelInfo{"ssse3", &base64EncodeSsse3};
+        }
+#endif
+        return Base64KernelInfo{"scalar", &base64EncodeScalar};
+    }();
+    return selected;
+}
+
+// Encode `in` into `out`, which must hold base64EncodedLength(in.size())
+// characters. Returns the number of characters written, or 0 if `out` is too
+// small (nothing is written in that case).
+inline size_t base64EncodeTo(std::span<const uint8_t> in, std::span<char> out)
+{
+    const size_t len = base64EncodedLength(in.size());
+    if (out.size() < len) {
+        return 0;
+    }
+    base64SelectedKernel().encode(in.data(), in.size(), out.data());
+    return len;
+}
+
+// Build "<prefix><base64 of in>" with a single allocation, e.g. for the
+// "data:image/jpeg;base64," data URLs sent to the model.
+inline std::string base64DataUrl(std::string_view prefix, std::span<const uint8_t> in)
+{
+    std::string url;
+    url.resize(prefix.size() + base64EncodedLength(in.size()));
+    std::copy(prefix.begin(), prefix.end(), url.begin());
+    base64EncodeTo(in, std::span<char>(url.data() + prefix.size(), url.size() - prefix.size()));
+    return url;
+}
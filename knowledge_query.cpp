@@ -0,0 +1,226 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Query (and import into) a knowledge store written by
+// realtime_video_pipeline --store.
+//
+// Usage: knowledge_query.exe <store-dir> [options]
+#include "knowledge_store.hpp"
+#include "pipeline_helpers.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+static void printUsage(const char* argv0)
+{
+    std::cerr
+        << "Usage: " << argv0 << " <store-dir> [options]\n"
+        << "Options:\n"
+        << "  --source <label>        Only results of this source (repeatable)\n"
+        << "  --from <datetime>       Start of the time range, \"YYYY-mm-dd HH:MM:SS\" local time\n"
+        << "                          or ISO 8601 with a zone (\"2026-04-27T12:00:00.250Z\")\n"
+        << "  --to <datetime>         End of the time range (exclusive)\n"
+        << "  --last <sec>            Only the last <sec> seconds (instead of --from/--to)\n"
+        << "  --keyword <word>        Require the word in the result text (repeatable)\n"
+        << "  --limit <n>             Print at most <n> results (default 100; 0 = all)\n"
+        << "  --format text|jsonl     Output format (default text)\n"
+        << "  --count                 Print only the number of matches\n"
+        << "  --summary               Print segments, records, sources and time span\n"
+        << "  --import <file.jsonl>   Append the records of a --jsonl output file to the store\n"
+        << "\n"
+        << "Times refer to the media timeline for files and to acquisition time for\n"
+        << "live sources, as in the pipeline's output.\n";
+}
+
+static int64_t toMs(const std::chrono::system_clock::time_point& tp)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count();
+}
+
+static std::chrono::system_clock::time_point fromMs(int64_t ms)
+{
+    return std::chrono::system_clock::time_point{} +
+           std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(ms));
+}
+
+// Append the records of a JSONL file written by the pipeline with --jsonl.
+// Its datetimes are ISO 8601 with milliseconds and a UTC offset, which
+// parseMetadataDateTime converts to UTC exactly as the pipeline stored them.
+static bool importJsonl(const std::string& storeDir, const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "[ERROR] Cannot open " << path << "\n";
+        return false;
+    }
+
+    KnowledgeStoreWriter writer;
+    std::string error;
+    if (!writer.open(storeDir, error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return false;
+    }
+
+    uint64_t skipped = 0;
+    for (std::string line; std::getline(in, line);) {
+        if (!trimInPlace(line)) {
+            continue;
+        }
+        const json record = json::parse(line, nullptr, false);
+        std::chrono::system_clock::time_point media{};
+        std::chrono::system_clock::time_point acquired{};
+        if (!record.is_object() ||
+            !parseMetadataDateTime(record.value("media_datetime", std::string()), media) ||
+            !parseMetadataDateTime(record.value("acquired_at", std::string()), acquired)) {
+            ++skipped;
+            continue;
+        }
+        writer.append({record.value("source", std::string("src0")), toMs(media), toMs(acquired), line});
+    }
+    writer.close();
+
+    std::cerr << "[INFO] Imported " << writer.appended() << " records from " << path;
+    if (skipped > 0) {
+        std::cerr << " (" << skipped << " lines skipped)";
+    }
+    std::cerr << "\n";
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") {
+        printUsage(argv[0]);
+        return argc < 2 ? 1 : 0;
+    }
+    const std::string storeDir = argv[1];
+
+    KnowledgeQuery query;
+    query.limit = 100;
+    bool jsonlOutput = false;
+    bool countOnly = false;
+    bool summaryOnly = false;
+    std::string importPath;
+
+    for (int i = 2; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        std::chrono::system_clock::time_point tp{};
+
+        if (a == "--source" && hasValue) {
+            query.sources.push_back(argv[++i]);
+        } else if ((a == "--from" || a == "--to") && hasValue) {
+            if (!parseMetadataDateTime(argv[++i], tp)) {
+                std::cerr << "[ERROR] " << a << " expects \"YYYY-mm-dd HH:MM:SS\" or ISO 8601\n";
+                return 1;
+            }
+            (a == "--from" ? query.fromMs : query.toMs) = toMs(tp);
+        } else if (a == "--last" && hasValue) {
+            double sec = 0.0;
+            if (!parseDoubleStrict(argv[++i], sec) || !(sec >= 0.0 && sec <= 1e12)) {
+                std::cerr << "[ERROR] --last must be a number of seconds between 0 and 1e12\n";
+                return 1;
+            }
+            query.toMs = toMs(std::chrono::system_clock::now()) + 1;
+            query.fromMs = query.toMs - static_cast<int64_t>(sec * 1000.0);
+        } else if (a == "--keyword" && hasValue) {
+            const std::string keyword = argv[++i];
+            bool indexable = false;
+            knowledgeForEachToken(keyword, [&](std::string_view) { indexable = true; });
+            if (!indexable) {
+                std::cerr << "[ERROR] --keyword needs a word of at least two letters or digits\n";
+                return 1;
+            }
+            query.keywords.push_back(keyword);
+        } else if (a == "--limit" && hasValue) {
+            int limit = 0;
+            if (!parseIntStrict(argv[++i], limit) || limit < 0) {
+                std::cerr << "[ERROR] --limit must be an integer >= 0\n";
+                return 1;
+            }
+            query.limit = static_cast<size_t>(limit);
+        } else if (a == "--format" && hasValue) {
+            const std::string f = argv[++i];
+            if (f != "text" && f != "jsonl") {
+                std::cerr << "[ERROR] --format must be text or jsonl\n";
+                return 1;
+            }
+            jsonlOutput = f == "jsonl";
+        } else if (a == "--count") {
+            countOnly = true;
+        } else if (a == "--summary") {
+            summaryOnly = true;
+        } else if (a == "--import" && hasValue) {
+            importPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            std::cerr << "[ERROR] Unknown or incomplete option: " << a << "\n";
+            return 1;
+        }
+    }
+
+    if (!importPath.empty()) {
+        return importJsonl(storeDir, importPath) ? 0 : 1;
+    }
+
+    KnowledgeStoreReader reader;
+    std::string error;
+    if (!reader.open(storeDir, error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    if (summaryOnly) {
+        const KnowledgeStoreSummary s = reader.summary();
+        std::cout << "segments: " << s.segments << " (" << s.sealedSegments << " sealed)\n"
+                  << "records:  " << s.records << "\n"
+                  << "sources:  " << s.sources << "\n";
+        if (s.records > 0) {
+            std::cout << "from:     " << formatDateTime(fromMs(s.minTimeMs)) << "\n"
+                      << "to:       " << formatDateTime(fromMs(s.maxTimeMs)) << "\n";
+        }
+        return 0;
+    }
+
+    if (countOnly) {
+        query.limit = 0;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<KnowledgeMatch> matches = reader.query(query);
+    const double elapsedMs =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (countOnly) {
+        std::cout << matches.size() << "\n";
+    } else {
+        for (const auto& m : matches) {
+            if (jsonlOutput) {
+                std::cout << m.json << '\n';
+                continue;
+            }
+            std::cout << formatDateTime(fromMs(m.timeMs)) << " source=" << m.source << "  "
+                      << knowledgeRecordText(m.json) << '\n';
+        }
+    }
+    std::cerr << "[INFO] " << matches.size() << " matches in " << std::fixed
+              << std::setprecision(2) << elapsedMs << " ms\n";
+    return 0;
+}
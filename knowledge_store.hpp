@@ -0,0 +1,964 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Append-only, memory-mapped store of inference results with time-range and
+// keyword queries.
+//
+// On-disk layout of a store directory (host byte order; a store is not meant
+// to move between architectures):
+//
+//   LOCK              held (flock / exclusive open) by the one writer allowed
+//                     at a time; readers do not take it
+//   sources.txt       source labels, one per line; the line number is the id
+//   seg-NNNNNN.dat    records in arrival order, each a KnowledgeRecordHeader
+//                     followed by the result's JSON object
+//   seg-NNNNNN.idx    written once the segment is sealed (full, or when the
+//                     writer closes): record offsets, a sparse time index
+//                     (min/max time per block of kKnowledgeBlockRecords
+//                     records) and an inverted keyword index (term hash ->
+//                     sorted record numbers)
+//
+// Sealed segments are never modified again, so readers map them and touch
+// only the index pages and records a query actually needs. The one segment
+// still being written has no index; queries scan it, which is bounded by the
+// segment size. A segment left unsealed by a crash is sealed the next time a
+// writer opens the store; a torn record at its end is ignored.
+#pragma once
+
+#include "async_writer.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr uint32_t kKnowledgeRecordMagic = 0x524B3256;   // "V2KR"
+constexpr uint32_t kKnowledgeSegmentRecords = 16384;
+constexpr uint32_t kKnowledgeBlockRecords = 64;
+constexpr char kKnowledgeIndexMagic[8] = {'V', '2', 'K', 'I', 'D', 'X', '1', '\0'};
+
+struct KnowledgeRecordHeader {
+    uint32_t magic;
+    uint32_t payloadBytes;
+    int64_t timeMs;       // media datetime (acquisition time for live sources), ms since epoch
+    int64_t wallTimeMs;   // acquisition time, ms since epoch
+    uint32_t sourceId;
+    uint32_t reserved;
+};
+static_assert(sizeof(KnowledgeRecordHeader) == 32);
+
+struct KnowledgeIndexHeader {
+    char magic[8];
+    uint32_t recordCount;
+    uint32_t blockCount;
+    uint32_t termCount;
+    uint32_t postingCount;
+    int64_t minTimeMs;
+    int64_t maxTimeMs;
+};
+static_assert(sizeof(KnowledgeIndexHeader) == 40);
+
+struct KnowledgeBlock {
+    int64_t minTimeMs;
+    int64_t maxTimeMs;
+    uint32_t firstRecord;
+    uint32_t recordCount;
+};
+static_assert(sizeof(KnowledgeBlock) == 24);
+
+struct KnowledgeTerm {
+    uint64_t hash;
+    uint32_t firstPosting;
+    uint32_t postingCount;
+};
+static_assert(sizeof(KnowledgeTerm) == 16);
+
+// One result as handed to the writer.
+struct KnowledgeRecord {
+    std::string source;
+    int64_t timeMs = 0;
+    int64_t wallTimeMs = 0;
+    std::string json;   // the JSONL record, without newline
+};
+
+//------------------------------------------------------------------------------
+// Helpers
+//------------------------------------------------------------------------------
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            return false;
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+        if (size_ > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                data_ = static_cast<const unsigned char*>(
+                    MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            data_ = p == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(p);
+        }
+        ::close(fd);
+#endif
+        if (size_ > 0 && data_ == nullptr) {
+            size_ = 0;
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (data_ != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(data_);
+#else
+            ::munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+        }
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Unaligned-safe read of the i-th T at byte offset `base` of a mapping.
+template <typename T>
+inline T knowledgeLoad(const unsigned char* data, size_t base, size_t i = 0)
+{
+    T value;
+    std::memcpy(&value, data + base + i * sizeof(T), sizeof(T));
+    return value;
+}
+
+// Lowercased words of a text: runs of ASCII letters/digits and non-ASCII
+// bytes (so UTF-8 words stay whole), at least two bytes long.
+template <typename F>
+inline void knowledgeForEachToken(std::string_view text, F&& onToken)
+{
+    std::string token;
+    auto flush = [&] {
+        if (token.size() >= 2) {
+            onToken(std::string_view(token));
+        }
+        token.clear();
+    };
+    for (const char c : text) {
+        const auto u = static_cast<unsigned char>(c);
+        if ((u >= 'a' && u <= 'z') || (u >= '0' && u <= '9') || u >= 0x80) {
+            token.push_back(c);
+        } else if (u >= 'A' && u <= 'Z') {
+            token.push_back(static_cast<char>(u - 'A' + 'a'));
+        } else {
+            flush();
+        }
+    }
+    flush();
+}
+
+// 64-bit FNV-1a. The keyword index stores term hashes only; a collision can
+// at worst add a spurious match.
+inline uint64_t knowledgeTermHash(std::string_view term)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (const char c : term) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// The indexed text of a record: its "text" field, or the whole payload if it
+// is not a JSON object with one.
+inline std::string knowledgeRecordText(std::string_view payload)
+{
+    const auto doc = nlohmann::json::parse(payload, nullptr, false);
+    if (doc.is_object()) {
+        const auto it = doc.find("text");
+        if (it != doc.end() && it->is_string()) {
+            return it->get<std::string>();
+        }
+    }
+    return std::string(payload);
+}
+
+// Visit the complete records of a mapped .dat file in order:
+// onRecord(offset, header, payload). Stops at the first torn or foreign one.
+template <typename F>
+inline void knowledgeForEachRecord(const MappedFile& dat, F&& onRecord)
+{
+    size_t offset = 0;
+    while (offset + sizeof(KnowledgeRecordHeader) <= dat.size()) {
+        const auto h = knowledgeLoad<KnowledgeRecordHeader>(dat.data(), offset);
+        const size_t end = offset + sizeof(KnowledgeRecordHeader) + h.payloadBytes;
+        if (h.magic != kKnowledgeRecordMagic || end > dat.size()) {
+            return;
+        }
+        onRecord(offset, h, std::string_view(
+            reinterpret_cast<const char*>(dat.data()) + offset + sizeof(KnowledgeRecordHeader),
+            h.payloadBytes));
+        offset = end;
+    }
+}
+
+inline std::string knowledgeSegmentPath(const std::filesystem::path& dir, uint32_t segment,
+                                        const char* extension)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "seg-%06u.%s", segment, extension);
+    return (dir / name).string();
+}
+
+// Segment numbers present in a store directory, ascending.
+inline std::vector<uint32_t> knowledgeListSegments(const std::filesystem::path& dir)
+{
+    std::vector<uint32_t> segments;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        const std::string name = entry.path().filename().string();
+        unsigned number = 0;
+        char ext[8] = {};
+        if (std::sscanf(name.c_str(), "seg-%6u.%3s", &number, ext) == 2 &&
+            std::strcmp(ext, "dat") == 0) {
+            segments.push_back(number);
+        }
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+inline std::vector<std::string> knowledgeLoadSources(const std::filesystem::path& dir)
+{
+    std::vector<std::string> sources;
+    std::ifstream in(dir / "sources.txt");
+    for (std::string line; std::getline(in, line);) {
+        sources.push_back(line);
+    }
+    return sources;
+}
+
+// Build the .idx of a segment from its .dat (written to a temporary file and
+// renamed, so readers never see a partial index).
+inline bool knowledgeSealSegment(const std::string& datPath, const std::string& idxPath,
+                                 std::string& error)
+{
+    MappedFile dat;
+    if (!dat.open(datPath)) {
+        error = "cannot map " + datPath;
+        return false;
+    }
+
+    std::vector<uint64_t> offsets;
+    std::vector<int64_t> times;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> postings;
+    knowledgeForEachRecord(dat, [&](size_t offset, const KnowledgeRecordHeader& h,
+                                    std::string_view payload) {
+        const auto record = static_cast<uint32_t>(offsets.size());
+        offsets.push_back(offset);
+        times.push_back(h.timeMs);
+        knowledgeForEachToken(knowledgeRecordText(payload), [&](std::string_view token) {
+            auto& list = postings[knowledgeTermHash(token)];
+            if (list.empty() || list.back() != record) {
+                list.push_back(record);
+            }
+        });
+    });
+
+    std::vector<KnowledgeBlock> blocks;
+    for (uint32_t first = 0; first < offsets.size(); first += kKnowledgeBlockRecords) {
+        const uint32_t count = std::min<uint32_t>(
+            kKnowledgeBlockRecords, static_cast<uint32_t>(offsets.size()) - first);
+        const auto [lo, hi] = std::minmax_element(times.begin() + first, times.begin() + first + count);
+        blocks.push_back({*lo, *hi, first, count});
+    }
+
+    std::vector<KnowledgeTerm> terms;
+    terms.reserve(postings.size());
+    for (const auto& [hash, list] : postings) {
+        terms.push_back({hash, 0, static_cast<uint32_t>(list.size())});
+    }
+    std::sort(terms.begin(), terms.end(),
+              [](const KnowledgeTerm& a, const KnowledgeTerm& b) { return a.hash < b.hash; });
+    uint32_t postingCount = 0;
+    for (auto& term : terms) {
+        term.firstPosting = postingCount;
+        postingCount += term.postingCount;
+    }
+
+    KnowledgeIndexHeader header{};
+    std::memcpy(header.magic, kKnowledgeIndexMagic, sizeof(header.magic));
+    header.recordCount = static_cast<uint32_t>(offsets.size());
+    header.blockCount = static_cast<uint32_t>(blocks.size());
+    header.termCount = static_cast<uint32_t>(terms.size());
+    header.postingCount = postingCount;
+    header.minTimeMs = times.empty() ? 0 : *std::min_element(times.begin(), times.end());
+    header.maxTimeMs = times.empty() ? 0 : *std::max_element(times.begin(), times.end());
+
+    const std::string tmpPath = idxPath + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        auto put = [&](const void* p, size_t n) {
+            out.write(static_cast<const char*>(p), static_cast<std::streamsize>(n));
+        };
+        put(&header, sizeof(header));
+        put(offsets.data(), offsets.size() * sizeof(uint64_t));
+        put(blocks.data(), blocks.size() * sizeof(KnowledgeBlock));
+        put(terms.data(), terms.size() * sizeof(KnowledgeTerm));
+        for (const auto& term : terms) {
+            const auto& list = postings[term.hash];
+            put(list.data(), list.size() * sizeof(uint32_t));
+        }
+        if (!out) {
+            error = "cannot write " + tmpPath;
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, idxPath, ec);
+    if (ec) {
+        error = "cannot rename " + tmpPath + ": " + ec.message();
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Writer
+//------------------------------------------------------------------------------
+
+// Appends records from any thread without blocking: append() only queues,
+// and a background thread writes, flushes and seals segments.
+class KnowledgeStoreWriter {
+public:
+    KnowledgeStoreWriter() = default;
+    ~KnowledgeStoreWriter()
+    {
+        close();
+        unlock();
+    }
+
+    KnowledgeStoreWriter(const KnowledgeStoreWriter&) = delete;
+    KnowledgeStoreWriter& operator=(const KnowledgeStoreWriter&) = delete;
+
+    bool open(const std::string& dir, std::string& error)
+    {
+        dir_ = dir;
+        std::error_code ec;
+        std::filesystem::create_directories(dir_, ec);
+        if (ec) {
+            error = "cannot create " + dir + ": " + ec.message();
+            return false;
+        }
+
+        // A second writer would reuse the segment number of the first one's
+        // live segment and seal it under it.
+        if (!lock(error)) {
+            return false;
+        }
+
+        const auto names = knowledgeLoadSources(dir_);
+        for (uint32_t i = 0; i < names.size(); ++i) {
+            sourceIds_.emplace(names[i], i);
+        }
+
+        // Seal whatever a previous writer left open, then start a new segment.
+        for (const uint32_t segment : knowledgeListSegments(dir_)) {
+            const std::string idx = knowledgeSegmentPath(dir_, segment, "idx");
+            if (!std::filesystem::exists(idx) &&
+                !knowledgeSealSegment(knowledgeSegmentPath(dir_, segment, "dat"), idx, error)) {
+                return false;
+            }
+            nextSegment_ = segment + 1;
+        }
+
+        sourcesFile_ = std::fopen((dir_ / "sources.txt").string().c_str(), "ab");
+        if (sourcesFile_ == nullptr) {
+            error = "cannot open " + (dir_ / "sources.txt").string();
+            return false;
+        }
+        thread_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    void append(KnowledgeRecord record)
+    {
+        pending_.fetch_add(1, std::memory_order_release);
+        queue_.push(std::move(record));
+        wake_.notify_one();
+    }
+
+    // Write everything queued, seal the current segment and stop.
+    void close()
+    {
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+        sealCurrent();
+        if (sourcesFile_ != nullptr) {
+            std::fclose(sourcesFile_);
+            sourcesFile_ = nullptr;
+        }
+        unlock();
+    }
+
+    uint64_t appended() const { return appended_.load(std::memory_order_relaxed); }
+
+private:
+    bool lock(std::string& error)
+    {
+        const std::string path = (dir_ / "LOCK").string();
+#ifdef _WIN32
+        // No sharing: a second open fails while this handle is open.
+        lockHandle_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (lockHandle_ == INVALID_HANDLE_VALUE) {
+            error = GetLastError() == ERROR_SHARING_VIOLATION
+                        ? dir_.string() + " is in use by another writer"
+                        : "cannot open " + path;
+            return false;
+        }
+#else
+        lockFd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lockFd_ < 0) {
+            error = "cannot open " + path;
+            return false;
+        }
+        if (::flock(lockFd_, LOCK_EX | LOCK_NB) != 0) {
+            error = dir_.string() + " is in use by another writer";
+            ::close(lockFd_);
+            lockFd_ = -1;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    void unlock()
+    {
+#ifdef _WIN32
+        if (lockHandle_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(lockHandle_);
+            lockHandle_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (lockFd_ >= 0) {
+            ::close(lockFd_);   // releases the flock
+            lockFd_ = -1;
+        }
+#endif
+    }
+
+    void run()
+    {
+        KnowledgeRecord record;
+        for (;;) {
+            bool stopping = false;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                wake_.wait_for(lock, std::chrono::seconds(1), [this] {
+                    return stop_ || pending_.load(std::memory_order_acquire) > 0;
+                });
+                stopping = stop_;
+            }
+
+            bool wrote = false;
+            while (queue_.pop(record)) {
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                write(record);
+                wrote = true;
+            }
+            // Flushed per batch so queries see results within a second.
+            if (wrote && dat_ != nullptr) {
+                std::fflush(dat_);
+            }
+
+            if (stopping && pending_.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+        }
+    }
+
+    uint32_t sourceId(const std::string& label)
+    {
+        const auto it = sourceIds_.find(label);
+        if (it != sourceIds_.end()) {
+            return it->second;
+        }
+        const auto id = static_cast<uint32_t>(sourceIds_.size());
+        sourceIds_.emplace(label, id);
+        // Labels are flushed before any record that refers to them.
+        std::fprintf(sourcesFile_, "%s\n", label.c_str());
+        std::fflush(sourcesFile_);
+        return id;
+    }
+
+    void write(const KnowledgeRecord& record)
+    {
+        if (dat_ == nullptr) {
+            currentSegment_ = nextSegment_++;
+            // "x": never truncate an existing segment.
+            dat_ = std::fopen(knowledgeSegmentPath(dir_, currentSegment_, "dat").c_str(), "wbx");
+            if (dat_ == nullptr) {
+                reportError("cannot create " + knowledgeSegmentPath(dir_, currentSegment_, "dat"));
+                return;
+            }
+            std::setvbuf(dat_, nullptr, _IOFBF, 1 << 18);
+            segmentRecords_ = 0;
+        }
+
+        KnowledgeRecordHeader h{};
+        h.magic = kKnowledgeRecordMagic;
+        h.payloadBytes = static_cast<uint32_t>(record.json.size());
+        h.timeMs = record.timeMs;
+        h.wallTimeMs = record.wallTimeMs;
+        h.sourceId = sourceId(record.source);
+        if (std::fwrite(&h, sizeof(h), 1, dat_) != 1 ||
+            std::fwrite(record.json.data(), 1, record.json.size(), dat_) != record.json.size()) {
+            reportError("write failed on " + knowledgeSegmentPath(dir_, currentSegment_, "dat"));
+        }
+        appended_.fetch_add(1, std::memory_order_relaxed);
+
+        if (++segmentRecords_ >= kKnowledgeSegmentRecords) {
+            sealCurrent();
+        }
+    }
+
+    void sealCurrent()
+    {
+        if (dat_ == nullptr) {
+            return;
+        }
+        std::fclose(dat_);
+        dat_ = nullptr;
+        std::string error;
+        if (!knowledgeSealSegment(knowledgeSegmentPath(dir_, currentSegment_, "dat"),
+                                  knowledgeSegmentPath(dir_, currentSegment_, "idx"), error)) {
+            reportError(error);
+        }
+    }
+
+    void reportError(const std::string& error)
+    {
+        if (!errorReported_) {
+            std::fprintf(stderr, "[ERROR] Knowledge store: %s\n", error.c_str());
+            errorReported_ = true;
+        }
+    }
+
+    std::filesystem::path dir_;
+    MpscQueue<KnowledgeRecord> queue_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<uint64_t> appended_{0};
+
+    std::mutex mtx_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::thread thread_;
+
+    // Writer thread only (and open/close around it).
+    std::unordered_map<std::string, uint32_t> sourceIds_;
+    std::FILE* sourcesFile_ = nullptr;
+    std::FILE* dat_ = nullptr;
+    uint32_t currentSegment_ = 0;
+    uint32_t nextSegment_ = 0;
+    uint32_t segmentRecords_ = 0;
+    bool errorReported_ = false;
+
+#ifdef _WIN32
+    HANDLE lockHandle_ = INVALID_HANDLE_VALUE;
+#else
+    int lockFd_ = -1;
+#endif
+};
+
+//------------------------------------------------------------------------------
+// Reader
+//------------------------------------------------------------------------------
+
+struct KnowledgeQuery {
+    std::vector<std::string> sources;   // empty = all sources
+    int64_t fromMs = std::numeric_limits<int64_t>::min();   // inclusive
+    int64_t toMs = std::numeric_limits<int64_t>::max();     // exclusive
+    std::vector<std::string> keywords;  // every word must occur in the text
+    size_t limit = 0;                   // 0 = all matches
+};
+
+struct KnowledgeMatch {
+    int64_t timeMs = 0;
+    int64_t wallTimeMs = 0;
+    std::string source;
+    std::string json;
+};
+
+struct KnowledgeStoreSummary {
+    size_t segments = 0;
+    size_t sealedSegments = 0;
+    uint64_t records = 0;
+    size_t sources = 0;
+    int64_t minTimeMs = 0;
+    int64_t maxTimeMs = 0;
+};
+
+// Read-only view of a store. Maps every segment at open(); a store that is
+// being written can be reopened to see newer results.
+class KnowledgeStoreReader {
+public:
+    bool open(const std::string& dir, std::string& error)
+    {
+        const std::filesystem::path path(dir);
+        if (!std::filesystem::is_directory(path)) {
+            error = dir + " is not a knowledge store directory";
+            return false;
+        }
+        sources_ = knowledgeLoadSources(path);
+        segments_.clear();
+        for (const uint32_t number : knowledgeListSegments(path)) {
+            auto segment = std::make_unique<Segment>();
+            if (!segment->dat.open(knowledgeSegmentPath(path, number, "dat"))) {
+                continue;
+            }
+            const std::string idxPath = knowledgeSegmentPath(path, number, "idx");
+            if (std::filesystem::exists(idxPath) && segment->idx.open(idxPath) &&
+                segment->idx.size() >= sizeof(KnowledgeIndexHeader)) {
+                segment->header = knowledgeLoad<KnowledgeIndexHeader>(segment->idx.data(), 0);
+                segment->sealed =
+                    std::memcmp(segment->header.magic, kKnowledgeIndexMagic, sizeof(kKnowledgeIndexMagic)) == 0 &&
+                    segment->idx.size() >= indexBytes(segment->header);
+            }
+            segments_.push_back(std::move(segment));
+        }
+        return true;
+    }
+
+    std::vector<KnowledgeMatch> query(const KnowledgeQuery& q) const
+    {
+        std::unordered_set<uint32_t> sourceFilter;
+        for (const auto& name : q.sources) {
+            const auto it = std::find(sources_.begin(), sources_.end(), name);
+            if (it != sources_.end()) {
+                sourceFilter.insert(static_cast<uint32_t>(it - sources_.begin()));
+            }
+        }
+        if (!q.sources.empty() && sourceFilter.empty()) {
+            return {};
+        }
+
+        // Every keyword must occur, so one without an indexable word (a
+        // single letter, punctuation) matches nothing rather than everything.
+        std::vector<uint64_t> termHashes;
+        for (const auto& keyword : q.keywords) {
+            const size_t before = termHashes.size();
+            knowledgeForEachToken(keyword, [&](std::string_view token) {
+                termHashes.push_back(knowledgeTermHash(token));
+            });
+            if (termHashes.size() == before) {
+                return {};
+            }
+        }
+        std::sort(termHashes.begin(), termHashes.end());
+        termHashes.erase(std::unique(termHashes.begin(), termHashes.end()), termHashes.end());
+
+        struct Hit {
+            int64_t timeMs;
+            size_t segment;
+            size_t offset;
+        };
+        std::vector<Hit> hits;
+
+        for (size_t s = 0; s < segments_.size(); ++s) {
+            const Segment& seg = *segments_[s];
+            auto consider = [&](size_t offset, const KnowledgeRecordHeader& h) {
+                if (h.timeMs >= q.fromMs && h.timeMs < q.toMs &&
+                    (sourceFilter.empty() || sourceFilter.count(h.sourceId) > 0)) {
+                    hits.push_back({h.timeMs, s, offset});
+                }
+            };
+
+            if (!seg.sealed) {
+                knowledgeForEachRecord(seg.dat, [&](size_t offset, const KnowledgeRecordHeader& h,
+                                                    std::string_view payload) {
+                    if (!termHashes.empty() && !textHasTerms(payload, termHashes)) {
+                        return;
+                    }
+                    consider(offset, h);
+                });
+                continue;
+            }
+
+            const KnowledgeIndexHeader& ih = seg.header;
+            if (ih.recordCount == 0 || ih.maxTimeMs < q.fromMs || ih.minTimeMs >= q.toMs) {
+                continue;
+            }
+            // Index entries are checked against the .dat before use, so a
+            // damaged or foreign .idx skips records instead of reading past
+            // the mapping.
+            auto visitRecord = [&](uint32_t record) {
+                if (record >= ih.recordCount) {
+                    return;
+                }
+                const uint64_t offset =
+                    knowledgeLoad<uint64_t>(seg.idx.data(), sizeof(KnowledgeIndexHeader), record);
+                KnowledgeRecordHeader h{};
+                if (recordAt(seg.dat, offset, h)) {
+                    consider(static_cast<size_t>(offset), h);
+                }
+            };
+
+            if (!termHashes.empty()) {
+                for (const uint32_t record : postingsIntersection(seg, termHashes)) {
+                    visitRecord(record);
+                }
+                continue;
+            }
+
+            const size_t blocksAt = sizeof(KnowledgeIndexHeader) + ih.recordCount * sizeof(uint64_t);
+            for (uint32_t b = 0; b < ih.blockCount; ++b) {
+                const auto block = knowledgeLoad<KnowledgeBlock>(seg.idx.data(), blocksAt, b);
+                if (block.maxTimeMs < q.fromMs || block.minTimeMs >= q.toMs ||
+                    block.firstRecord >= ih.recordCount) {
+                    continue;
+                }
+                const uint32_t count = std::min(block.recordCount, ih.recordCount - block.firstRecord);
+                for (uint32_t r = 0; r < count; ++r) {
+                    visitRecord(block.firstRecord + r);
+                }
+            }
+        }
+
+        std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) {
+            return a.timeMs != b.timeMs ? a.timeMs < b.timeMs
+                                        : (a.segment != b.segment ? a.segment < b.segment
+                                                                  : a.offset < b.offset);
+        });
+        if (q.limit > 0 && hits.size() > q.limit) {
+            hits.resize(q.limit);
+        }
+
+        std::vector<KnowledgeMatch> matches;
+        matches.reserve(hits.size());
+        for (const Hit& hit : hits) {
+            const MappedFile& dat = segments_[hit.segment]->dat;
+            const auto h = knowledgeLoad<KnowledgeRecordHeader>(dat.data(), hit.offset);
+            KnowledgeMatch m;
+            m.timeMs = h.timeMs;
+            m.wallTimeMs = h.wallTimeMs;
+            m.source = h.sourceId < sources_.size() ? sources_[h.sourceId] : std::to_string(h.sourceId);
+            m.json.assign(reinterpret_cast<const char*>(dat.data()) + hit.offset + sizeof(KnowledgeRecordHeader),
+                          h.payloadBytes);
+            matches.push_back(std::move(m));
+        }
+        return matches;
+    }
+
+    KnowledgeStoreSummary summary() const
+    {
+        KnowledgeStoreSummary out;
+        out.segments = segments_.size();
+        out.sources = sources_.size();
+        bool first = true;
+        auto extend = [&](int64_t t) {
+            out.minTimeMs = first ? t : std::min(out.minTimeMs, t);
+            out.maxTimeMs = first ? t : std::max(out.maxTimeMs, t);
+            first = false;
+        };
+        for (const auto& seg : segments_) {
+            if (seg->sealed) {
+                ++out.sealedSegments;
+                out.records += seg->header.recordCount;
+                if (seg->header.recordCount > 0) {
+                    extend(seg->header.minTimeMs);
+                    extend(seg->header.maxTimeMs);
+                }
+            } else {
+                knowledgeForEachRecord(seg->dat, [&](size_t, const KnowledgeRecordHeader& h, std::string_view) {
+                    ++out.records;
+                    extend(h.timeMs);
+                });
+            }
+        }
+        return out;
+    }
+
+private:
+    struct Segment {
+        MappedFile dat;
+        MappedFile idx;
+        KnowledgeIndexHeader header{};
+        bool sealed = false;
+    };
+
+    static size_t indexBytes(const KnowledgeIndexHeader& h)
+    {
+        return sizeof(KnowledgeIndexHeader) + size_t{h.recordCount} * sizeof(uint64_t) +
+               size_t{h.blockCount} * sizeof(KnowledgeBlock) +
+               size_t{h.termCount} * sizeof(KnowledgeTerm) + size_t{h.postingCount} * sizeof(uint32_t);
+    }
+
+    // Header of the record at offset, if it lies wholly inside the .dat.
+    static bool recordAt(const MappedFile& dat, uint64_t offset, KnowledgeRecordHeader& h)
+    {
+        if (dat.size() < sizeof(KnowledgeRecordHeader) || offset > dat.size() - sizeof(KnowledgeRecordHeader)) {
+            return false;
+        }
+        h = knowledgeLoad<KnowledgeRecordHeader>(dat.data(), static_cast<size_t>(offset));
+        return h.magic == kKnowledgeRecordMagic &&
+               h.payloadBytes <= dat.size() - static_cast<size_t>(offset) - sizeof(KnowledgeRecordHeader);
+    }
+
+    static bool textHasTerms(std::string_view payload, const std::vector<uint64_t>& termHashes)
+    {
+        std::unordered_set<uint64_t> found;
+        knowledgeForEachToken(knowledgeRecordText(payload), [&](std::string_view token) {
+            found.insert(knowledgeTermHash(token));
+        });
+        return std::all_of(termHashes.begin(), termHashes.end(),
+                           [&](uint64_t h) { return found.count(h) > 0; });
+    }
+
+    // Record numbers containing every term (binary search in the sorted term
+    // table, then intersection starting from the shortest postings list).
+    static std::vector<uint32_t> postingsIntersection(const Segment& seg,
+                                                      const std::vector<uint64_t>& termHashes)
+    {
+        const KnowledgeIndexHeader& ih = seg.header;
+        const size_t termsAt = sizeof(KnowledgeIndexHeader) + ih.recordCount * sizeof(uint64_t) +
+                               ih.blockCount * sizeof(KnowledgeBlock);
+        const size_t postingsAt = termsAt + ih.termCount * sizeof(KnowledgeTerm);
+
+        std::vector<KnowledgeTerm> found;
+        for (const uint64_t hash : termHashes) {
+            uint32_t lo = 0;
+            uint32_t hi = ih.termCount;
+            while (lo < hi) {
+                const uint32_t mid = lo + (hi - lo) / 2;
+                if (knowledgeLoad<KnowledgeTerm>(seg.idx.data(), termsAt, mid).hash < hash) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (lo == ih.termCount) {
+                return {};
+            }
+            const auto term = knowledgeLoad<KnowledgeTerm>(seg.idx.data(), termsAt, lo);
+            if (term.hash != hash || term.firstPosting > ih.postingCount ||
+                term.postingCount > ih.postingCount - term.firstPosting) {
+                return {};
+            }
+            found.push_back(term);
+        }
+        std::sort(found.begin(), found.end(), [](const KnowledgeTerm& a, const KnowledgeTerm& b) {
+            return a.postingCount < b.postingCount;
+        });
+
+        auto load = [&](const KnowledgeTerm& term) {
+            std::vector<uint32_t> list(term.postingCount);
+            std::memcpy(list.data(), seg.idx.data() + postingsAt + size_t{term.firstPosting} * sizeof(uint32_t),
+                        list.size() * sizeof(uint32_t));
+            return list;
+        };
+        std::vector<uint32_t> result = load(found.front());
+        for (size_t i = 1; i < found.size() && !result.empty(); ++i) {
+            const std::vector<uint32_t> next = load(found[i]);
+            std::vector<uint32_t> merged;
+            std::set_intersection(result.begin(), result.end(), next.begin(), next.end(),
+                                  std::back_inserter(merged));
+            result.swap(merged);
+        }
+        return result;
+    }
+
+    std::vector<std::string> sources_;
+    std::vector<std::unique_ptr<Segment>> segments_;
+};
@@ -0,0 +1,173 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Round-trip tests of knowledge_store.hpp: records written across a segment
+// boundary come back from sealed and unsealed segments with time-range,
+// source and keyword filters, and damaged files are read without crashing.
+//
+// Usage: knowledge_store_test.exe (run by ctest)
+#include "knowledge_store.hpp"
+#include "test_check.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+constexpr int64_t kBaseMs = 1700000000000;
+constexpr uint32_t kRecords = kKnowledgeSegmentRecords + 100;   // one full segment and a partial one
+
+// Record i: one per second, alternating between two sources; every 100th
+// odd record mentions an alarm.
+static KnowledgeRecord makeRecord(uint32_t i)
+{
+    KnowledgeRecord r;
+    r.source = i % 2 == 0 ? "cam1" : "cam2";
+    r.timeMs = kBaseMs + int64_t{i} * 1000;
+    r.wallTimeMs = r.timeMs + 250;
+    const std::string text = "Frame " + std::to_string(i) + (i % 100 == 1 ? ": Alarm raised" : ": quiet ward");
+    r.json = nlohmann::json{{"source", r.source}, {"text", text}}.dump();
+    return r;
+}
+
+static std::vector<KnowledgeMatch> runQuery(const std::string& dir, const KnowledgeQuery& q)
+{
+    KnowledgeStoreReader reader;
+    std::string error;
+    if (!reader.open(dir, error)) {
+        std::cerr << error << "\n";
+        return {};
+    }
+    return reader.query(q);
+}
+
+// All records, the two sources, a time range, a keyword and a limit.
+static void checkQueries(const std::string& dir, uint32_t expectedRecords)
+{
+    KnowledgeQuery all;
+    const auto matches = runQuery(dir, all);
+    CHECK(matches.size() == expectedRecords);
+    bool ordered = true;
+    bool intact = true;
+    for (uint32_t i = 0; i < matches.size(); ++i) {
+        const KnowledgeRecord want = makeRecord(i);
+        ordered = ordered && matches[i].timeMs == want.timeMs;
+        intact = intact && matches[i].json == want.json && matches[i].source == want.source &&
+                 matches[i].wallTimeMs == want.wallTimeMs;
+    }
+    CHECK(ordered);
+    CHECK(intact);
+
+    KnowledgeQuery range;
+    range.fromMs = kBaseMs + 5000;
+    range.toMs = kBaseMs + 8000;
+    const auto inRange = runQuery(dir, range);
+    CHECK(inRange.size() == 3 && inRange.front().timeMs == kBaseMs + 5000);
+
+    // Spans the boundary between the sealed and the last segment.
+    KnowledgeQuery boundary;
+    boundary.fromMs = kBaseMs + int64_t{kKnowledgeSegmentRecords - 2} * 1000;
+    boundary.toMs = kBaseMs + int64_t{kKnowledgeSegmentRecords + 2} * 1000;
+    CHECK(runQuery(dir, boundary).size() == 4);
+
+    KnowledgeQuery alarms;
+    alarms.sources = {"cam2"};
+    alarms.keywords = {"ALARM"};
+    uint32_t expectedAlarms = 0;
+    for (uint32_t i = 0; i < expectedRecords; ++i) {
+        expectedAlarms += i % 100 == 1 ? 1 : 0;
+    }
+    const auto found = runQuery(dir, alarms);
+    CHECK(found.size() == expectedAlarms);
+    CHECK(!found.empty() && knowledgeRecordText(found.front().json) == "Frame 1: Alarm raised");
+
+    // A keyword without an indexable word matches nothing, not everything.
+    KnowledgeQuery noTerm;
+    noTerm.keywords = {"a"};
+    CHECK(runQuery(dir, noTerm).empty());
+    noTerm.keywords = {"alarm", "?!"};
+    CHECK(runQuery(dir, noTerm).empty());
+
+    KnowledgeQuery unknownSource;
+    unknownSource.sources = {"cam9"};
+    CHECK(runQuery(dir, unknownSource).empty());
+
+    KnowledgeQuery limited;
+    limited.limit = 10;
+    const auto first = runQuery(dir, limited);
+    CHECK(first.size() == 10 && first.back().timeMs == kBaseMs + 9000);
+}
+
+int main()
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "knowledge_store_test";
+    std::filesystem::remove_all(dir);
+
+    {
+        KnowledgeStoreWriter writer;
+        std::string error;
+        CHECK(writer.open(dir.string(), error));
+        for (uint32_t i = 0; i < kRecords; ++i) {
+            writer.append(makeRecord(i));
+        }
+        writer.close();
+        CHECK(writer.appended() == kRecords);
+    }
+
+    KnowledgeStoreReader reader;
+    std::string error;
+    CHECK(reader.open(dir.string(), error));
+    const KnowledgeStoreSummary summary = reader.summary();
+    CHECK(summary.segments == 2 && summary.sealedSegments == 2);
+    CHECK(summary.records == kRecords && summary.sources == 2);
+    CHECK(summary.minTimeMs == kBaseMs && summary.maxTimeMs == kBaseMs + int64_t{kRecords - 1} * 1000);
+
+    // Sealed segments, through their indexes.
+    checkQueries(dir.string(), kRecords);
+
+    // The last segment as a crash leaves it: no index and a torn record at
+    // the end. Queries scan it and ignore the torn tail.
+    const std::string lastDat = knowledgeSegmentPath(dir, 1, "dat");
+    const std::string lastIdx = knowledgeSegmentPath(dir, 1, "idx");
+    std::filesystem::remove(lastIdx);
+    {
+        std::ofstream dat(lastDat, std::ios::binary | std::ios::app);
+        const KnowledgeRecordHeader torn{kKnowledgeRecordMagic, 1000, kBaseMs, kBaseMs, 0, 0};
+        dat.write(reinterpret_cast<const char*>(&torn), sizeof(torn));
+        dat.write("{\"text\":", 8);
+    }
+    checkQueries(dir.string(), kRecords);
+
+    // The next writer seals it again.
+    {
+        KnowledgeStoreWriter writer;
+        CHECK(writer.open(dir.string(), error));
+        CHECK(std::filesystem::exists(lastIdx));
+    }
+    checkQueries(dir.string(), kRecords);
+
+    // A damaged index entry pointing past the .dat drops that record only.
+    {
+        std::fstream idx(knowledgeSegmentPath(dir, 0, "idx"), std::ios::binary | std::ios::in | std::ios::out);
+        const uint64_t pastEnd = uint64_t{1} << 62;
+        idx.seekp(sizeof(KnowledgeIndexHeader) + 5 * sizeof(uint64_t));
+        idx.write(reinterpret_cast<const char*>(&pastEnd), sizeof(pastEnd));
+    }
+    CHECK(runQuery(dir.string(), KnowledgeQuery{}).size() == kRecords - 1);
+
+    std::filesystem::remove_all(dir);
+    return testResult("knowledge_store");
+}
@@ -0,0 +1,856 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// In-process probing of media files: when the recording started and when
+// each video frame is presented, read straight from the container instead of
+// spawning ffprobe.
+//
+// Two container families are parsed:
+// - ISO BMFF / QuickTime (.mp4, .mov, .m4v, .3gp): creation_time from mvhd
+//   (or the video track's mdhd), the producer reference time of a prft box,
+//   and the sample times of the first video track from stts/ctts, shifted by
+//   its edit list, with its sync samples (stss) as keyframes
+// - Matroska / WebM (.mkv, .webm): Info/DateUTC, the keyframes of the first
+//   video track from the Cues index, and, only when asked for, the block
+//   timestamps of that track, collected by walking the clusters (block
+//   payloads are skipped, only their headers are read). Files without Cues
+//   take their keyframes from the block flags of that walk
+//
+// Anything else (AVI, MPEG-TS, URLs) is reported as not probed, and
+// fragmented MP4 without a sample table as probed without frame times, so
+// callers can fall back to ffprobe and to the capture backend's timeline.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct MediaProbe {
+    std::string container;   // "mp4" or "matroska"
+
+    // Wall-clock time of the first frame, from an MP4 prft box.
+    std::optional<std::chrono::system_clock::time_point> startTimeRealtime;
+
+    // Creation time stored in the container (UTC).
+    std::optional<std::chrono::system_clock::time_point> creationTime;
+
+    // Presentation time of every video frame in output order, in seconds
+    // from the first one (decoders report that frame as position 0). For
+    // Matroska only filled when probeMedia() is asked for frame times.
+    std::vector<double> framePtsSec;
+
+    // The keyframes (decodable on their own) on the same scale, sorted.
+    std::vector<double> keyframePtsSec;
+};
+
+namespace media_probe_detail {
+
+// Corrupt sample tables must not make us allocate without bound; this is
+// over three weeks of 30 fps video.
+constexpr uint64_t kMaxFrames = uint64_t{1} << 26;
+
+// Whole boxes/elements that are read into memory (moov, Info, Tracks).
+constexpr uint64_t kMaxHeaderBytes = uint64_t{256} << 20;
+
+// Random-access reads from a file.
+class FileReader {
+public:
+    explicit FileReader(const std::string& path) : in_(path, std::ios::binary)
+    {
+        if (in_) {
+            in_.seekg(0, std::ios::end);
+            size_ = static_cast<uint64_t>(in_.tellg());
+        }
+    }
+
+    bool isOpen() const { return in_.is_open(); }
+    uint64_t size() const { return size_; }
+
+    bool read(uint64_t offset, void* out, size_t n)
+    {
+        if (offset > size_ || n > size_ - offset) {
+            return false;
+        }
+        in_.clear();
+        in_.seekg(static_cast<std::streamoff>(offset));
+        in_.read(static_cast<char*>(out), static_cast<std::streamsize>(n));
+        return in_.gcount() == static_cast<std::streamsize>(n);
+    }
+
+    bool read(uint64_t offset, std::vector<uint8_t>& out, uint64_t n)
+    {
+        if (n > kMaxHeaderBytes) {
+            return false;
+        }
+        out.resize(static_cast<size_t>(n));
+        return read(offset, out.data(), out.size());
+    }
+
+private:
+    std::ifstream in_;
+    uint64_t size_ = 0;
+};
+
+inline uint64_t readBE(const uint8_t* p, size_t n)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// Container timestamps outside 1970-01-01 .. 2200-01-01 UTC are corrupt or
+// unset; rejecting them also keeps the microsecond conversion from overflowing.
+constexpr int64_t kMaxUnixSec = 7258118400;
+
+inline std::optional<std::chrono::system_clock::time_point> unixTime(int64_t sec, int64_t micros = 0)
+{
+    if (sec < 0 || sec >= kMaxUnixSec || micros < 0 || micros >= 1000000) {
+        return std::nullopt;
+    }
+    return std::chrono::system_clock::time_point{} +
+           std::chrono::duration_cast<std::chrono::system_clock::duration>(
+               std::chrono::seconds(sec) + std::chrono::microseconds(micros));
+}
+
+// Store presentation times in seconds as offsets from the first frame,
+// sorted; `keyframes` is a subset of `times` and shifted by the same origin.
+// Without `times` the first keyframe, where decoding starts, is the origin.
+inline void setFrameTimes(MediaProbe& out, std::vector<double> times, std::vector<double> keyframes)
+{
+    std::sort(times.begin(), times.end());
+    std::sort(keyframes.begin(), keyframes.end());
+    keyframes.erase(std::unique(keyframes.begin(), keyframes.end()), keyframes.end());
+    if (!times.empty() || !keyframes.empty()) {
+        const double first = times.empty() ? keyframes.front() : times.front();
+        for (double& t : times) {
+            t -= first;
+        }
+        for (double& t : keyframes) {
+            t -= first;
+        }
+    }
+    out.framePtsSec = std::move(times);
+    out.keyframePtsSec = std::move(keyframes);
+}
+
+//------------------------------------------------------------------------------
+// ISO BMFF / QuickTime
+//------------------------------------------------------------------------------
+
+struct Mp4Track {
+    uint32_t id = 0;
+    bool video = false;
+    uint32_t timescale = 0;
+    uint64_t creation = 0;                              // seconds since 1904
+    std::vector<std::pair<uint32_t, uint32_t>> stts;    // sample count, delta
+    std::vector<std::pair<uint32_t, int32_t>> ctts;     // sample count, offset
+    std::vector<uint32_t> stss;                         // sync sample numbers, from 1
+    bool hasStss = false;                               // absent: every sample is sync
+    int64_t editMediaTime = 0;                          // first media time shown
+    uint64_t emptyEditDuration = 0;                     // movie timescale
+};
+
+struct Mp4Movie {
+    uint32_t timescale = 0;
+    uint64_t creation = 0;
+    std::vector<Mp4Track> tracks;
+
+    bool hasPrft = false;
+    uint32_t prftTrackId = 0;
+    uint64_t prftNtp = 0;        // 32.32 fixed point, seconds since 1900
+    uint64_t prftMediaTime = 0;  // in the reference track's timescale
+};
+
+// Call fn(type, payload, size) for each box in [p, p + n).
+inline void forEachBox(const uint8_t* p, uint64_t n,
+                       const std::function<void(uint32_t, const uint8_t*, uint64_t)>& fn)
+{
+    uint64_t off = 0;
+    while (n - off >= 8) {
+        uint64_t size = readBE(p + off, 4);
+        const uint32_t type = static_cast<uint32_t>(readBE(p + off + 4, 4));
+        uint64_t header = 8;
+        if (size == 1) {
+            if (n - off < 16) {
+                return;
+            }
+            size = readBE(p + off + 8, 8);
+            header = 16;
+        } else if (size == 0) {
+            size = n - off;
+        }
+        if (size < header || size > n - off) {
+            return;
+        }
+        fn(type, p + off + header, size - header);
+        off += size;
+    }
+}
+
+constexpr uint32_t fourcc(const char (&s)[5])
+{
+    return (uint32_t(uint8_t(s[0])) << 24) | (uint32_t(uint8_t(s[1])) << 16) |
+           (uint32_t(uint8_t(s[2])) << 8) | uint32_t(uint8_t(s[3]));
+}
+
+inline void parseMp4Track(const uint8_t* p, uint64_t n, Mp4Movie& movie)
+{
+    Mp4Track track;
+    const std::function<void(uint32_t, const uint8_t*, uint64_t)> visit =
+        [&](uint32_t type, const uint8_t* b, uint64_t len) {
+            if (type == fourcc("edts") || type == fourcc("mdia") || type == fourcc("minf") ||
+                type == fourcc("stbl")) {
+                forEachBox(b, len, visit);
+            } else if (type == fourcc("tkhd") && len >= 24) {
+                track.id = static_cast<uint32_t>(readBE(b + (b[0] == 1 ? 20 : 12), 4));
+            } else if (type == fourcc("mdhd") && len >= 24) {
+                if (b[0] == 1 && len >= 32) {
+                    track.creation = readBE(b + 4, 8);
+                    track.timescale = static_cast<uint32_t>(readBE(b + 20, 4));
+                } else {
+                    track.creation = readBE(b + 4, 4);
+                    track.timescale = static_cast<uint32_t>(readBE(b + 12, 4));
+                }
+            } else if (type == fourcc("hdlr") && len >= 12) {
+                track.video = readBE(b + 8, 4) == fourcc("vide");
+            } else if (type == fourcc("elst") && len >= 8) {
+                const bool v1 = b[0] == 1;
+                const uint64_t entrySize = v1 ? 20 : 12;
+                const uint64_t count = std::min<uint64_t>(readBE(b + 4, 4), (len - 8) / entrySize);
+                for (uint64_t i = 0; i < count; ++i) {
+                    const uint8_t* e = b + 8 + i * entrySize;
+                    const uint64_t duration = readBE(e, v1 ? 8 : 4);
+                    const int64_t mediaTime = v1 ? static_cast<int64_t>(readBE(e + 8, 8))
+                                                 : static_cast<int32_t>(readBE(e + 4, 4));
+                    if (mediaTime < 0) {
+                        track.emptyEditDuration += duration;   // empty edit: a delay
+                        continue;
+                    }
+                    track.editMediaTime = mediaTime;
+                    break;
+                }
+            } else if (type == fourcc("stts") && len >= 8) {
+                const uint64_t count = std::min<uint64_t>(readBE(b + 4, 4), (len - 8) / 8);
+                for (uint64_t i = 0; i < count; ++i) {
+                    track.stts.emplace_back(static_cast<uint32_t>(readBE(b + 8 + i * 8, 4)),
+                                            static_cast<uint32_t>(readBE(b + 12 + i * 8, 4)));
+                }
+            } else if (type == fourcc("stss") && len >= 8) {
+                track.hasStss = true;
+                const uint64_t count = std::min<uint64_t>(readBE(b + 4, 4), (len - 8) / 4);
+                for (uint64_t i = 0; i < count; ++i) {
+                    track.stss.push_back(static_cast<uint32_t>(readBE(b + 8 + i * 4, 4)));
+                }
+            } else if (type == fourcc("ctts") && len >= 8) {
+                // Version 0 offsets are unsigned by the spec but written as
+                // signed by common muxers; reading them as signed fits both.
+                const uint64_t count = std::min<uint64_t>(readBE(b + 4, 4), (len - 8) / 8);
+                for (uint64_t i = 0; i < count; ++i) {
+                    track.ctts.emplace_back(static_cast<uint32_t>(readBE(b + 8 + i * 8, 4)),
+                                            static_cast<int32_t>(readBE(b + 12 + i * 8, 4)));
+                }
+            }
+        };
+    forEachBox(p, n, visit);
+    movie.tracks.push_back(std::move(track));
+}
+
+inline void parseMp4Moov(const uint8_t* p, uint64_t n, Mp4Movie& movie)
+{
+    forEachBox(p, n, [&](uint32_t type, const uint8_t* b, uint64_t len) {
+        if (type == fourcc("mvhd") && len >= 20) {
+            if (b[0] == 1 && len >= 28) {
+                movie.creation = readBE(b + 4, 8);
+                movie.timescale = static_cast<uint32_t>(readBE(b + 20, 4));
+            } else {
+                movie.creation = readBE(b + 4, 4);
+                movie.timescale = static_cast<uint32_t>(readBE(b + 12, 4));
+            }
+        } else if (type == fourcc("trak")) {
+            parseMp4Track(b, len, movie);
+        }
+    });
+}
+
+inline void parseMp4Prft(const uint8_t* b, uint64_t len, Mp4Movie& movie)
+{
+    const bool v1 = len >= 1 && b[0] == 1;
+    if (len < (v1 ? 24u : 20u)) {
+        return;
+    }
+    movie.hasPrft = true;
+    movie.prftTrackId = static_cast<uint32_t>(readBE(b + 4, 4));
+    movie.prftNtp = readBE(b + 8, 8);
+    movie.prftMediaTime = readBE(b + 16, v1 ? 8 : 4);
+}
+
+// Composition times of a track's samples after its edit list, in seconds,
+// and those of its sync samples; samples the edit list cuts off are left
+// out. Empty if there is no table.
+inline void mp4SampleTimes(const Mp4Track& track, uint32_t movieTimescale, std::vector<double>& times,
+                           std::vector<double>& keyframes)
+{
+    if (track.timescale == 0) {
+        return;
+    }
+    uint64_t total = 0;
+    for (const auto& [count, delta] : track.stts) {
+        total += count;
+    }
+    if (total == 0 || total > kMaxFrames) {
+        return;
+    }
+
+    std::vector<int64_t> cts;
+    cts.reserve(static_cast<size_t>(total));
+    int64_t dts = 0;
+    for (const auto& [count, delta] : track.stts) {
+        for (uint32_t i = 0; i < count; ++i) {
+            cts.push_back(dts);
+            dts += delta;
+        }
+    }
+    size_t idx = 0;
+    for (const auto& [count, offset] : track.ctts) {
+        for (uint32_t i = 0; i < count && idx < cts.size(); ++i) {
+            cts[idx++] += offset;
+        }
+    }
+
+    const double delay = movieTimescale > 0
+                             ? static_cast<double>(track.emptyEditDuration) / movieTimescale
+                             : 0.0;
+    std::vector<uint32_t> sync = track.stss;
+    std::sort(sync.begin(), sync.end());
+    auto nextSync = sync.begin();
+
+    times.reserve(cts.size());
+    for (size_t i = 0; i < cts.size(); ++i) {
+        while (nextSync != sync.end() && *nextSync < i + 1) {
+            ++nextSync;
+        }
+        const bool isSync = !track.hasStss || (nextSync != sync.end() && *nextSync == i + 1);
+        if (cts[i] < track.editMediaTime) {
+            continue;
+        }
+        const double t = static_cast<double>(cts[i] - track.editMediaTime) / track.timescale + delay;
+        times.push_back(t);
+        if (isSync) {
+            keyframes.push_back(t);
+        }
+    }
+}
+
+inline bool probeMp4(FileReader& file, MediaProbe& out)
+{
+    static const uint32_t kTopLevel[] = {
+        fourcc("ftyp"), fourcc("moov"), fourcc("mdat"), fourcc("free"), fourcc("skip"),
+        fourcc("wide"), fourcc("pnot"), fourcc("styp"), fourcc("sidx"),
+    };
+
+    Mp4Movie movie;
+    bool first = true;
+    bool sawMoov = false;
+    uint64_t off = 0;
+    while (file.size() - off >= 8) {
+        uint8_t h[16];
+        if (!file.read(off, h, 8)) {
+            break;
+        }
+        uint64_t size = readBE(h, 4);
+        const uint32_t type = static_cast<uint32_t>(readBE(h + 4, 4));
+        uint64_t header = 8;
+        if (size == 1) {
+            if (!file.read(off + 8, h + 8, 8)) {
+                break;
+            }
+            size = readBE(h + 8, 8);
+            header = 16;
+        } else if (size == 0) {
+            size = file.size() - off;
+        }
+        if (first && std::find(std::begin(kTopLevel), std::end(kTopLevel), type) == std::end(kTopLevel)) {
+            return false;
+        }
+        first = false;
+        if (size < header || size > file.size() - off) {
+            break;   // truncated file: keep what was read so far
+        }
+
+        std::vector<uint8_t> payload;
+        if (type == fourcc("moov") && file.read(off + header, payload, size - header)) {
+            parseMp4Moov(payload.data(), payload.size(), movie);
+            sawMoov = true;
+        } else if (type == fourcc("prft") && file.read(off + header, payload, size - header)) {
+            parseMp4Prft(payload.data(), payload.size(), movie);
+        }
+        off += size;
+    }
+    if (!sawMoov) {
+        return false;
+    }
+
+    out.container = "mp4";
+    const Mp4Track* video = nullptr;
+    for (const auto& track : movie.tracks) {
+        if (track.video) {
+            video = &track;
+            break;
+        }
+    }
+
+    // QuickTime epoch: 1904-01-01 UTC. Zero means "not set".
+    constexpr int64_t kMp4EpochToUnix = 2082844800;
+    const uint64_t creation = movie.creation != 0 ? movie.creation : (video ? video->creation : 0);
+    if (creation > static_cast<uint64_t>(kMp4EpochToUnix) &&
+        creation - kMp4EpochToUnix < static_cast<uint64_t>(kMaxUnixSec)) {
+        out.creationTime = unixTime(static_cast<int64_t>(creation - kMp4EpochToUnix));
+    }
+
+    double originSec = 0.0;   // presentation time of the first frame
+    if (video != nullptr) {
+        std::vector<double> times;
+        std::vector<double> keyframes;
+        mp4SampleTimes(*video, movie.timescale, times, keyframes);
+        if (!times.empty()) {
+            originSec = *std::min_element(times.begin(), times.end());
+        }
+        setFrameTimes(out, std::move(times), std::move(keyframes));
+    }
+
+    if (movie.hasPrft) {
+        const Mp4Track* ref = nullptr;
+        for (const auto& track : movie.tracks) {
+            if (track.id == movie.prftTrackId) {
+                ref = &track;
+            }
+        }
+        constexpr int64_t kNtpToUnix = 2208988800;
+        const int64_t ntpSec = static_cast<int64_t>(movie.prftNtp >> 32);
+        if (ref != nullptr && ref->timescale > 0 && ntpSec > kNtpToUnix) {
+            const double fraction = static_cast<double>(movie.prftNtp & 0xFFFFFFFFu) / 4294967296.0;
+            // Map the reference media time through the edit list, like the
+            // sample times above.
+            double refSec = static_cast<double>(static_cast<int64_t>(movie.prftMediaTime) -
+                                                ref->editMediaTime) / ref->timescale;
+            if (movie.timescale > 0) {
+                refSec += static_cast<double>(ref->emptyEditDuration) / movie.timescale;
+            }
+            const double startUnixSec =
+                static_cast<double>(ntpSec - kNtpToUnix) + fraction - (refSec - originSec);
+            if (startUnixSec >= 0.0 && startUnixSec < static_cast<double>(kMaxUnixSec)) {
+                const double wholeSec = std::floor(startUnixSec);
+                int64_t sec = static_cast<int64_t>(wholeSec);
+                int64_t micros = std::llround((startUnixSec - wholeSec) * 1e6);
+                if (micros >= 1000000) {
+                    ++sec;
+                    micros -= 1000000;
+                }
+                out.startTimeRealtime = unixTime(sec, micros);
+            }
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Matroska / WebM
+//------------------------------------------------------------------------------
+
+constexpr uint32_t kEbmlHeader = 0x1A45DFA3;
+constexpr uint32_t kSegment = 0x18538067;
+constexpr uint32_t kInfo = 0x1549A966;
+constexpr uint32_t kTimecodeScale = 0x2AD7B1;
+constexpr uint32_t kDateUtc = 0x4461;
+constexpr uint32_t kTracks = 0x1654AE6B;
+constexpr uint32_t kTrackEntry = 0xAE;
+constexpr uint32_t kTrackNumber = 0xD7;
+constexpr uint32_t kTrackType = 0x83;
+constexpr uint32_t kCluster = 0x1F43B675;
+constexpr uint32_t kClusterTimecode = 0xE7;
+constexpr uint32_t kSimpleBlock = 0xA3;
+constexpr uint32_t kBlockGroup = 0xA0;
+constexpr uint32_t kBlock = 0xA1;
+constexpr uint32_t kReferenceBlock = 0xFB;
+constexpr uint32_t kSeekHead = 0x114D9B74;
+constexpr uint32_t kSeek = 0x4DBB;
+constexpr uint32_t kSeekId = 0x53AB;
+constexpr uint32_t kSeekPosition = 0x53AC;
+constexpr uint32_t kCues = 0x1C53BB6B;
+constexpr uint32_t kCuePoint = 0xBB;
+constexpr uint32_t kCueTime = 0xB3;
+constexpr uint32_t kCueTrackPositions = 0xB7;
+constexpr uint32_t kCueTrack = 0xF7;
+
+// Level-1 elements; one of these ends a cluster of unknown size.
+inline bool isSegmentChild(uint32_t id)
+{
+    switch (id) {
+    case kSeekHead:
+    case kInfo:
+    case kTracks:
+    case kCluster:
+    case kCues:
+    case 0x1254C367:   // Tags
+    case 0x1043A770:   // Chapters
+    case 0x1941A469:   // Attachments
+        return true;
+    default:
+        return false;
+    }
+}
+
+struct EbmlElement {
+    uint32_t id = 0;
+    uint64_t dataOffset = 0;
+    uint64_t size = 0;
+    bool unknownSize = false;
+};
+
+// Decode an EBML variable-length integer. IDs keep their length marker,
+// sizes do not.
+inline bool readVint(const uint8_t* p, size_t avail, bool keepMarker, uint64_t& value, size_t& length,
+                     bool* allOnes = nullptr)
+{
+    if (avail == 0 || p[0] == 0) {
+        return false;
+    }
+    length = 1;
+    while (!(p[0] & (0x80 >> (length - 1)))) {
+        ++length;
+    }
+    if (length > avail || length > 8) {
+        return false;
+    }
+    const uint8_t firstMask = static_cast<uint8_t>(0xFF >> length);
+    value = keepMarker ? p[0] : (p[0] & firstMask);
+    bool ones = (p[0] & firstMask) == firstMask;
+    for (size_t i = 1; i < length; ++i) {
+        value = (value << 8) | p[i];
+        ones = ones && p[i] == 0xFF;
+    }
+    if (allOnes != nullptr) {
+        *allOnes = ones;
+    }
+    return true;
+}
+
+inline bool readElementHeader(FileReader& file, uint64_t offset, uint64_t end, EbmlElement& out)
+{
+    uint8_t h[12];
+    const size_t avail = static_cast<size_t>(std::min<uint64_t>(sizeof(h), end - offset));
+    if (offset >= end || !file.read(offset, h, avail)) {
+        return false;
+    }
+    uint64_t id = 0;
+    size_t idLength = 0;
+    if (!readVint(h, avail, true, id, idLength) || idLength > 4) {
+        return false;
+    }
+    uint64_t size = 0;
+    size_t sizeLength = 0;
+    bool unknown = false;
+    if (!readVint(h + idLength, avail - idLength, false, size, sizeLength, &unknown)) {
+        return false;
+    }
+    out.id = static_cast<uint32_t>(id);
+    out.dataOffset = offset + idLength + sizeLength;
+    out.unknownSize = unknown;
+    out.size = unknown ? end - out.dataOffset : std::min(size, end - out.dataOffset);
+    return out.dataOffset <= end;
+}
+
+// Call fn(id, data, size) for each child element held in memory.
+inline void forEachElement(const uint8_t* p, uint64_t n,
+                           const std::function<void(uint32_t, const uint8_t*, uint64_t)>& fn)
+{
+    uint64_t off = 0;
+    while (off < n) {
+        uint64_t id = 0;
+        uint64_t size = 0;
+        size_t idLength = 0;
+        size_t sizeLength = 0;
+        if (!readVint(p + off, static_cast<size_t>(n - off), true, id, idLength) ||
+            !readVint(p + off + idLength, static_cast<size_t>(n - off - idLength), false, size, sizeLength)) {
+            return;
+        }
+        off += idLength + sizeLength;
+        if (size > n - off) {
+            return;
+        }
+        fn(static_cast<uint32_t>(id), p + off, size);
+        off += size;
+    }
+}
+
+struct MatroskaScan {
+    uint64_t timecodeScale = 1000000;   // ns per timestamp unit
+    std::optional<int64_t> dateUtcNs;   // since 2001-01-01 UTC
+    std::vector<uint64_t> videoTracks;
+    std::map<uint64_t, std::vector<int64_t>> blockTimes;   // track -> timestamps
+    std::map<uint64_t, std::vector<int64_t>> keyTimes;     // track -> keyframe timestamps
+    std::optional<uint64_t> cuesOffset;                    // from the SeekHead
+    bool hasCues = false;
+    std::map<uint64_t, std::vector<int64_t>> cueTimes;     // track -> indexed timestamps
+};
+
+// Record the timestamp of a SimpleBlock/Block whose data starts at `offset`.
+// A SimpleBlock carries its keyframe flag; for a Block, `groupKeyframe`
+// tells whether its BlockGroup has no ReferenceBlock.
+inline void readBlockHeader(FileReader& file, uint64_t offset, uint64_t size, int64_t clusterTime,
+                            std::optional<bool> groupKeyframe, MatroskaScan& scan)
+{
+    uint8_t h[12];
+    const size_t avail = static_cast<size_t>(std::min<uint64_t>(sizeof(h), size));
+    uint64_t track = 0;
+    size_t trackLength = 0;
+    if (!file.read(offset, h, avail) || !readVint(h, avail, false, track, trackLength) ||
+        avail < trackLength + 3) {
+        return;
+    }
+    const int16_t relative = static_cast<int16_t>(readBE(h + trackLength, 2));
+    const uint8_t flags = h[trackLength + 2];
+    // A laced block holds several frames under one timestamp; they are
+    // listed with that timestamp, which keeps the frame count right.
+    size_t frames = 1;
+    if ((flags & 0x06) != 0 && avail > trackLength + 3) {
+        frames = static_cast<size_t>(h[trackLength + 3]) + 1;
+    }
+    auto& times = scan.blockTimes[track];
+    if (times.size() + frames > kMaxFrames) {
+        return;
+    }
+    times.insert(times.end(), frames, clusterTime + relative);
+    if (groupKeyframe.value_or((flags & 0x80) != 0)) {
+        scan.keyTimes[track].push_back(clusterTime + relative);
+    }
+}
+
+// Walk one cluster and return the offset where the next segment child starts.
+inline uint64_t scanCluster(FileReader& file, const EbmlElement& cluster, uint64_t segmentEnd,
+                            MatroskaScan& scan)
+{
+    const uint64_t end = cluster.unknownSize ? segmentEnd : cluster.dataOffset + cluster.size;
+    int64_t clusterTime = 0;
+    uint64_t off = cluster.dataOffset;
+    EbmlElement child;
+    while (off < end && readElementHeader(file, off, end, child)) {
+        if (cluster.unknownSize && isSegmentChild(child.id)) {
+            return off;
+        }
+        if (child.id == kClusterTimecode && child.size <= 8) {
+            uint8_t v[8];
+            if (file.read(child.dataOffset, v, static_cast<size_t>(child.size))) {
+                clusterTime = static_cast<int64_t>(readBE(v, static_cast<size_t>(child.size)));
+            }
+        } else if (child.id == kSimpleBlock) {
+            readBlockHeader(file, child.dataOffset, child.size, clusterTime, std::nullopt, scan);
+        } else if (child.id == kBlockGroup) {
+            EbmlElement inner;
+            std::optional<EbmlElement> block;
+            bool referenced = false;
+            const uint64_t groupEnd = child.dataOffset + child.size;
+            for (uint64_t g = child.dataOffset; g < groupEnd && readElementHeader(file, g, groupEnd, inner);
+                 g = inner.dataOffset + inner.size) {
+                if (inner.id == kBlock) {
+                    block = inner;
+                } else if (inner.id == kReferenceBlock) {
+                    referenced = true;
+                }
+            }
+            if (block) {
+                readBlockHeader(file, block->dataOffset, block->size, clusterTime, !referenced, scan);
+            }
+        }
+        if (child.unknownSize) {
+            break;   // cannot skip it; nothing sensible follows
+        }
+        off = child.dataOffset + child.size;
+    }
+    return end;
+}
+
+inline bool probeMatroska(FileReader& file, MediaProbe& out, bool frameTimes)
+{
+    EbmlElement header;
+    if (!readElementHeader(file, 0, file.size(), header) || header.id != kEbmlHeader) {
+        return false;
+    }
+    EbmlElement segment;
+    const uint64_t segmentAt = header.dataOffset + header.size;
+    if (!readElementHeader(file, segmentAt, file.size(), segment) || segment.id != kSegment) {
+        return false;
+    }
+    const uint64_t segmentEnd = segment.dataOffset + segment.size;
+
+    MatroskaScan scan;
+    uint64_t off = segment.dataOffset;
+    EbmlElement child;
+    while (off < segmentEnd && readElementHeader(file, off, segmentEnd, child)) {
+        std::vector<uint8_t> data;
+        if (child.id == kCluster) {
+            if (frameTimes || child.unknownSize) {
+                // Without a size the cluster can only be skipped by walking
+                // it, unless the SeekHead tells where the Cues are.
+                if (!frameTimes && !scan.hasCues && scan.cuesOffset && *scan.cuesOffset > off) {
+                    off = *scan.cuesOffset;
+                } else {
+                    off = scanCluster(file, child, segmentEnd, scan);
+                }
+                continue;
+            }
+        } else if (child.id == kSeekHead && file.read(child.dataOffset, data, child.size)) {
+            forEachElement(data.data(), data.size(), [&](uint32_t id, const uint8_t* p, uint64_t n) {
+                if (id != kSeek) {
+                    return;
+                }
+                uint64_t target = 0;
+                std::optional<uint64_t> position;
+                forEachElement(p, n, [&](uint32_t field, const uint8_t* v, uint64_t len) {
+                    if (field == kSeekId && len >= 1 && len <= 4) {
+                        target = readBE(v, static_cast<size_t>(len));
+                    } else if (field == kSeekPosition && len >= 1 && len <= 8) {
+                        position = readBE(v, static_cast<size_t>(len));
+                    }
+                });
+                if (target == kCues && position && *position < segmentEnd - segment.dataOffset) {
+                    scan.cuesOffset = segment.dataOffset + *position;
+                }
+            });
+        } else if (child.id == kCues && file.read(child.dataOffset, data, child.size)) {
+            scan.hasCues = true;
+            forEachElement(data.data(), data.size(), [&](uint32_t id, const uint8_t* p, uint64_t n) {
+                if (id != kCuePoint) {
+                    return;
+                }
+                std::optional<int64_t> time;
+                std::vector<uint64_t> tracks;
+                forEachElement(p, n, [&](uint32_t field, const uint8_t* v, uint64_t len) {
+                    if (field == kCueTime && len >= 1 && len <= 8) {
+                        time = static_cast<int64_t>(readBE(v, static_cast<size_t>(len)));
+                    } else if (field == kCueTrackPositions) {
+                        forEachElement(v, len, [&](uint32_t pos, const uint8_t* w, uint64_t wlen) {
+                            if (pos == kCueTrack && wlen >= 1 && wlen <= 8) {
+                                tracks.push_back(readBE(w, static_cast<size_t>(wlen)));
+                            }
+                        });
+                    }
+                });
+                for (const uint64_t track : tracks) {
+                    auto& times = scan.cueTimes[track];
+                    if (time && times.size() < kMaxFrames) {
+                        times.push_back(*time);
+                    }
+                }
+            });
+        } else if (child.id == kInfo && file.read(child.dataOffset, data, child.size)) {
+            forEachElement(data.data(), data.size(), [&](uint32_t id, const uint8_t* p, uint64_t n) {
+                if (id == kTimecodeScale && n >= 1 && n <= 8) {
+                    scan.timecodeScale = readBE(p, static_cast<size_t>(n));
+                } else if (id == kDateUtc && n == 8) {
+                    scan.dateUtcNs = static_cast<int64_t>(readBE(p, 8));
+                }
+            });
+        } else if (child.id == kTracks && file.read(child.dataOffset, data, child.size)) {
+            forEachElement(data.data(), data.size(), [&](uint32_t id, const uint8_t* p, uint64_t n) {
+                if (id != kTrackEntry) {
+                    return;
+                }
+                uint64_t number = 0;
+                uint64_t type = 0;
+                forEachElement(p, n, [&](uint32_t field, const uint8_t* v, uint64_t len) {
+                    if (field == kTrackNumber && len >= 1 && len <= 8) {
+                        number = readBE(v, static_cast<size_t>(len));
+                    } else if (field == kTrackType && len >= 1 && len <= 8) {
+                        type = readBE(v, static_cast<size_t>(len));
+                    }
+                });
+                if (type == 1) {
+                    scan.videoTracks.push_back(number);
+                }
+            });
+        }
+        if (child.unknownSize) {
+            break;
+        }
+        off = child.dataOffset + child.size;
+    }
+
+    if (!frameTimes) {
+        // Only some clusters were walked; a partial timeline is no timeline.
+        scan.blockTimes.clear();
+        scan.keyTimes.clear();
+    }
+
+    out.container = "matroska";
+    if (scan.dateUtcNs) {
+        // Matroska epoch: 2001-01-01 UTC.
+        constexpr int64_t kMatroskaEpochToUnix = 978307200;
+        // Floor division, DateUTC is signed and may precede 2001.
+        const int64_t ns = *scan.dateUtcNs;
+        int64_t sec = ns / 1000000000;
+        int64_t rem = ns % 1000000000;
+        if (rem < 0) {
+            --sec;
+            rem += 1000000000;
+        }
+        out.creationTime = unixTime(kMatroskaEpochToUnix + sec, rem / 1000);
+    }
+    if (!scan.videoTracks.empty() && scan.timecodeScale > 0) {
+        const uint64_t track = scan.videoTracks.front();
+        const double unitSec = static_cast<double>(scan.timecodeScale) * 1e-9;
+        auto toSeconds = [unitSec](const std::vector<int64_t>& ticks) {
+            std::vector<double> seconds;
+            seconds.reserve(ticks.size());
+            for (const int64_t t : ticks) {
+                seconds.push_back(static_cast<double>(t) * unitSec);
+            }
+            return seconds;
+        };
+        // The Cues list the points a player can seek to, which are the
+        // keyframes; the block flags are the fallback for files without.
+        const std::vector<int64_t>& cued = scan.cueTimes[track];
+        const std::vector<int64_t>& keyframes = cued.empty() ? scan.keyTimes[track] : cued;
+        const auto it = scan.blockTimes.find(track);
+        if (it != scan.blockTimes.end()) {
+            setFrameTimes(out, toSeconds(it->second), toSeconds(keyframes));
+        } else {
+            setFrameTimes(out, {}, toSeconds(keyframes));
+        }
+    }
+    return true;
+}
+
+}  // namespace media_probe_detail
+
+// Probe a local media file. Returns false if it cannot be opened or is not
+// an MP4/QuickTime or Matroska/WebM file; fields the container does not
+// carry are left empty. `frameTimes` asks for framePtsSec, which in Matroska
+// means reading every block header; MP4 sample tables are read regardless.
+inline bool probeMedia(const std::string& path, MediaProbe& out, bool frameTimes = true)
+{
+    out = MediaProbe{};
+    media_probe_detail::FileReader file(path);
+    if (!file.isOpen() || file.size() < 8) {
+        return false;
+    }
+    return media_probe_detail::probeMatroska(file, out, frameTimes) || media_probe_detail::probeMp4(file, out);
+}
@@ -0,0 +1,307 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Tests of media_probe.hpp against small MP4 and Matroska files built in
+// memory: B-frame reordering (ctts), edit lists and sync samples, laced and
+// BlockGroup blocks, Cues, and truncated or overflowing headers.
+//
+// Usage: media_probe_test.exe (run by ctest)
+#include "media_probe.hpp"
+#include "test_check.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Bytes = std::vector<uint8_t>;
+
+static void putBE(Bytes& out, uint64_t v, int n)
+{
+    for (int i = n - 1; i >= 0; --i) {
+        out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+}
+
+static Bytes cat(std::initializer_list<Bytes> parts)
+{
+    Bytes out;
+    for (const Bytes& p : parts) {
+        out.insert(out.end(), p.begin(), p.end());
+    }
+    return out;
+}
+
+static Bytes be(uint64_t v, int n)
+{
+    Bytes out;
+    putBE(out, v, n);
+    return out;
+}
+
+static bool near(double a, double b)
+{
+    return std::abs(a - b) < 1e-9;
+}
+
+static bool sameTimes(const std::vector<double>& got, std::initializer_list<double> want)
+{
+    if (got.size() != want.size()) {
+        return false;
+    }
+    size_t i = 0;
+    for (const double w : want) {
+        if (!near(got[i++], w)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int64_t unixMicros(const std::optional<std::chrono::system_clock::time_point>& tp)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(tp->time_since_epoch()).count();
+}
+
+// Write the bytes to a temporary file, probe it and remove it.
+static bool probeBytes(const Bytes& data, MediaProbe& out, bool frameTimes = true)
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "media_probe_test.bin";
+    {
+        std::ofstream f(path, std::ios::binary | std::ios::trunc);
+        f.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    }
+    const bool ok = probeMedia(path.string(), out, frameTimes);
+    std::filesystem::remove(path);
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+// ISO BMFF
+//------------------------------------------------------------------------------
+
+static Bytes box(const char* type, const Bytes& payload)
+{
+    Bytes out;
+    putBE(out, 8 + payload.size(), 4);
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), payload.begin(), payload.end());
+    return out;
+}
+
+static Bytes fullBox(const char* type, uint8_t version, const Bytes& body)
+{
+    return box(type, cat({Bytes{version, 0, 0, 0}, body}));
+}
+
+constexpr int64_t kMp4Epoch = 2082844800;   // 1904-01-01 in Unix seconds
+constexpr int64_t kCreation = 1700000000;   // 2023-11-14 22:13:20 UTC
+
+static Bytes mp4Track(uint32_t id, const char* handler, uint32_t timescale, const Bytes& stbl,
+                      const Bytes& edts = {})
+{
+    const Bytes tkhd = fullBox("tkhd", 0, cat({be(0, 4), be(0, 4), be(id, 4), be(0, 4), be(0, 4)}));
+    const Bytes mdhd = fullBox("mdhd", 0, cat({be(0, 4), be(0, 4), be(timescale, 4), be(0, 4), be(0, 4)}));
+    const Bytes hdlr = fullBox("hdlr", 0, cat({be(0, 4), Bytes(handler, handler + 4), Bytes(13, 0)}));
+    return box("trak", cat({tkhd, edts, box("mdia", cat({mdhd, hdlr, box("minf", box("stbl", stbl))}))}));
+}
+
+// An audio track, then a video track at 12800 units/s with six samples 512
+// apart (25 fps) whose composition offsets reorder them, sync samples 1 and
+// 4, and an edit list that delays it by 0.5 s and cuts off the first sample.
+// A prft box maps the first shown frame to kCreation + 100.5 s.
+static Bytes mp4Fixture(const Bytes& mvhd, const Bytes& stts)
+{
+    const Bytes audio = mp4Track(2, "soun", 48000, fullBox("stts", 0, cat({be(1, 4), be(10, 4), be(1024, 4)})));
+
+    Bytes ctts = be(6, 4);
+    for (const uint32_t offset : {1024u, 2048u, 512u, 512u, 1024u, 1024u}) {
+        putBE(ctts, 1, 4);
+        putBE(ctts, offset, 4);
+    }
+    const Bytes stbl = cat({stts, fullBox("ctts", 0, ctts), fullBox("stss", 0, cat({be(2, 4), be(1, 4), be(4, 4)}))});
+    const Bytes elst = fullBox("elst", 0, cat({be(2, 4),
+                                                be(500, 4), be(0xFFFFFFFF, 4), be(0x10000, 4),
+                                                be(200, 4), be(1536, 4), be(0x10000, 4)}));
+    const Bytes video = mp4Track(1, "vide", 12800, stbl, box("edts", elst));
+
+    const uint64_t ntp = (static_cast<uint64_t>(kCreation + 100 + 2208988800) << 32) | 0x80000000u;
+    return cat({box("ftyp", cat({Bytes{'i', 's', 'o', 'm'}, be(0, 4), Bytes{'i', 's', 'o', 'm'}})),
+                box("moov", cat({mvhd, audio, video})),
+                fullBox("prft", 0, cat({be(1, 4), be(ntp, 8), be(1536, 4)})),
+                box("mdat", Bytes(16, 0))});
+}
+
+static Bytes mvhdV0(uint64_t creation)
+{
+    return fullBox("mvhd", 0, cat({be(creation, 4), be(0, 4), be(1000, 4), be(0, 4)}));
+}
+
+static Bytes sixSamples()
+{
+    return fullBox("stts", 0, cat({be(1, 4), be(6, 4), be(512, 4)}));
+}
+
+static void testMp4()
+{
+    MediaProbe p;
+    CHECK(probeBytes(mp4Fixture(mvhdV0(kCreation + kMp4Epoch), sixSamples()), p));
+    CHECK(p.container == "mp4");
+    CHECK(p.creationTime && unixMicros(p.creationTime) == kCreation * 1000000);
+    CHECK(p.startTimeRealtime && unixMicros(p.startTimeRealtime) == (kCreation + 100) * 1000000 + 500000);
+    // Presentation order, the cut-off sample left out, from the first shown frame.
+    CHECK(sameTimes(p.framePtsSec, {0.0, 0.04, 0.08, 0.12, 0.16}));
+    CHECK(sameTimes(p.keyframePtsSec, {0.04}));
+}
+
+static void testMp4Overflow()
+{
+    MediaProbe p;
+
+    // A 64-bit creation time far past 2200 is dropped, not wrapped.
+    const Bytes mvhdV1 = fullBox("mvhd", 1, cat({be(~uint64_t{0}, 8), be(0, 8), be(1000, 4), be(0, 8)}));
+    CHECK(probeBytes(mp4Fixture(mvhdV1, sixSamples()), p));
+    CHECK(!p.creationTime);
+    CHECK(p.framePtsSec.size() == 5);
+
+    // A sample count beyond kMaxFrames yields no timeline instead of an
+    // allocation of that size.
+    CHECK(probeBytes(mp4Fixture(mvhdV0(kCreation + kMp4Epoch),
+                                fullBox("stts", 0, cat({be(1, 4), be(0xFFFFFFFF, 4), be(512, 4)}))), p));
+    CHECK(p.framePtsSec.empty() && p.keyframePtsSec.empty());
+
+    // An entry count larger than the box is clamped to the entries present.
+    CHECK(probeBytes(mp4Fixture(mvhdV0(kCreation + kMp4Epoch),
+                                fullBox("stts", 0, cat({be(1000, 4), be(6, 4), be(512, 4)}))), p));
+    CHECK(p.framePtsSec.size() == 5);
+
+    // A trailing box claiming 2^63 bytes (64-bit size) ends the walk.
+    const Bytes good = mp4Fixture(mvhdV0(kCreation + kMp4Epoch), sixSamples());
+    CHECK(probeBytes(cat({good, be(1, 4), Bytes{'m', 'd', 'a', 't'}, be(uint64_t{1} << 63, 8)}), p));
+    CHECK(p.framePtsSec.size() == 5);
+
+    // A file cut inside moov has no sample table to report.
+    CHECK(!probeBytes(Bytes(good.begin(), good.begin() + 200), p));
+}
+
+//------------------------------------------------------------------------------
+// Matroska
+//------------------------------------------------------------------------------
+
+// An element with an 8-byte size, or an unknown one.
+static Bytes element(uint32_t id, const Bytes& data, bool unknownSize = false)
+{
+    Bytes out;
+    putBE(out, id, id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1);
+    putBE(out, unknownSize ? 0x01FFFFFFFFFFFFFF : (uint64_t{1} << 56) | data.size(), 8);
+    out.insert(out.end(), data.begin(), data.end());
+    return out;
+}
+
+static Bytes block(uint8_t track, int16_t relative, uint8_t flags, const Bytes& lacing = {})
+{
+    return cat({Bytes{static_cast<uint8_t>(0x80 | track)}, be(static_cast<uint16_t>(relative), 2), Bytes{flags},
+                lacing, Bytes(8, 0)});
+}
+
+static Bytes cuePoint(uint64_t time)
+{
+    return element(0xBB, cat({element(0xB3, be(time, 2)), element(0xB7, element(0xF7, be(1, 1)))}));
+}
+
+constexpr int64_t kMatroskaEpoch = 978307200;   // 2001-01-01 in Unix seconds
+
+// Video track 1 and audio track 2; one cluster at 1000 ms holding a keyframe
+// SimpleBlock, an audio block, a Xiph-laced block of three frames at +40 ms,
+// a referencing BlockGroup at +160 ms and a keyframe BlockGroup at +200 ms.
+// With `cues`, Cues list 1000 and 1160 ms as the seek points.
+static Bytes mkvFixture(bool cues, uint64_t dateUtc, bool unknownClusterSize = false)
+{
+    const Bytes info = element(0x1549A966, cat({element(0x2AD7B1, be(1000000, 3)), element(0x4461, be(dateUtc, 8))}));
+    const Bytes tracks = element(0x1654AE6B, cat({element(0xAE, cat({element(0xD7, be(2, 1)), element(0x83, be(2, 1))})),
+                                                  element(0xAE, cat({element(0xD7, be(1, 1)), element(0x83, be(1, 1))}))}));
+    const Bytes cluster = element(0x1F43B675, cat({
+        element(0xE7, be(1000, 2)),
+        element(0xA3, block(1, 0, 0x80)),
+        element(0xA3, block(2, 0, 0x80)),
+        element(0xA3, block(1, 40, 0x02, Bytes{2, 4, 4})),
+        element(0xA0, cat({element(0xA1, block(1, 160, 0)), element(0xFB, be(0xFF60, 2))})),
+        element(0xA0, element(0xA1, block(1, 200, 0))),
+    }), unknownClusterSize);
+    const Bytes cueIndex = cues ? element(0x1C53BB6B, cat({cuePoint(1000), cuePoint(1160)})) : Bytes{};
+    return cat({element(0x1A45DFA3, element(0x4282, Bytes{'w', 'e', 'b', 'm'})),
+                element(0x18538067, cat({info, tracks, cluster, cueIndex}))});
+}
+
+static void testMatroska()
+{
+    const uint64_t dateUtc = static_cast<uint64_t>(kCreation - kMatroskaEpoch) * 1000000000 + 250000000;
+    MediaProbe p;
+
+    // Without Cues the keyframes come from the block flags: the SimpleBlock
+    // flag and a BlockGroup without ReferenceBlock.
+    CHECK(probeBytes(mkvFixture(false, dateUtc), p));
+    CHECK(p.container == "matroska");
+    CHECK(p.creationTime && unixMicros(p.creationTime) == kCreation * 1000000 + 250000);
+    CHECK(sameTimes(p.framePtsSec, {0.0, 0.04, 0.04, 0.04, 0.16, 0.2}));
+    CHECK(sameTimes(p.keyframePtsSec, {0.0, 0.2}));
+
+    // With Cues those are the keyframes, with or without the cluster walk.
+    CHECK(probeBytes(mkvFixture(true, dateUtc), p));
+    CHECK(p.framePtsSec.size() == 6);
+    CHECK(sameTimes(p.keyframePtsSec, {0.0, 0.16}));
+    CHECK(probeBytes(mkvFixture(true, dateUtc), p, false));
+    CHECK(p.framePtsSec.empty());
+    CHECK(sameTimes(p.keyframePtsSec, {0.0, 0.16}));
+}
+
+static void testMatroskaOverflow()
+{
+    MediaProbe p;
+
+    // DateUTC is signed; the most negative value is dropped, not wrapped.
+    CHECK(probeBytes(mkvFixture(false, uint64_t{1} << 63), p));
+    CHECK(!p.creationTime);
+    CHECK(p.framePtsSec.size() == 6);
+
+    // A file cut inside the cluster keeps the blocks before the cut.
+    const Bytes full = mkvFixture(false, 0);
+    CHECK(probeBytes(Bytes(full.begin(), full.end() - 40), p));
+    CHECK(!p.framePtsSec.empty() && p.framePtsSec.size() < 6);
+
+    // An unknown-size cluster ends where the next segment child starts.
+    CHECK(probeBytes(mkvFixture(true, 0, true), p));
+    CHECK(p.framePtsSec.size() == 6);
+    CHECK(sameTimes(p.keyframePtsSec, {0.0, 0.16}));
+
+    // Sizes larger than the file are clamped to it.
+    Bytes oversized = mkvFixture(false, 0);
+    oversized.insert(oversized.end(), {0x12, 0x54, 0xC3, 0x67, 0x01, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE});
+    CHECK(probeBytes(oversized, p));
+
+    // Neither container.
+    CHECK(!probeBytes(Bytes(64, 0xAB), p));
+}
+
+int main()
+{
+    testMp4();
+    testMp4Overflow();
+    testMatroska();
+    testMatroskaOverflow();
+    return testResult("media_probe");
+}
@@ -0,0 +1,409 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Lightweight runtime metrics: lock-free latency histograms and counters, and
+// a minimal HTTP endpoint serving them in the Prometheus text format.
+//
+// Recording is a couple of relaxed atomic increments, so it can sit on the
+// capture and inference paths of every thread. Readers take snapshots, which
+// are consistent enough for monitoring (counts recorded during a snapshot may
+// be split across it) and never block writers.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Seconds elapsed between successive lap() calls.
+class Stopwatch {
+public:
+    Stopwatch() : last_(std::chrono::steady_clock::now()) {}
+
+    double lap()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const double sec = std::chrono::duration<double>(now - last_).count();
+        last_ = now;
+        return sec;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last_;
+};
+
+// Monotonic event counter.
+class Counter {
+public:
+    void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+// Latency histogram with log-linear buckets.
+//
+// Values are kept in microseconds; each power of two is split into four
+// buckets, so a bucket is at most 25% wide and quantiles interpolated inside
+// it are within a few percent. 112 buckets cover 1 us to about 9 minutes;
+// longer values land in the last bucket.
+class LatencyHistogram {
+public:
+    static constexpr size_t kBuckets = 112;
+
+    struct Snapshot {
+        std::array<uint64_t, kBuckets> counts{};
+        uint64_t count = 0;
+        double sumSec = 0.0;
+
+        double mean() const { return count > 0 ? sumSec / static_cast<double>(count) : 0.0; }
+
+        // Quantile q in [0, 1], in seconds; 0 if nothing was recorded.
+        double quantile(double q) const
+        {
+            uint64_t total = 0;
+            for (const uint64_t c : counts) {
+                total += c;
+            }
+            if (total == 0) {
+                return 0.0;
+            }
+
+            const double rank = std::clamp(q, 0.0, 1.0) * static_cast<double>(total);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < kBuckets; ++i) {
+                if (counts[i] == 0) {
+                    continue;
+                }
+                if (static_cast<double>(seen + counts[i]) >= rank) {
+                    const double within = (rank - static_cast<double>(seen)) /
+                                          static_cast<double>(counts[i]);
+                    const double lo = static_cast<double>(bucketLowerUs(i));
+                    const double hi = static_cast<double>(bucketLowerUs(i + 1));
+                    return (lo + within * (hi - lo)) * 1e-6;
+                }
+                seen += counts[i];
+            }
+            return static_cast<double>(bucketLowerUs(kBuckets)) * 1e-6;
+        }
+
+        // Events recorded between `earlier` and this snapshot.
+        Snapshot since(const Snapshot& earlier) const
+        {
+            Snapshot d;
+            for (size_t i = 0; i < kBuckets; ++i) {
+                d.counts[i] = counts[i] - earlier.counts[i];
+            }
+            d.count = count - earlier.count;
+            d.sumSec = sumSec - earlier.sumSec;
+            return d;
+        }
+    };
+
+    void record(double seconds)
+    {
+        const double us = std::max(0.0, seconds) * 1e6;
+        const uint64_t v = us < 1e15 ? static_cast<uint64_t>(us) : uint64_t{1} << 50;
+        counts_[bucketFor(v)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sumNs_.fetch_add(static_cast<uint64_t>(us * 1e3), std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const
+    {
+        Snapshot s;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        }
+        s.count = count_.load(std::memory_order_relaxed);
+        s.sumSec = static_cast<double>(sumNs_.load(std::memory_order_relaxed)) * 1e-9;
+        return s;
+    }
+
+    // Bucket index of a value in microseconds: 0..3 exact, then four
+    // buckets per power of two.
+    static size_t bucketFor(uint64_t us)
+    {
+        if (us < 4) {
+            return static_cast<size_t>(us);
+        }
+        const int msb = static_cast<int>(std::bit_width(us)) - 1;
+        const size_t sub = static_cast<size_t>((us >> (msb - 2)) & 3);
+        return std::min(kBuckets - 1, 4 + static_cast<size_t>(msb - 2) * 4 + sub);
+    }
+
+    // Smallest value (us) that falls into bucket i; bucketLowerUs(i + 1) is
+    // the exclusive upper bound of bucket i.
+    static uint64_t bucketLowerUs(size_t i)
+    {
+        if (i < 4) {
+            return i;
+        }
+        const size_t shift = (i - 4) / 4;
+        const uint64_t sub = (i - 4) % 4;
+        return (4 + sub) << shift;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sumNs_{0};
+};
+
+//------------------------------------------------------------------------------
+// Prometheus text format
+//------------------------------------------------------------------------------
+
+inline void appendPrometheusHeader(
+    std::string& out, const std::string& name, const char* type, const char* help)
+{
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+inline void appendPrometheusSample(
+    std::string& out, const std::string& name, const std::string& labels, double value)
+{
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.9g", value);
+    out += name;
+    if (!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    out += " ";
+    out += buf;
+    out += "\n";
+}
+
+// One summary series (quantiles 0.5/0.95/0.99, _sum and _count) for a
+// histogram snapshot. `labels` identifies the series, e.g. stage="encode".
+inline void appendPrometheusSummary(
+    std::string& out, const std::string& name, const std::string& labels,
+    const LatencyHistogram::Snapshot& s)
+{
+    const std::string sep = labels.empty() ? "" : ",";
+    for (const double q : {0.5, 0.95, 0.99}) {
+        char quantile[32];
+        std::snprintf(quantile, sizeof(quantile), "quantile=\"%g\"", q);
+        appendPrometheusSample(out, name, labels + sep + quantile, s.quantile(q));
+    }
+    appendPrometheusSample(out, name + "_sum", labels, s.sumSec);
+    appendPrometheusSample(out, name + "_count", labels, static_cast<double>(s.count));
+}
+
+//------------------------------------------------------------------------------
+// Metrics endpoint
+//------------------------------------------------------------------------------
+
+// Minimal HTTP/1.0 server answering GET /metrics with render().
+//
+// One background thread handles one connection at a time, which is plenty
+// for a scraper polling every few seconds. It binds to the loopback address
+// unless told otherwise, since the metrics are not authenticated.
+class MetricsServer {
+public:
+    explicit MetricsServer(std::function<std::string()> render) : render_(std::move(render)) {}
+
+    ~MetricsServer()
+    {
+        stop();
+    }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // Bind and start serving. Returns false (with a message in `error`) if
+    // the socket cannot be set up.
+    bool start(const std::string& bindAddress, int port, std::string& error)
+    {
+#ifdef _WIN32
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            error = "WSAStartup failed";
+            return false;
+        }
+        wsaStarted_ = true;
+#endif
+        listenFd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd_ == kInvalidSocket) {
+            error = "socket() failed";
+            return false;
+        }
+
+        const int yes = 1;
+        ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR,
+                     reinterpret_cast<const char*>(&yes), sizeof(yes));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (::inet_pton(AF_INET, bindAddress.c_str(), &addr.sin_addr) != 1) {
+            error = "invalid bind address " + bindAddress;
+            closeSocket(listenFd_);
+            return false;
+        }
+        if (::bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listenFd_, 8) != 0) {
+            error = "cannot listen on " + bindAddress + ":" + std::to_string(port);
+            closeSocket(listenFd_);
+            return false;
+        }
+
+        running_.store(true);
+        thread_ = std::thread([this] { serve(); });
+        return true;
+    }
+
+    void stop()
+    {
+        running_.store(false);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        closeSocket(listenFd_);
+#ifdef _WIN32
+        if (wsaStarted_) {
+            WSACleanup();
+            wsaStarted_ = false;
+        }
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    using Socket = SOCKET;
+    static constexpr Socket kInvalidSocket = INVALID_SOCKET;
+#else
+    using Socket = int;
+    static constexpr Socket kInvalidSocket = -1;
+#endif
+
+    // A scraper that disconnects mid-response must not raise SIGPIPE, which
+    // would terminate the pipeline. Where MSG_NOSIGNAL is missing (macOS) the
+    // accepted socket gets SO_NOSIGPIPE instead.
+#if defined(MSG_NOSIGNAL)
+    static constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+    static constexpr int kSendFlags = 0;
+#endif
+
+    static void closeSocket(Socket& s)
+    {
+        if (s == kInvalidSocket) {
+            return;
+        }
+#ifdef _WIN32
+        ::closesocket(s);
+#else
+        ::close(s);
+#endif
+        s = kInvalidSocket;
+    }
+
+    // Wait up to timeoutMs for `s` to become readable.
+    static bool waitReadable(Socket s, int timeoutMs)
+    {
+#ifdef _WIN32
+        WSAPOLLFD pfd{s, POLLIN, 0};
+        return WSAPoll(&pfd, 1, timeoutMs) > 0;
+#else
+        pollfd pfd{s, POLLIN, 0};
+        return ::poll(&pfd, 1, timeoutMs) > 0;
+#endif
+    }
+
+    static void sendAll(Socket s, const std::string& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const auto n = ::send(s, data.data() + sent, static_cast<int>(data.size() - sent), kSendFlags);
+            if (n <= 0) {
+                return;
+            }
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    void serve()
+    {
+        while (running_.load()) {
+            // Poll so stop() is noticed without closing the socket under accept().
+            if (!waitReadable(listenFd_, 200)) {
+                continue;
+            }
+            Socket client = ::accept(listenFd_, nullptr, nullptr);
+            if (client == kInvalidSocket) {
+                continue;
+            }
+#ifdef SO_NOSIGPIPE
+            const int one = 1;
+            ::setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            handle(client);
+            closeSocket(client);
+        }
+    }
+
+    void handle(Socket client)
+    {
+        // Read the request head; only the request line matters.
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            if (!waitReadable(client, 1000)) {
+                return;
+            }
+            const auto n = ::recv(client, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                break;
+            }
+            request.append(buf, static_cast<size_t>(n));
+        }
+
+        const bool isMetrics = request.rfind("GET /metrics ", 0) == 0 ||
+                               request.rfind("GET / ", 0) == 0;
+        std::string body = isMetrics ? render_() : "not found\n";
+        std::string head = isMetrics ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n";
+        head += isMetrics ? "Content-Type: text/plain; version=0.0.4\r\n"
+                          : "Content-Type: text/plain\r\n";
+        head += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        head += "Connection: close\r\n\r\n";
+        sendAll(client, head + body);
+    }
+
+    std::function<std::string()> render_;
+    Socket listenFd_ = kInvalidSocket;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+#ifdef _WIN32
+    bool wsaStarted_ = false;
+#endif
+};
@@ -0,0 +1,614 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Microbenchmarks for the hot helpers of realtime_video_pipeline.
+//
+// Results go to stdout as a table, JSON or CSV; the JSON output of one build
+// can be passed to --compare when running another to print the change per
+// benchmark.
+//
+// Usage: micro_bench.exe [--min-time <sec>] [--filter <substring>]
+//                        [--format table|json|csv] [--compare <baseline.json>]
+#include "base64.hpp"
+#include "pipeline_helpers.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+//------------------------------------------------------------------------------
+// Reference implementations
+//------------------------------------------------------------------------------
+
+// The pipeline's original encoder (byte-at-a-time push_back into a string),
+// kept verbatim as the baseline and as the correctness oracle.
+static std::string legacyBase64Encode(const std::vector<unsigned char>& data)
+{
+    static const char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    encoded.reserve(((data.size() + 2) / 3) * 4);
+
+    size_t i = 0;
+    while (i + 2 < data.size()) {
+        const uint32_t triple =
+            (static_cast<uint32_t>(data[i]) << 16) |
+            (static_cast<uint32_t>(data[i + 1]) << 8) |
+            static_cast<uint32_t>(data[i + 2]);
+
+        encoded.push_back(table[(triple >> 18) & 0x3F]);
+        encoded.push_back(table[(triple >> 12) & 0x3F]);
+        encoded.push_back(table[(triple >> 6) & 0x3F]);
+        encoded.push_back(table[triple & 0x3F]);
+        i += 3;
+    }
+
+    const size_t rem = data.size() - i;
+    if (rem == 1) {
+        const uint32_t triple = (static_cast<uint32_t>(data[i]) << 16);
+        encoded.push_back(table[(triple >> 18) & 0x3F]);
+        encoded.push_back(table[(triple >> 12) & 0x3F]);
+        encoded.push_back('=');
+        encoded.push_back('=');
+    } else if (rem == 2) {
+        const uint32_t triple =
+            (static_cast<uint32_t>(data[i]) << 16) |
+            (static_cast<uint32_t>(data[i + 1]) << 8);
+        encoded.push_back(table[(triple >> 18) & 0x3F]);
+        encoded.push_back(table[(triple >> 12) & 0x3F]);
+        encoded.push_back(table[(triple >> 6) & 0x3F]);
+        encoded.push_back('=');
+    }
+
+    return encoded;
+}
+
+//------------------------------------------------------------------------------
+// Timing harness
+//------------------------------------------------------------------------------
+
+// Sink for benchmark results so the optimizer cannot drop the work.
+static volatile uint64_t g_sink = 0;
+
+// Run `op` in growing batches until minTimeSec has elapsed and return the
+// mean time per call in nanoseconds.
+static double timeOp(const std::function<void()>& op, double minTimeSec)
+{
+    using clock = std::chrono::steady_clock;
+
+    op();  // warm-up (page faults, kernel selection)
+
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    const auto start = clock::now();
+    double elapsed = 0.0;
+    while (elapsed < minTimeSec) {
+        for (uint64_t i = 0; i < batch; ++i) {
+            op();
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    }
+    return elapsed * 1e9 / static_cast<double>(iterations);
+}
+
+enum class OutputFormat { Table, Json, Csv };
+
+struct BenchResult {
+    std::string name;
+    size_t bytes = 0;      // input size, for the throughput column
+    size_t outBytes = 0;   // output size where it matters (JPEG, JSON); else 0
+    double nsPerOp = 0.0;
+};
+
+// Benchmark selection, collected results and the optional baseline.
+struct BenchRun {
+    double minTimeSec = 0.3;
+    std::string filter;
+    OutputFormat format = OutputFormat::Table;
+    std::map<std::string, double> baselineNs;
+    std::vector<BenchResult> results;
+
+    bool selected(const std::string& name) const
+    {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // Time `op` under `name` unless filtered out; table rows are printed as
+    // they complete so long runs show progress.
+    void run(const std::string& name, size_t bytes, size_t outBytes, const std::function<void()>& op)
+    {
+        if (!selected(name)) {
+            return;
+        }
+        results.push_back({name, bytes, outBytes, timeOp(op, minTimeSec)});
+        if (format == OutputFormat::Table) {
+            printRow(results.back());
+        }
+    }
+
+    static double mibPerSec(const BenchResult& r)
+    {
+        return r.nsPerOp > 0.0
+                   ? (static_cast<double>(r.bytes) / (1024.0 * 1024.0)) / (r.nsPerOp * 1e-9)
+                   : 0.0;
+    }
+
+    // Relative change against the baseline, or NaN if it has no such entry.
+    double changeVsBaseline(const BenchResult& r) const
+    {
+        const auto it = baselineNs.find(r.name);
+        return it != baselineNs.end() && it->second > 0.0
+                   ? (r.nsPerOp - it->second) / it->second
+                   : std::nan("");
+    }
+
+    void printHeader() const
+    {
+        std::cout << std::left << std::setw(40) << "benchmark"
+                  << std::right << std::setw(10) << "bytes"
+                  << std::setw(10) << "out"
+                  << std::setw(14) << "ns/op"
+                  << std::setw(12) << "MiB/s";
+        if (!baselineNs.empty()) {
+            std::cout << std::setw(10) << "change";
+        }
+        std::cout << "\n";
+    }
+
+    void printRow(const BenchResult& r) const
+    {
+        std::cout << std::left << std::setw(40) << r.name
+                  << std::right << std::setw(10) << r.bytes
+                  << std::setw(10) << (r.outBytes > 0 ? std::to_string(r.outBytes) : "-")
+                  << std::setw(14) << std::fixed << std::setprecision(0) << r.nsPerOp
+                  << std::setw(12) << std::setprecision(1) << mibPerSec(r);
+        if (!baselineNs.empty()) {
+            const double change = changeVsBaseline(r);
+            std::ostringstream cell;
+            if (std::isnan(change)) {
+                cell << "-";
+            } else {
+                cell << std::showpos << std::fixed << std::setprecision(1) << change * 100.0 << "%";
+            }
+            std::cout << std::setw(10) << cell.str();
+        }
+        std::cout << "\n";
+    }
+
+    void printJson() const
+    {
+        json out = {
+            {"min_time_sec", minTimeSec},
+            {"base64_kernel", base64SelectedKernel().name},
+            {"results", json::array()},
+        };
+        for (const auto& r : results) {
+            json entry = {
+                {"name", r.name},
+                {"bytes", r.bytes},
+                {"out_bytes", r.outBytes},
+                {"ns_per_op", r.nsPerOp},
+                {"mib_per_s", mibPerSec(r)},
+            };
+            const double change = changeVsBaseline(r);
+            if (!std::isnan(change)) {
+                entry["change_vs_baseline"] = change;
+            }
+            out["results"].push_back(std::move(entry));
+        }
+        std::cout << out.dump(2) << "\n";
+    }
+
+    void printCsv() const
+    {
+        std::cout << "name,bytes,out_bytes,ns_per_op,mib_per_s,change_vs_baseline\n";
+        for (const auto& r : results) {
+            const double change = changeVsBaseline(r);
+            std::cout << '"' << r.name << "\"," << r.bytes << ',' << r.outBytes << ','
+                      << std::fixed << std::setprecision(1) << r.nsPerOp << ','
+                      << mibPerSec(r) << ',';
+            if (!std::isnan(change)) {
+                std::cout << std::setprecision(4) << change;
+            }
+            std::cout << "\n";
+        }
+    }
+};
+
+// Load name -> ns/op from a previous --format json run.
+static bool loadBaseline(const std::string& path, std::map<std::string, double>& out)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "[ERROR] Cannot open baseline: " << path << "\n";
+        return false;
+    }
+    try {
+        const json baseline = json::parse(in);
+        for (const auto& r : baseline.at("results")) {
+            out[r.at("name").get<std::string>()] = r.at("ns_per_op").get<double>();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] Invalid baseline " << path << ": " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Inputs
+//------------------------------------------------------------------------------
+
+// A camera-like BGR frame: smooth noise with a few hard edges and some text,
+// so resize and JPEG costs are close to those of real footage (pure noise
+// would make the encoder far slower, flat colour far faster).
+static cv::Mat syntheticFrame(int width, int height)
+{
+    cv::Mat coarse(std::max(1, height / 16), std::max(1, width / 16), CV_8UC3);
+    cv::randu(coarse, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::Mat frame;
+    cv::resize(coarse, frame, cv::Size(width, height), 0, 0, cv::INTER_CUBIC);
+
+    for (int i = 0; i < 6; ++i) {
+        const cv::Rect box(width * i / 7, height * (i % 3) / 4, width / 8, height / 5);
+        cv::rectangle(frame, box, cv::Scalar(40 * i, 255 - 40 * i, 128), cv::FILLED);
+    }
+    cv::putText(frame, "micro_bench 12:34:56", cv::Point(width / 20, height - height / 10),
+                cv::FONT_HERSHEY_SIMPLEX, height / 400.0, cv::Scalar(255, 255, 255), 2);
+    return frame;
+}
+
+// Model answer text of roughly `size` bytes, sentence-shaped.
+static std::string responseText(size_t size)
+{
+    static const std::string sentence =
+        "A person in a white coat adjusts the infusion pump next to the bed. ";
+    std::string text;
+    text.reserve(size + sentence.size());
+    while (text.size() < size) {
+        text += sentence;
+    }
+    return text;
+}
+
+//------------------------------------------------------------------------------
+// Benchmarks
+//------------------------------------------------------------------------------
+
+static bool benchBase64(BenchRun& run)
+{
+    // 16 KiB: small thumbnail; 160 KiB: 1024 px JPEG at q85; 1 MiB: 4K frame.
+    const size_t sizes[] = {16 * 1024, 160 * 1024, 1024 * 1024};
+
+    struct Kernel {
+        const char* name;
+        Base64Kernel encode;
+        bool available;
+    };
+    std::vector<Kernel> kernels = {{"base64/scalar", &base64EncodeScalar, true}};
+#ifdef V2K_BASE64_X86
+    kernels.push_back({"base64/ssse3", &base64EncodeSsse3, base64CpuHasSsse3()});
+    kernels.push_back({"base64/avx2", &base64EncodeAvx2, base64CpuHasAvx2()});
+#endif
+
+    std::mt19937 rng(42);
+    bool ok = true;
+
+    for (const size_t size : sizes) {
+        std::vector<unsigned char> data(size);
+        for (auto& b : data) {
+            b = static_cast<unsigned char>(rng());
+        }
+        const std::string expected = legacyBase64Encode(data);
+        const std::string suffix = " " + std::to_string(size / 1024) + "KiB";
+
+        run.run("base64/legacy" + suffix, size, expected.size(), [&] {
+            const std::string s = legacyBase64Encode(data);
+            g_sink = g_sink + static_cast<unsigned char>(s.back());
+        });
+
+        std::string out(base64EncodedLength(size), '\0');
+        for (const auto& kernel : kernels) {
+            if (!kernel.available || !run.selected(kernel.name + suffix)) {
+                continue;
+            }
+
+            // Check every size remainder so the vector loop tails are covered.
+            for (size_t n = size - 64; n <= size; ++n) {
+                std::string check(base64EncodedLength(n), '\0');
+                kernel.encode(data.data(), n, check.data());
+                std::vector<unsigned char> prefix(data.begin(), data.begin() + n);
+                if (check != legacyBase64Encode(prefix)) {
+                    std::cerr << "[ERROR] " << kernel.name << " mismatch at n=" << n << "\n";
+                    ok = false;
+                    break;
+                }
+            }
+
+            run.run(kernel.name + suffix, size, out.size(), [&] {
+                kernel.encode(data.data(), data.size(), out.data());
+                g_sink = g_sink + static_cast<unsigned char>(out.back());
+            });
+        }
+
+        // What the pipeline does per request: one allocation, prefix + payload.
+        run.run(std::string("base64/data-url(") + base64SelectedKernel().name + ")" + suffix,
+                size, expected.size(), [&] {
+            const std::string url = base64DataUrl("data:image/jpeg;base64,", data);
+            g_sink = g_sink + static_cast<unsigned char>(url.back());
+        });
+
+        if (base64DataUrl("", data) != expected) {
+            std::cerr << "[ERROR] base64DataUrl mismatch at n=" << size << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// resizeMaxDim to the pipeline's default --max-dim from common capture sizes.
+static bool benchResize(BenchRun& run)
+{
+    const cv::Size sizes[] = {{1280, 720}, {1920, 1080}, {3840, 2160}};
+    const struct {
+        const char* name;
+        int flag;
+    } modes[] = {
+        {"nearest", cv::INTER_NEAREST},
+        {"linear", cv::INTER_LINEAR},
+        {"area", cv::INTER_AREA},   // pipeline default
+        {"cubic", cv::INTER_CUBIC},
+    };
+    const int maxDim = 1024;
+
+    bool ok = true;
+    for (const auto& size : sizes) {
+        const std::string dims = std::to_string(size.width) + "x" + std::to_string(size.height);
+        bool any = false;
+        for (const auto& mode : modes) {
+            any = any || run.selected("resize/" + std::string(mode.name) + " " + dims);
+        }
+        if (!any) {
+            continue;
+        }
+
+        const cv::Mat frame = syntheticFrame(size.width, size.height);
+        const size_t bytes = frame.total() * frame.elemSize();
+        for (const auto& mode : modes) {
+            const cv::Mat check = resizeMaxDim(frame, maxDim, mode.flag);
+            if (std::max(check.cols, check.rows) != maxDim) {
+                std::cerr << "[ERROR] resizeMaxDim(" << dims << ", " << mode.name
+                          << ") returned " << check.cols << "x" << check.rows << "\n";
+                ok = false;
+            }
+            run.run("resize/" + std::string(mode.name) + " " + dims, bytes,
+                    check.total() * check.elemSize(), [&] {
+                const cv::Mat resized = resizeMaxDim(frame, maxDim, mode.flag);
+                g_sink = g_sink + resized.rows;
+            });
+        }
+    }
+    return ok;
+}
+
+// encodeJpeg on a frame already resized to the default --max-dim.
+static bool benchJpeg(BenchRun& run)
+{
+    const cv::Mat frame = resizeMaxDim(syntheticFrame(1920, 1080), 1024);
+    const size_t bytes = frame.total() * frame.elemSize();
+    const std::string dims = std::to_string(frame.cols) + "x" + std::to_string(frame.rows);
+
+    bool ok = true;
+    for (const int quality : {50, 70, 85, 95}) {
+        const std::string name = "jpeg/q" + std::to_string(quality) + " " + dims;
+        if (!run.selected(name)) {
+            continue;
+        }
+        std::vector<uchar> buffer;
+        if (!encodeJpeg(frame, quality, buffer) || buffer.empty()) {
+            std::cerr << "[ERROR] encodeJpeg failed at quality " << quality << "\n";
+            ok = false;
+            continue;
+        }
+        run.run(name, bytes, buffer.size(), [&] {
+            encodeJpeg(frame, quality, buffer);
+            g_sink = g_sink + buffer.size();
+        });
+    }
+    return ok;
+}
+
+// buildChatRequestBody and its serialization with a realistic image payload.
+static bool benchRequestBody(BenchRun& run)
+{
+    std::vector<uchar> jpeg;
+    encodeJpeg(resizeMaxDim(syntheticFrame(1920, 1080), 1024), 85, jpeg);
+    const std::string dataUrl = base64DataUrl("data:image/jpeg;base64,", jpeg);
+    const std::string prompt =
+        "Describe what is happening in this frame. Wall time: 12.345s; "
+        "media position: 12.345s; interval #12";
+
+    // The pipeline moves its data URL in; here it has to be copied, which
+    // is included in the build timing.
+    run.run("request/build", dataUrl.size(), 0, [&] {
+        const json body = buildChatRequestBody("medgemma-1.5:4b", prompt, dataUrl, false);
+        g_sink = g_sink + body.size();
+    });
+
+    const json body = buildChatRequestBody("medgemma-1.5:4b", prompt, dataUrl, false);
+    const std::string payload = body.dump();
+    run.run("request/serialize", dataUrl.size(), payload.size(), [&] {
+        const std::string s = body.dump();
+        g_sink = g_sink + s.size();
+    });
+
+    const bool ok = payload.find(dataUrl) != std::string::npos;
+    if (!ok) {
+        std::cerr << "[ERROR] Serialized request does not contain the data URL\n";
+    }
+    return ok;
+}
+
+// json::parse plus extractMessageText for each response shape it accepts.
+static bool benchResponseParsing(BenchRun& run)
+{
+    bool ok = true;
+    for (const size_t size : {size_t{1024}, size_t{64 * 1024}}) {
+        const std::string text = responseText(size);
+        const std::string half1 = text.substr(0, text.size() / 2);
+        const std::string half2 = text.substr(text.size() / 2);
+        const std::string suffix = " " + std::to_string(size / 1024) + "KiB";
+
+        const std::pair<const char*, json> shapes[] = {
+            {"chat", {{"choices", {{{"message", {{"role", "assistant"}, {"content", text}}}}}}}},
+            {"parts", {{"choices", {{{"message", {{"role", "assistant"}, {"content", {
+                {{"type", "text"}, {"text", half1}}, {{"type", "text"}, {"text", half2}}}}}}}}}}},
+            {"text", {{"choices", {{{"text", text}}}}}},
+            {"output_text", {{"output_text", text}}},
+            {"output", {{"output", {{{"content", {
+                {{"type", "output_text"}, {"text", half1}},
+                {{"type", "output_text"}, {"text", half2}}}}}}}}},
+        };
+
+        for (const auto& [shape, response] : shapes) {
+            if (extractMessageText(response) != text) {
+                std::cerr << "[ERROR] extractMessageText failed on shape " << shape << "\n";
+                ok = false;
+            }
+            const std::string raw = response.dump();
+            run.run("response/parse+extract(" + std::string(shape) + ")" + suffix,
+                    raw.size(), text.size(), [&] {
+                const std::string s = extractMessageText(json::parse(raw));
+                g_sink = g_sink + s.size();
+            });
+        }
+
+        // Extraction alone, on the default shape.
+        const json& chat = shapes[0].second;
+        run.run("response/extract(chat)" + suffix, text.size(), text.size(), [&] {
+            const std::string s = extractMessageText(chat);
+            g_sink = g_sink + s.size();
+        });
+    }
+    return ok;
+}
+
+// parseMetadataDateTime on the creation_time variants seen in media files.
+static bool benchDateTime(BenchRun& run)
+{
+    const std::pair<const char*, const char*> inputs[] = {
+        {"plain", "2025-03-14 09:26:53"},
+        {"iso-utc", "2025-03-14T09:26:53.000000Z"},
+        {"iso-offset", "2025-03-14T09:26:53+01:00"},
+    };
+
+    bool ok = true;
+    for (const auto& [name, input] : inputs) {
+        std::chrono::system_clock::time_point tp{};
+        if (!parseMetadataDateTime(input, tp)) {
+            std::cerr << "[ERROR] parseMetadataDateTime rejected \"" << input << "\"\n";
+            ok = false;
+        }
+        run.run("datetime/" + std::string(name), std::strlen(input), 0, [&] {
+            std::chrono::system_clock::time_point parsed{};
+            parseMetadataDateTime(input, parsed);
+            g_sink = g_sink + static_cast<uint64_t>(parsed.time_since_epoch().count());
+        });
+    }
+    return ok;
+}
+
+static void printUsage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  --min-time <sec>           Minimum time per benchmark (default 0.3)\n"
+              << "  --filter <substring>       Only run benchmarks whose name contains it\n"
+              << "  --format table|json|csv    Output format (default table)\n"
+              << "  --compare <baseline.json>  Show the change against a previous --format json run\n";
+}
+
+int main(int argc, char** argv)
+{
+    BenchRun run;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (a == "--min-time" && hasValue) {
+            if (!parseDoubleStrict(argv[++i], run.minTimeSec) || !std::isfinite(run.minTimeSec) ||
+                run.minTimeSec <= 0.0) {
+                std::cerr << "[ERROR] --min-time must be a number > 0\n";
+                return 1;
+            }
+        } else if (a == "--filter" && hasValue) {
+            run.filter = argv[++i];
+        } else if (a == "--format" && hasValue) {
+            const std::string f = argv[++i];
+            if (f == "table") {
+                run.format = OutputFormat::Table;
+            } else if (f == "json") {
+                run.format = OutputFormat::Json;
+            } else if (f == "csv") {
+                run.format = OutputFormat::Csv;
+            } else {
+                std::cerr << "[ERROR] --format must be table, json or csv\n";
+                return 1;
+            }
+        } else if (a == "--compare" && hasValue) {
+            if (!loadBaseline(argv[++i], run.baselineNs)) {
+                return 1;
+            }
+        } else {
+            printUsage(argv[0]);
+            return a == "--help" || a == "-h" ? 0 : 1;
+        }
+    }
+
+    // Benchmark the steady state, not OpenCV's thread-pool fan-out.
+    cv::setNumThreads(1);
+
+    if (run.format == OutputFormat::Table) {
+        run.printHeader();
+    }
+
+    bool ok = true;
+    ok = benchBase64(run) && ok;
+    ok = benchResize(run) && ok;
+    ok = benchJpeg(run) && ok;
+    ok = benchRequestBody(run) && ok;
+    ok = benchResponseParsing(run) && ok;
+    ok = benchDateTime(run) && ok;
+
+    if (run.format == OutputFormat::Json) {
+        run.printJson();
+    } else if (run.format == OutputFormat::Csv) {
+        run.printCsv();
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Standalone mock OpenAI-compatible server (see mock_openai_server.hpp), for
+// running the pipeline against a predictable endpoint by hand. Point
+// openai.base_url at http://127.0.0.1:<port>/v1/.
+//
+// Usage: mock_openai_server.exe [--port <n>] [--bind <addr>] [model options]
+#include "mock_openai_server.hpp"
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static volatile std::sig_atomic_t g_stop = 0;
+
+static void onSignal(int)
+{
+    g_stop = 1;
+}
+
+static void printUsage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "Options:\n"
+              << "  --port <n>              Listen port (default 8089; 0 = any free port)\n"
+              << "  --bind <addr>           Listen address (default 127.0.0.1)\n"
+              << mockServerOptionsUsage();
+}
+
+int main(int argc, char** argv)
+{
+    MockServerOptions options;
+    options.port = 8089;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        bool matched = false;
+        std::string error;
+        if (!parseMockServerOption(argc, argv, i, options, matched, error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return 1;
+        }
+        if (matched) {
+            continue;
+        }
+
+        if (a == "--port" && i + 1 < argc) {
+            // No pipeline_helpers.hpp here: the mock server does not link OpenCV.
+            const std::string v = argv[++i];
+            char* end = nullptr;
+            const long port = std::strtol(v.c_str(), &end, 10);
+            if (v.empty() || *end != '\0' || port < 0 || port > 65535) {
+                std::cerr << "[ERROR] --port must be an integer in 0..65535\n";
+                return 1;
+            }
+            options.port = static_cast<int>(port);
+        } else if (a == "--bind" && i + 1 < argc) {
+            options.bindAddress = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return a == "--help" || a == "-h" ? 0 : 1;
+        }
+    }
+
+    MockOpenAIServer server(options);
+    std::string error;
+    if (!server.start(error)) {
+        std::cerr << "[ERROR] " << error << "\n";
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::cerr << "[INFO] Mock OpenAI server on http://" << options.bindAddress << ":"
+              << server.port() << "/v1/ (Ctrl-C to stop)\n";
+
+    while (!g_stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    server.stop();
+    std::cerr << "[INFO] Served " << server.requests() << " requests in "
+              << server.batches() << " batches\n";
+    return 0;
+}
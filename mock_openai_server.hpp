@@ -0,0 +1,736 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Mock OpenAI-compatible chat-completions server for benchmarks.
+//
+// It answers POST .../chat/completions after a simulated inference delay and
+// never looks at the image, so the pipeline can be exercised at full rate on
+// a machine without a GPU or model. The delay model covers the two server
+// behaviours that matter for the pipeline's scheduling:
+// - independent requests (engines = 0): every request sleeps its own sampled
+//   latency, like a remote API with plenty of capacity;
+// - batching engines (engines >= 1): requests queue for a fixed number of
+//   engines, each of which collects up to maxBatch requests (waiting at most
+//   batchWindowMs after the first) and serves them together in
+//   latency + (n - 1) * batchItemMs, like vLLM or llama.cpp with parallel
+//   slots. engines = 1, maxBatch = 1 is a strictly serial server (Ollama's
+//   default).
+// Responses use one of the JSON shapes extractMessageText() accepts, and
+// "stream": true requests get a server-sent event stream.
+//
+// POSIX sockets only; the benchmark targets are built on Linux/macOS.
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Distribution of the simulated inference time.
+struct MockLatencyModel {
+    enum class Kind { Fixed, Uniform, LogNormal };
+
+    Kind kind = Kind::Fixed;
+    double meanMs = 200.0;
+    double spreadMs = 0.0;   // uniform: half-width; lognormal: standard deviation
+
+    double sampleMs(std::mt19937_64& rng) const
+    {
+        switch (kind) {
+        case Kind::Fixed:
+            return meanMs;
+        case Kind::Uniform:
+            return std::max(0.0, std::uniform_real_distribution<double>(
+                                     meanMs - spreadMs, meanMs + spreadMs)(rng));
+        case Kind::LogNormal: {
+            if (meanMs <= 0.0) {
+                return 0.0;
+            }
+            const double cv = spreadMs / meanMs;
+            const double sigma2 = std::log1p(cv * cv);
+            const double mu = std::log(meanMs) - sigma2 / 2.0;
+            return std::lognormal_distribution<double>(mu, std::sqrt(sigma2))(rng);
+        }
+        }
+        return meanMs;
+    }
+
+    // Parse "fixed:<ms>", "uniform:<mean>:<half-width>" or
+    // "lognormal:<mean>:<stddev>".
+    static bool parse(const std::string& spec, MockLatencyModel& out)
+    {
+        const size_t c1 = spec.find(':');
+        if (c1 == std::string::npos) {
+            return false;
+        }
+        const std::string kind = spec.substr(0, c1);
+        const size_t c2 = spec.find(':', c1 + 1);
+
+        char* end = nullptr;
+        const std::string first = spec.substr(c1 + 1, c2 == std::string::npos ? std::string::npos : c2 - c1 - 1);
+        const double mean = std::strtod(first.c_str(), &end);
+        if (first.empty() || *end != '\0' || !std::isfinite(mean) || mean < 0.0) {
+            return false;
+        }
+
+        double spread = 0.0;
+        if (c2 != std::string::npos) {
+            const std::string second = spec.substr(c2 + 1);
+            spread = std::strtod(second.c_str(), &end);
+            if (second.empty() || *end != '\0' || !std::isfinite(spread) || spread < 0.0) {
+                return false;
+            }
+        }
+
+        if (kind == "fixed" && c2 == std::string::npos) {
+            out = {Kind::Fixed, mean, 0.0};
+        } else if (kind == "uniform" && c2 != std::string::npos) {
+            out = {Kind::Uniform, mean, spread};
+        } else if (kind == "lognormal" && c2 != std::string::npos) {
+            out = {Kind::LogNormal, mean, spread};
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+// Response body shapes, matching the branches of extractMessageText().
+enum class MockResponseShape {
+    Chat,         // choices[0].message.content (string)
+    Parts,        // choices[0].message.content [{type, text}, ...]
+    Text,         // choices[0].text
+    OutputText,   // output_text
+    Output,       // output[].content[].text
+    Mixed,        // rotate through all of the above
+};
+
+inline bool parseMockResponseShape(const std::string& s, MockResponseShape& out)
+{
+    if (s == "chat") {
+        out = MockResponseShape::Chat;
+    } else if (s == "parts") {
+        out = MockResponseShape::Parts;
+    } else if (s == "text") {
+        out = MockResponseShape::Text;
+    } else if (s == "output_text") {
+        out = MockResponseShape::OutputText;
+    } else if (s == "output") {
+        out = MockResponseShape::Output;
+    } else if (s == "mixed") {
+        out = MockResponseShape::Mixed;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+constexpr long kMockMaxEngines = 256;
+constexpr long kMockMaxBatch = 1024;
+
+struct MockServerOptions {
+    std::string bindAddress = "127.0.0.1";
+    int port = 0;   // 0 = pick a free port
+
+    MockLatencyModel latency;
+    int engines = 0;              // 0 = every request independent
+    int maxBatch = 1;
+    double batchWindowMs = 0.0;
+    double batchItemMs = 0.0;
+
+    MockResponseShape shape = MockResponseShape::Chat;
+    std::string responseText =
+        "The room is quiet. One person is visible near the bed. No alarms are shown.";
+    double tokenIntervalMs = 20.0;   // between streamed words
+
+    unsigned seed = 1;
+};
+
+// Options shared by the mock server's own CLI and pipeline_bench. Consumes
+// argv[i] (and its value) if it is one of them; returns false with a message
+// in `error` if the value is invalid, and sets `matched` accordingly.
+inline bool parseMockServerOption(
+    int argc, char** argv, int& i, MockServerOptions& opt, bool& matched, std::string& error)
+{
+    const std::string a = argv[i];
+    matched = true;
+
+    auto value = [&](std::string& out) {
+        if (i + 1 >= argc) {
+            error = "Missing value for " + a;
+            return false;
+        }
+        out = argv[++i];
+        return true;
+    };
+    auto number = [&](double& out, double minValue) {
+        std::string v;
+        if (!value(v)) {
+            return false;
+        }
+        char* end = nullptr;
+        const double parsed = std::strtod(v.c_str(), &end);
+        if (v.empty() || *end != '\0' || !std::isfinite(parsed) || parsed < minValue) {
+            error = a + " must be a number >= " + std::to_string(static_cast<int>(minValue));
+            return false;
+        }
+        out = parsed;
+        return true;
+    };
+    // Counts: a whole number, bounded because --engines starts one thread each.
+    auto integer = [&](int& out, long minValue, long maxValue) {
+        std::string v;
+        if (!value(v)) {
+            return false;
+        }
+        char* end = nullptr;
+        errno = 0;
+        const long parsed = std::strtol(v.c_str(), &end, 10);
+        if (v.empty() || *end != '\0' || errno != 0 || parsed < minValue || parsed > maxValue) {
+            error = a + " must be an integer in " + std::to_string(minValue) + ".." + std::to_string(maxValue);
+            return false;
+        }
+        out = static_cast<int>(parsed);
+        return true;
+    };
+
+    std::string v;
+    double d = 0.0;
+    if (a == "--latency") {
+        if (!value(v)) return false;
+        if (!MockLatencyModel::parse(v, opt.latency)) {
+            error = "--latency expects fixed:<ms>, uniform:<ms>:<ms> or lognormal:<ms>:<ms>";
+            return false;
+        }
+    } else if (a == "--engines") {
+        if (!integer(opt.engines, 0, kMockMaxEngines)) return false;
+    } else if (a == "--max-batch") {
+        if (!integer(opt.maxBatch, 1, kMockMaxBatch)) return false;
+    } else if (a == "--batch-window-ms") {
+        if (!number(d, 0)) return false;
+        opt.batchWindowMs = d;
+    } else if (a == "--batch-item-ms") {
+        if (!number(d, 0)) return false;
+        opt.batchItemMs = d;
+    } else if (a == "--shape") {
+        if (!value(v)) return false;
+        if (!parseMockResponseShape(v, opt.shape)) {
+            error = "--shape must be chat, parts, text, output_text, output or mixed";
+            return false;
+        }
+    } else if (a == "--response-text") {
+        if (!value(opt.responseText)) return false;
+    } else if (a == "--token-interval-ms") {
+        if (!number(d, 0)) return false;
+        opt.tokenIntervalMs = d;
+    } else {
+        matched = false;
+    }
+    return true;
+}
+
+inline const char* mockServerOptionsUsage()
+{
+    return "  --latency <spec>        fixed:<ms> | uniform:<mean>:<half-width> |\n"
+           "                          lognormal:<mean>:<stddev> (default fixed:200)\n"
+           "  --engines <n>           Inference engines, 0..256; 0 = requests are independent (default 0)\n"
+           "  --max-batch <n>         Requests one engine serves together, 1..1024 (default 1)\n"
+           "  --batch-window-ms <ms>  How long an engine waits to fill a batch (default 0)\n"
+           "  --batch-item-ms <ms>    Extra time per additional request in a batch (default 0)\n"
+           "  --shape <s>             chat | parts | text | output_text | output | mixed (default chat)\n"
+           "  --response-text <t>     Text returned by the mock model\n"
+           "  --token-interval-ms <ms> Delay between streamed words (default 20)\n";
+}
+
+class MockOpenAIServer {
+public:
+    explicit MockOpenAIServer(MockServerOptions options)
+        : options_(std::move(options)), rng_(options_.seed) {}
+
+    ~MockOpenAIServer()
+    {
+        stop();
+    }
+
+    MockOpenAIServer(const MockOpenAIServer&) = delete;
+    MockOpenAIServer& operator=(const MockOpenAIServer&) = delete;
+
+    bool start(std::string& error)
+    {
+        listenFd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd_ < 0) {
+            error = "socket() failed";
+            return false;
+        }
+        // stop() only closes the socket of a running server.
+        auto fail = [this, &error](std::string message) {
+            ::close(listenFd_);
+            listenFd_ = -1;
+            error = std::move(message);
+            return false;
+        };
+        const int yes = 1;
+        ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(options_.port));
+        if (::inet_pton(AF_INET, options_.bindAddress.c_str(), &addr.sin_addr) != 1) {
+            return fail("invalid bind address " + options_.bindAddress);
+        }
+        if (::bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listenFd_, 64) != 0) {
+            return fail("cannot listen on " + options_.bindAddress + ":" + std::to_string(options_.port));
+        }
+
+        socklen_t len = sizeof(addr);
+        ::getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+
+        running_.store(true);
+        for (int i = 0; i < options_.engines; ++i) {
+            engines_.emplace_back([this] { engineLoop(); });
+        }
+        acceptThread_ = std::thread([this] { acceptLoop(); });
+        return true;
+    }
+
+    void stop()
+    {
+        if (!running_.exchange(false)) {
+            return;
+        }
+        queueCv_.notify_all();
+        if (acceptThread_.joinable()) {
+            acceptThread_.join();
+        }
+        for (auto& t : engines_) {
+            t.join();
+        }
+        engines_.clear();
+
+        std::list<Connection> connections;
+        {
+            std::lock_guard<std::mutex> lock(connMtx_);
+            connections.swap(connections_);
+        }
+        for (auto& connection : connections) {
+            connection.thread.join();
+        }
+        ::close(listenFd_);
+        listenFd_ = -1;
+    }
+
+    int port() const { return port_; }
+
+    uint64_t requests() const { return requests_.load(); }
+    uint64_t batches() const { return batches_.load(); }
+
+private:
+    // A client connection served by its own thread.
+    struct Connection {
+        std::thread thread;
+        bool finished = false;   // guarded by connMtx_
+    };
+
+    // A request waiting for an engine.
+    struct Ticket {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+        std::chrono::steady_clock::time_point arrived = std::chrono::steady_clock::now();
+    };
+
+    static bool waitReadable(int fd, int timeoutMs)
+    {
+        pollfd pfd{fd, POLLIN, 0};
+        return ::poll(&pfd, 1, timeoutMs) > 0;
+    }
+
+    static bool sendAll(int fd, std::string_view data)
+    {
+        while (!data.empty()) {
+            const ssize_t n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            data.remove_prefix(static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    static bool gunzip(const std::string& in, std::string& out)
+    {
+        z_stream zs{};
+        if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+            return false;
+        }
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        zs.avail_in = static_cast<uInt>(in.size());
+        int rc = Z_OK;
+        char buf[64 * 1024];
+        while (rc == Z_OK) {
+            zs.next_out = reinterpret_cast<Bytef*>(buf);
+            zs.avail_out = sizeof(buf);
+            rc = inflate(&zs, Z_NO_FLUSH);
+            out.append(buf, sizeof(buf) - zs.avail_out);
+        }
+        inflateEnd(&zs);
+        return rc == Z_STREAM_END;
+    }
+
+    double sampleLatencyMs()
+    {
+        std::lock_guard<std::mutex> lock(rngMtx_);
+        return options_.latency.sampleMs(rng_);
+    }
+
+    void sleepMs(double ms)
+    {
+        if (ms > 0.0) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms));
+        }
+    }
+
+    void acceptLoop()
+    {
+        while (running_.load()) {
+            if (!waitReadable(listenFd_, 100)) {
+                continue;
+            }
+            const int fd = ::accept(listenFd_, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            const int yes = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+            std::lock_guard<std::mutex> lock(connMtx_);
+            reapConnections();
+            Connection& connection = connections_.emplace_back();
+            connection.thread = std::thread([this, fd, &connection] {
+                serveConnection(fd);
+                ::close(fd);
+                std::lock_guard<std::mutex> finishedLock(connMtx_);
+                connection.finished = true;
+            });
+        }
+    }
+
+    // Join the threads of closed connections, so a long benchmark that
+    // reconnects often does not accumulate them. Called with connMtx_ held;
+    // a finished thread has nothing left to do but return.
+    void reapConnections()
+    {
+        for (auto it = connections_.begin(); it != connections_.end();) {
+            if (it->finished) {
+                it->thread.join();
+                it = connections_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Serve keep-alive requests on one connection until the client closes it.
+    void serveConnection(int fd)
+    {
+        std::string buffer;
+        char chunk[64 * 1024];
+        while (running_.load()) {
+            const size_t headEnd = buffer.find("\r\n\r\n");
+            if (headEnd == std::string::npos) {
+                if (!waitReadable(fd, 100)) {
+                    continue;
+                }
+                const ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    return;
+                }
+                buffer.append(chunk, static_cast<size_t>(n));
+                continue;
+            }
+
+            const std::string head = buffer.substr(0, headEnd);
+            const size_t bodyLen = headerValueSize(head, "content-length");
+            while (buffer.size() < headEnd + 4 + bodyLen && running_.load()) {
+                if (!waitReadable(fd, 100)) {
+                    continue;
+                }
+                const ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    return;
+                }
+                buffer.append(chunk, static_cast<size_t>(n));
+            }
+            std::string body = buffer.substr(headEnd + 4, bodyLen);
+            buffer.erase(0, headEnd + 4 + bodyLen);
+
+            if (!handleRequest(fd, head, std::move(body))) {
+                return;
+            }
+        }
+    }
+
+    // Value of a numeric header (case-insensitive name), 0 if absent.
+    static size_t headerValueSize(const std::string& head, const std::string& name)
+    {
+        const std::string value = headerValue(head, name);
+        return value.empty() ? 0 : static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+    }
+
+    static std::string headerValue(const std::string& head, const std::string& name)
+    {
+        std::string lower(head);
+        std::transform(lower.begin(), lower.end(), lower.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        const size_t pos = lower.find("\r\n" + name + ":");
+        if (pos == std::string::npos) {
+            return {};
+        }
+        size_t start = pos + 3 + name.size();
+        const size_t end = head.find("\r\n", start);
+        while (start < end && head[start] == ' ') {
+            ++start;
+        }
+        return head.substr(start, end - start);
+    }
+
+    bool handleRequest(int fd, const std::string& head, std::string body)
+    {
+        const size_t lineEnd = head.find("\r\n");
+        const std::string requestLine = head.substr(0, lineEnd);
+        const bool isChat = requestLine.rfind("POST ", 0) == 0 &&
+                            requestLine.find("/chat/completions") != std::string::npos;
+        if (!isChat) {
+            return sendAll(fd, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        }
+
+        if (headerValue(head, "content-encoding") == "gzip") {
+            std::string plain;
+            if (!gunzip(body, plain)) {
+                return sendJson(fd, 400, R"({"error":{"message":"bad gzip body"}})");
+            }
+            body.swap(plain);
+        }
+        const nlohmann::json request = nlohmann::json::parse(body, nullptr, false);
+        if (request.is_discarded()) {
+            return sendJson(fd, 400, R"({"error":{"message":"invalid JSON"}})");
+        }
+
+        const uint64_t index = requests_.fetch_add(1);
+        infer();
+
+        const auto streamIt = request.find("stream");
+        if (streamIt != request.end() && streamIt->is_boolean() && streamIt->get<bool>()) {
+            return sendStream(fd);
+        }
+        return sendJson(fd, 200, responseBody(index).dump());
+    }
+
+    // Block for the simulated inference of one request.
+    void infer()
+    {
+        if (options_.engines <= 0) {
+            batches_.fetch_add(1);
+            sleepMs(sampleLatencyMs());
+            return;
+        }
+
+        auto ticket = std::make_shared<Ticket>();
+        {
+            std::lock_guard<std::mutex> lock(queueMtx_);
+            queue_.push_back(ticket);
+        }
+        queueCv_.notify_all();
+
+        std::unique_lock<std::mutex> lock(ticket->mtx);
+        ticket->cv.wait(lock, [&] { return ticket->done || !running_.load(); });
+    }
+
+    void engineLoop()
+    {
+        while (running_.load()) {
+            std::vector<std::shared_ptr<Ticket>> batch;
+            {
+                std::unique_lock<std::mutex> lock(queueMtx_);
+                queueCv_.wait(lock, [&] { return !queue_.empty() || !running_.load(); });
+                if (!running_.load()) {
+                    break;
+                }
+
+                // Fill the batch until it is full or the window after the
+                // oldest request has passed.
+                const auto deadline = queue_.front()->arrived +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double, std::milli>(options_.batchWindowMs));
+                while (static_cast<int>(queue_.size()) < options_.maxBatch &&
+                       std::chrono::steady_clock::now() < deadline && running_.load()) {
+                    queueCv_.wait_until(lock, deadline);
+                }
+                const size_t n = std::min(queue_.size(), static_cast<size_t>(options_.maxBatch));
+                for (size_t i = 0; i < n; ++i) {
+                    batch.push_back(std::move(queue_.front()));
+                    queue_.pop_front();
+                }
+            }
+            if (batch.empty()) {
+                continue;
+            }
+
+            batches_.fetch_add(1);
+            sleepMs(sampleLatencyMs() +
+                    options_.batchItemMs * static_cast<double>(batch.size() - 1));
+            for (auto& ticket : batch) {
+                {
+                    std::lock_guard<std::mutex> lock(ticket->mtx);
+                    ticket->done = true;
+                }
+                ticket->cv.notify_one();
+            }
+        }
+
+        // Release anything still queued so connection threads can exit.
+        std::lock_guard<std::mutex> lock(queueMtx_);
+        for (auto& ticket : queue_) {
+            std::lock_guard<std::mutex> ticketLock(ticket->mtx);
+            ticket->done = true;
+            ticket->cv.notify_one();
+        }
+        queue_.clear();
+    }
+
+    nlohmann::json responseBody(uint64_t index) const
+    {
+        using nlohmann::json;
+        const std::string& text = options_.responseText;
+
+        MockResponseShape shape = options_.shape;
+        if (shape == MockResponseShape::Mixed) {
+            shape = static_cast<MockResponseShape>(index % 5);
+        }
+
+        switch (shape) {
+        case MockResponseShape::Parts:
+            return {{"choices", json::array({{{"message", {{"role", "assistant"},
+                {"content", json::array({{{"type", "text"}, {"text", text}}})}}}}})}};
+        case MockResponseShape::Text:
+            return {{"choices", json::array({{{"text", text}}})}};
+        case MockResponseShape::OutputText:
+            return {{"output_text", text}};
+        case MockResponseShape::Output:
+            return {{"output", json::array({{{"type", "message"},
+                {"content", json::array({{{"type", "output_text"}, {"text", text}}})}}})}};
+        case MockResponseShape::Chat:
+        case MockResponseShape::Mixed:
+            break;
+        }
+        return {{"id", "mock-" + std::to_string(index)},
+                {"object", "chat.completion"},
+                {"choices", json::array({{{"index", 0},
+                    {"message", {{"role", "assistant"}, {"content", text}}},
+                    {"finish_reason", "stop"}}})}};
+    }
+
+    bool sendJson(int fd, int status, const std::string& body)
+    {
+        std::string response = "HTTP/1.1 " + std::to_string(status) +
+                               (status == 200 ? " OK" : " Bad Request") + "\r\n";
+        response += "Content-Type: application/json\r\n";
+        response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        response += body;
+        return sendAll(fd, response);
+    }
+
+    // The simulated inference time is the time to first token; words then
+    // follow every tokenIntervalMs.
+    bool sendStream(int fd)
+    {
+        auto chunk = [&](const std::string& payload) {
+            char size[32];
+            std::snprintf(size, sizeof(size), "%zx\r\n", payload.size());
+            return sendAll(fd, std::string(size) + payload + "\r\n");
+        };
+
+        if (!sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                         "Transfer-Encoding: chunked\r\n\r\n")) {
+            return false;
+        }
+
+        const std::string& text = options_.responseText;
+        size_t pos = 0;
+        bool first = true;
+        while (pos < text.size()) {
+            size_t next = text.find(' ', pos);
+            next = next == std::string::npos ? text.size() : next + 1;
+            if (!first) {
+                sleepMs(options_.tokenIntervalMs);
+            }
+            first = false;
+
+            const nlohmann::json event = {
+                {"object", "chat.completion.chunk"},
+                {"choices", nlohmann::json::array({{{"index", 0},
+                    {"delta", {{"content", text.substr(pos, next - pos)}}}}})}};
+            if (!chunk("data: " + event.dump() + "\n\n")) {
+                return false;
+            }
+            pos = next;
+        }
+        return chunk("data: [DONE]\n\n") && chunk("");
+    }
+
+    MockServerOptions options_;
+    int listenFd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{false};
+
+    std::mutex rngMtx_;
+    std::mt19937_64 rng_;
+
+    std::thread acceptThread_;
+    std::mutex connMtx_;
+    std::list<Connection> connections_;   // list: the threads hold references
+
+    std::vector<std::thread> engines_;
+    std::mutex queueMtx_;
+    std::condition_variable queueCv_;
+    std::deque<std::shared_ptr<Ticket>> queue_;
+
+    std::atomic<uint64_t> requests_{0};
+    std::atomic<uint64_t> batches_{0};
+};
@@ -0,0 +1,502 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// End-to-end benchmark of realtime_video_pipeline against a local mock
+// OpenAI-compatible server.
+//
+// The harness writes a synthetic video, starts the mock server in-process,
+// runs the real pipeline executable on N copies of the video (played back at
+// 1x, so each behaves like a live camera) with its metrics endpoint enabled,
+// and after --duration seconds scrapes the metrics and stops it. It reports
+// sustained triggers/s, end-to-end latency from trigger to printed result,
+// pipeline CPU per stream and peak RSS, which is enough to catch performance
+// regressions on a plain Linux box without a GPU or model.
+//
+// Usage: pipeline_bench.exe [options] [-- <extra pipeline arguments>]
+#include "mock_openai_server.hpp"
+#include "pipeline_helpers.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <curl/curl.h>
+
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+namespace fs = std::filesystem;
+
+struct BenchOptions {
+    std::string pipeline;      // default: next to this executable
+    int streams = 1;
+    double durationSec = 30.0;
+    int width = 1280;
+    int height = 720;
+    double fps = 30.0;
+    double sceneChangeSec = 10.0;
+    double intervalSec = 1.0;
+    int inflight = 1;
+    bool stream = false;
+    bool keepFiles = false;
+    MockServerOptions mock;
+    std::vector<std::string> extraArgs;
+};
+
+static void printUsage(const char* argv0)
+{
+    std::cerr
+        << "Usage: " << argv0 << " [options] [-- <extra pipeline arguments>]\n"
+        << "Options:\n"
+        << "  --pipeline <path>       Pipeline executable (default: realtime_video_pipeline.exe\n"
+        << "                          next to this program)\n"
+        << "  --streams <n>           Synthetic sources (default 1)\n"
+        << "  --duration <sec>        Measured run time (default 30)\n"
+        << "  --size <w>x<h>          Synthetic video size (default 1280x720)\n"
+        << "  --fps <n>               Synthetic video frame rate (default 30)\n"
+        << "  --scene-change <sec>    Change the scene every <sec> seconds (default 10)\n"
+        << "  --interval <sec>        Pipeline --interval (default 1)\n"
+        << "  --inflight <n>          Pipeline --inflight (default 1)\n"
+        << "  --stream                Pipeline --stream (mock answers with SSE)\n"
+        << "  --keep                  Keep the temporary video, config and logs\n"
+        << "Mock server:\n"
+        << mockServerOptionsUsage();
+}
+
+static bool parseArgs(int argc, char** argv, BenchOptions& opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+
+        bool matched = false;
+        std::string error;
+        if (!parseMockServerOption(argc, argv, i, opt.mock, matched, error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return false;
+        }
+        if (matched) {
+            continue;
+        }
+
+        const bool hasValue = i + 1 < argc;
+        auto intValue = [&](int& out, int minValue) {
+            int parsed = 0;
+            if (!parseIntStrict(argv[++i], parsed) || parsed < minValue) {
+                std::cerr << "[ERROR] " << a << " must be an integer >= " << minValue << "\n";
+                return false;
+            }
+            out = parsed;
+            return true;
+        };
+        auto doubleValue = [&](double& out, double minValue) {
+            double parsed = 0.0;
+            if (!parseDoubleStrict(argv[++i], parsed) || !std::isfinite(parsed) || parsed < minValue) {
+                std::cerr << "[ERROR] " << a << " must be a number >= " << minValue << "\n";
+                return false;
+            }
+            out = parsed;
+            return true;
+        };
+
+        if (a == "--") {
+            opt.extraArgs.assign(argv + i + 1, argv + argc);
+            break;
+        } else if (a == "--pipeline" && hasValue) {
+            opt.pipeline = argv[++i];
+        } else if (a == "--streams" && hasValue) {
+            if (!intValue(opt.streams, 1)) {
+                return false;
+            }
+        } else if (a == "--duration" && hasValue) {
+            if (!doubleValue(opt.durationSec, 1.0)) {
+                return false;
+            }
+        } else if (a == "--size" && hasValue) {
+            const std::string size = argv[++i];
+            const size_t x = size.find('x');
+            int w = 0;
+            int h = 0;
+            if (x == std::string::npos || size.find_first_not_of("0123456789x") != std::string::npos ||
+                !parseIntStrict(size.substr(0, x), w) ||
+                !parseIntStrict(size.substr(x + 1), h) || w < 16 || h < 16 || w > 7680 || h > 4320) {
+                std::cerr << "[ERROR] --size expects <w>x<h> between 16x16 and 7680x4320\n";
+                return false;
+            }
+            opt.width = w;
+            opt.height = h;
+        } else if (a == "--fps" && hasValue) {
+            if (!doubleValue(opt.fps, 1.0)) {
+                return false;
+            }
+        } else if (a == "--scene-change" && hasValue) {
+            if (!doubleValue(opt.sceneChangeSec, 0.1)) {
+                return false;
+            }
+        } else if (a == "--interval" && hasValue) {
+            if (!doubleValue(opt.intervalSec, 0.1)) {
+                return false;
+            }
+        } else if (a == "--inflight" && hasValue) {
+            if (!intValue(opt.inflight, 1)) {
+                return false;
+            }
+        } else if (a == "--stream") {
+            opt.stream = true;
+        } else if (a == "--keep") {
+            opt.keepFiles = true;
+        } else {
+            printUsage(argv[0]);
+            if (a != "--help" && a != "-h") {
+                std::cerr << "[ERROR] Unknown or incomplete option: " << a << "\n";
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Synthetic source
+//------------------------------------------------------------------------------
+
+// Write an MJPG AVI with a moving box over a textured background that
+// changes every sceneChangeSec, so frames are neither identical (which would
+// flatter the JPEG encoder and the response cache) nor pure noise.
+static bool writeSyntheticVideo(const BenchOptions& opt, const fs::path& path, double lengthSec)
+{
+    cv::VideoWriter writer(path.string(), cv::VideoWriter::fourcc('M', 'J', 'P', 'G'),
+                           opt.fps, cv::Size(opt.width, opt.height), true);
+    if (!writer.isOpened()) {
+        return false;
+    }
+
+    const int frames = static_cast<int>(lengthSec * opt.fps);
+    cv::Mat background(opt.height, opt.width, CV_8UC3);
+    cv::Mat frame;
+    int scene = -1;
+    for (int i = 0; i < frames; ++i) {
+        const double t = i / opt.fps;
+        const int s = static_cast<int>(t / opt.sceneChangeSec);
+        if (s != scene) {
+            scene = s;
+            cv::randu(background, cv::Scalar::all(0), cv::Scalar::all(40));
+            const int shade = 60 + (scene * 47) % 150;
+            background += cv::Scalar(shade, (shade * 2) % 200, 255 - shade);
+        }
+
+        background.copyTo(frame);
+        const int box = opt.height / 4;
+        const int x = static_cast<int>((opt.width - box) * (0.5 + 0.5 * std::sin(t)));
+        const int y = static_cast<int>((opt.height - box) * (0.5 + 0.5 * std::cos(t * 0.7)));
+        cv::rectangle(frame, cv::Rect(x, y, box, box), cv::Scalar(230, 230, 230), cv::FILLED);
+        cv::putText(frame, "frame " + std::to_string(i), cv::Point(20, 40),
+                    cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(255, 255, 255), 2);
+        writer.write(frame);
+    }
+    writer.release();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Metrics scraping
+//------------------------------------------------------------------------------
+
+static size_t appendToString(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+    static_cast<std::string*>(userdata)->append(ptr, size * nmemb);
+    return size * nmemb;
+}
+
+// Fetch a Prometheus text page into "name{labels}" -> value.
+static bool scrapeMetrics(int port, std::map<std::string, double>& out)
+{
+    CURL* curl = curl_easy_init();
+    if (curl == nullptr) {
+        return false;
+    }
+    std::string body;
+    const std::string url = "http://127.0.0.1:" + std::to_string(port) + "/metrics";
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &appendToString);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 2000L);
+    const CURLcode rc = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
+    if (rc != CURLE_OK) {
+        return false;
+    }
+
+    std::istringstream lines(body);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const size_t space = line.rfind(' ');
+        if (space == std::string::npos) {
+            continue;
+        }
+        out[line.substr(0, space)] = std::atof(line.c_str() + space + 1);
+    }
+    return !out.empty();
+}
+
+static double metricOr(const std::map<std::string, double>& m, const std::string& key, double fallback = 0.0)
+{
+    const auto it = m.find(key);
+    return it != m.end() ? it->second : fallback;
+}
+
+static std::string stageQuantiles(const std::map<std::string, double>& m, const std::string& stage)
+{
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(1);
+    const char* sep = "";
+    for (const char* q : {"0.5", "0.95", "0.99"}) {
+        s << sep << metricOr(m, "v2k_stage_seconds{stage=\"" + stage + "\",quantile=\"" + q + "\"}") * 1e3;
+        sep = " / ";
+    }
+    s << " ms";
+    return s.str();
+}
+
+//------------------------------------------------------------------------------
+// Pipeline process
+//------------------------------------------------------------------------------
+
+// A free TCP port on the loopback interface (closed again before use).
+static int pickFreePort()
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    int port = 0;
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    ::close(fd);
+    return port;
+}
+
+static pid_t spawn(const std::vector<std::string>& args, const fs::path& stdoutPath, const fs::path& stderrPath)
+{
+    const pid_t pid = ::fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    const int out = ::open(stdoutPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    const int err = ::open(stderrPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out >= 0) {
+        ::dup2(out, STDOUT_FILENO);
+    }
+    if (err >= 0) {
+        ::dup2(err, STDERR_FILENO);
+    }
+
+    std::vector<char*> argv;
+    for (const auto& a : args) {
+        argv.push_back(const_cast<char*>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+    ::execv(argv[0], argv.data());
+    std::perror("execv");
+    std::_Exit(127);
+}
+
+static void printTail(const fs::path& path, size_t lines)
+{
+    std::ifstream in(path);
+    std::vector<std::string> all;
+    for (std::string line; std::getline(in, line);) {
+        all.push_back(line);
+    }
+    for (size_t i = all.size() > lines ? all.size() - lines : 0; i < all.size(); ++i) {
+        std::cerr << "  | " << all[i] << "\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions opt;
+    if (!parseArgs(argc, argv, opt)) {
+        return 1;
+    }
+    if (opt.pipeline.empty()) {
+        opt.pipeline = (fs::absolute(argv[0]).parent_path() / "realtime_video_pipeline.exe").string();
+    }
+    if (!fs::exists(opt.pipeline)) {
+        std::cerr << "[ERROR] Pipeline executable not found: " << opt.pipeline << "\n";
+        return 1;
+    }
+
+    const fs::path workDir = fs::temp_directory_path() /
+                             ("v2k_pipeline_bench_" + std::to_string(::getpid()));
+    fs::create_directories(workDir);
+    const fs::path videoPath = workDir / "synthetic.avi";
+    const fs::path configPath = workDir / "config.ini";
+
+    // The video outlasts the run, so every source is still live when the
+    // metrics are scraped.
+    const double videoSec = opt.durationSec + 10.0;
+    std::cerr << "[INFO] Writing " << videoSec << "s synthetic video " << opt.width << "x"
+              << opt.height << "@" << opt.fps << " to " << videoPath.string() << "\n";
+    if (!writeSyntheticVideo(opt, videoPath, videoSec)) {
+        std::cerr << "[ERROR] Could not write " << videoPath.string()
+                  << " (OpenCV built without an MJPG writer?)\n";
+        return 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    MockOpenAIServer server(opt.mock);
+    std::string error;
+    if (!server.start(error)) {
+        std::cerr << "[ERROR] Mock server: " << error << "\n";
+        return 1;
+    }
+
+    std::ofstream(configPath)
+        << "[openai]\n"
+        << "base_url = http://127.0.0.1:" << server.port() << "/v1/\n"
+        << "api_key = mock\n"
+        << "vmodel_name = mock\n";
+
+    const int metricsPort = pickFreePort();
+    std::vector<std::string> args = {
+        opt.pipeline, videoPath.string(), configPath.string(),
+        "--no-gui",
+        "--interval", std::to_string(opt.intervalSec),
+        "--inflight", std::to_string(opt.inflight),
+        "--metrics-port", std::to_string(metricsPort),
+    };
+    for (int i = 1; i < opt.streams; ++i) {
+        args.insert(args.end(), {"--source", videoPath.string()});
+    }
+    if (opt.stream) {
+        args.push_back("--stream");
+    }
+    args.insert(args.end(), opt.extraArgs.begin(), opt.extraArgs.end());
+
+    const fs::path stdoutPath = workDir / "pipeline.stdout";
+    const fs::path stderrPath = workDir / "pipeline.stderr";
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = spawn(args, stdoutPath, stderrPath);
+    if (pid < 0) {
+        std::cerr << "[ERROR] fork failed\n";
+        return 1;
+    }
+
+    // Run for the requested duration, watching for an early exit.
+    bool exitedEarly = false;
+    int status = 0;
+    rusage usage{};
+    while (std::chrono::steady_clock::now() - start <
+           std::chrono::duration<double>(opt.durationSec)) {
+        if (::wait4(pid, &status, WNOHANG, &usage) == pid) {
+            exitedEarly = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    std::map<std::string, double> m;
+    const bool scraped = !exitedEarly && scrapeMetrics(metricsPort, m);
+    const double elapsedSec =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The pipeline cancels its requests in flight on SIGTERM; how long that
+    // takes is what a rolling restart waits for.
+    double shutdownSec = 0.0;
+    if (!exitedEarly) {
+        const auto termAt = std::chrono::steady_clock::now();
+        ::kill(pid, SIGTERM);
+        ::wait4(pid, &status, 0, &usage);
+        shutdownSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - termAt).count();
+    }
+    server.stop();
+    curl_global_cleanup();
+
+    if (exitedEarly || !scraped) {
+        std::cerr << "[ERROR] "
+                  << (exitedEarly ? "Pipeline exited before the run finished"
+                                  : "Could not scrape the pipeline's metrics endpoint")
+                  << "; last lines of " << stderrPath.string() << ":\n";
+        printTail(stderrPath, 15);
+        return 1;
+    }
+
+    const double cpuSec = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+                          usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#ifdef __APPLE__
+    const double rssMiB = usage.ru_maxrss / (1024.0 * 1024.0);   // bytes
+#else
+    const double rssMiB = usage.ru_maxrss / 1024.0;              // KiB
+#endif
+
+    const double triggers = metricOr(m, "v2k_triggers_total");
+    const double requests = metricOr(m, "v2k_requests_total");
+    const double failed = metricOr(m, "v2k_requests_failed_total");
+
+    std::cout << "pipeline_bench: " << opt.streams << " stream(s) " << opt.width << "x"
+              << opt.height << "@" << opt.fps << ", interval " << opt.intervalSec
+              << "s, inflight " << opt.inflight << (opt.stream ? ", streamed" : "") << "\n";
+    std::cout << std::fixed << std::setprecision(2);
+    auto row = [](const char* name) -> std::ostream& {
+        return std::cout << "  " << std::left << std::setw(30) << name << std::right;
+    };
+    row("duration") << elapsedSec << " s\n";
+    row("triggers/s") << triggers / elapsedSec << "\n";
+    row("requests/s") << requests / elapsedSec << "\n";
+    row("requests failed") << static_cast<uint64_t>(failed) << "\n";
+    row("jobs overwritten") << static_cast<uint64_t>(metricOr(m, "v2k_jobs_overwritten_total")) << "\n";
+    row("jobs expired") << static_cast<uint64_t>(metricOr(m, "v2k_jobs_expired_total")) << "\n";
+    row("jobs blocked") << static_cast<uint64_t>(metricOr(m, "v2k_jobs_blocked_total")) << "\n";
+    row("jobs skipped") << static_cast<uint64_t>(metricOr(m, "v2k_jobs_skipped_total")) << "\n";
+    row("jobs stale") << static_cast<uint64_t>(metricOr(m, "v2k_jobs_stale_total")) << "\n";
+    row("end-to-end p50/p95/p99") << stageQuantiles(m, "end_to_end") << "\n";
+    row("frame age p50/p95/p99") << stageQuantiles(m, "frame_age") << "\n";
+    row("queue wait p50/p95/p99") << stageQuantiles(m, "queue_wait") << "\n";
+    row("http p50/p95/p99") << stageQuantiles(m, "http") << "\n";
+    row("retrieve p50/p95/p99") << stageQuantiles(m, "retrieve") << "\n";
+    row("jpeg encode p50/p95/p99") << stageQuantiles(m, "jpeg_encode") << "\n";
+    row("CPU (all streams)") << 100.0 * cpuSec / elapsedSec << " % of a core\n";
+    row("CPU per stream") << 100.0 * cpuSec / elapsedSec / opt.streams << " % of a core\n";
+    row("max RSS") << rssMiB << " MiB\n";
+    row("shutdown after SIGTERM") << shutdownSec * 1e3 << " ms\n";
+    row("mock requests / batches") << server.requests() << " / " << server.batches() << "\n";
+
+    if (!opt.keepFiles) {
+        std::error_code ec;
+        fs::remove_all(workDir, ec);
+    } else {
+        std::cerr << "[INFO] Files kept in " << workDir.string() << "\n";
+    }
+
+    return requests > 0 && failed == 0 ? 0 : 1;
+}
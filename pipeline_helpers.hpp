@@ -0,0 +1,420 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Stateless helpers on the per-request path of realtime_video_pipeline:
+// frame resizing and JPEG encoding, request body construction, response
+// parsing and timestamp handling.
+//
+// They live here rather than in the pipeline so that micro_bench measures
+// exactly the code the pipeline runs.
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// String helpers
+//------------------------------------------------------------------------------
+
+// Parse a double and require that the whole string is consumed.
+inline bool parseDoubleStrict(const std::string& s, double& out)
+{
+    try {
+        size_t idx = 0;
+        out = std::stod(s, &idx);
+        return idx == s.size();
+    } catch (...) {
+        return false;
+    }
+}
+
+// Parse an int and require that the whole string is consumed.
+inline bool parseIntStrict(const std::string& s, int& out)
+{
+    try {
+        size_t idx = 0;
+        out = std::stoi(s, &idx);
+        return idx == s.size();
+    } catch (...) {
+        return false;
+    }
+}
+
+// Trim leading and trailing whitespace in place.
+// Returns false if the resulting string is empty.
+inline bool trimInPlace(std::string& s)
+{
+    const auto start = s.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        s.clear();
+        return false;
+    }
+
+    const auto end = s.find_last_not_of(" \t\r\n");
+    s = s.substr(start, end - start + 1);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// API response parsing
+//------------------------------------------------------------------------------
+
+// Extract human-readable text from an API response.
+//
+// We support a few plausible shapes because deployments using "OpenAI-like"
+// compatibility layers may not always return identical JSON structures.
+inline std::string extractMessageText(const nlohmann::json& response)
+{
+    const auto choicesIt = response.find("choices");
+    if (choicesIt != response.end() && choicesIt->is_array() && !choicesIt->empty()) {
+        const auto& first = (*choicesIt)[0];
+
+        // Typical chat-completions shape:
+        // choices[0].message.content
+        const auto messageIt = first.find("message");
+        if (messageIt != first.end()) {
+            const auto contentIt = messageIt->find("content");
+            if (contentIt != messageIt->end()) {
+                if (contentIt->is_string()) {
+                    return contentIt->get<std::string>();
+                }
+                if (contentIt->is_array()) {
+                    std::string combined;
+                    for (const auto& part : *contentIt) {
+                        const auto textIt = part.find("text");
+                        if (textIt != part.end() && textIt->is_string()) {
+                            combined += textIt->get<std::string>();
+                        }
+                    }
+                    if (!combined.empty()) {
+                        return combined;
+                    }
+                }
+            }
+        }
+
+        // Fallback shape sometimes seen in wrappers.
+        const auto textIt = first.find("text");
+        if (textIt != first.end() && textIt->is_string()) {
+            return textIt->get<std::string>();
+        }
+    }
+
+    // Additional defensive fallbacks.
+    const auto outputTextIt = response.find("output_text");
+    if (outputTextIt != response.end() && outputTextIt->is_string()) {
+        return outputTextIt->get<std::string>();
+    }
+
+    const auto outputIt = response.find("output");
+    if (outputIt != response.end() && outputIt->is_array()) {
+        std::string combined;
+        for (const auto& item : *outputIt) {
+            const auto contentIt = item.find("content");
+            if (contentIt == item.end() || !contentIt->is_array()) {
+                continue;
+            }
+            for (const auto& part : *contentIt) {
+                const auto textIt = part.find("text");
+                if (textIt != part.end() && textIt->is_string()) {
+                    combined += textIt->get<std::string>();
+                }
+            }
+        }
+        if (!combined.empty()) {
+            return combined;
+        }
+    }
+
+    return {};
+}
+
+//------------------------------------------------------------------------------
+// Time helpers
+//------------------------------------------------------------------------------
+
+// Thread-safe localtime wrapper.
+//
+// std::localtime() is not thread-safe, so we use platform-specific safe forms.
+inline bool safeLocalTime(std::time_t t, std::tm& out)
+{
+#ifdef _WIN32
+    return localtime_s(&out, &t) == 0;
+#else
+    return localtime_r(&t, &out) != nullptr;
+#endif
+}
+
+// Format a system_clock time point as "[YYYY-mm-dd HH:MM:SS]".
+inline std::string formatDateTime(const std::chrono::system_clock::time_point& tp)
+{
+    const std::time_t t = std::chrono::system_clock::to_time_t(tp);
+    std::tm tm{};
+    if (!safeLocalTime(t, tm)) {
+        return "[invalid-local-time]";
+    }
+
+    std::ostringstream oss;
+    oss << '[' << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << ']';
+    return oss.str();
+}
+
+// Format a system_clock time point as local ISO 8601 with milliseconds and
+// UTC offset, e.g. "2026-03-14T09:26:53.120+01:00".
+inline std::string formatIsoDateTime(const std::chrono::system_clock::time_point& tp)
+{
+    const std::time_t t = std::chrono::system_clock::to_time_t(tp);
+    std::tm tm{};
+    if (!safeLocalTime(t, tm)) {
+        return {};
+    }
+
+    const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             tp.time_since_epoch()).count();
+    char date[32];
+    char zone[8];
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+    std::strftime(zone, sizeof(zone), "%z", &tm);
+    std::string offset(zone);
+    if (offset.size() == 5) {
+        offset.insert(3, ":");   // +0100 -> +01:00
+    }
+
+    char out[64];
+    std::snprintf(out, sizeof(out), "%s.%03d%s", date, static_cast<int>(((ms % 1000) + 1000) % 1000),
+                  offset.c_str());
+    return out;
+}
+
+// Parse a local datetime string of the form "YYYY-mm-dd HH:MM:SS".
+inline bool parseDateTime(const std::string& s, std::chrono::system_clock::time_point& out)
+{
+    std::tm tm{};
+    std::istringstream iss(s);
+    iss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+    if (iss.fail()) {
+        return false;
+    }
+
+    const std::time_t tt = std::mktime(&tm);
+    if (tt == static_cast<std::time_t>(-1)) {
+        return false;
+    }
+
+    out = std::chrono::system_clock::from_time_t(tt);
+    return true;
+}
+
+// Thread-safe inverse of gmtime: broken-down UTC time to time_t.
+inline std::time_t utcTimeToTimeT(std::tm& tm)
+{
+#ifdef _WIN32
+    return _mkgmtime(&tm);
+#else
+    return timegm(&tm);
+#endif
+}
+
+// Parse a metadata datetime: "YYYY-mm-dd HH:MM:SS" or "YYYY-mm-ddTHH:MM:SS",
+// optionally followed by fractional seconds and a zone ("Z", "+hh:mm", "+hhmm",
+// "+hh"). With a zone the value is converted from that offset to UTC, as media
+// containers store it; without one it is read as local time.
+inline bool parseMetadataDateTime(
+    std::string value,
+    std::chrono::system_clock::time_point& out)
+{
+    if (!trimInPlace(value) || value.size() < 19) {
+        return false;
+    }
+    if (value[10] == 'T' || value[10] == 't') {
+        value[10] = ' ';
+    }
+
+    std::tm tm{};
+    std::istringstream iss(value.substr(0, 19));
+    iss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+    if (iss.fail()) {
+        return false;
+    }
+
+    size_t pos = 19;
+    long long fracMicros = 0;
+    if (pos < value.size() && (value[pos] == '.' || value[pos] == ',')) {
+        ++pos;
+        long long scale = 100000;
+        const size_t digitsStart = pos;
+        while (pos < value.size() && std::isdigit(static_cast<unsigned char>(value[pos]))) {
+            fracMicros += (value[pos] - '0') * scale;
+            scale /= 10;
+            ++pos;
+        }
+        if (pos == digitsStart) {
+            return false;
+        }
+    }
+    while (pos < value.size() && value[pos] == ' ') {
+        ++pos;
+    }
+
+    bool hasZone = false;
+    int offsetMinutes = 0;
+    if (pos < value.size()) {
+        const std::string zone = value.substr(pos);
+        if (zone == "Z" || zone == "z" || zone == "UTC") {
+            hasZone = true;
+        } else if (zone[0] == '+' || zone[0] == '-') {
+            std::string digits;
+            for (size_t i = 1; i < zone.size(); ++i) {
+                if (std::isdigit(static_cast<unsigned char>(zone[i]))) {
+                    digits += zone[i];
+                } else if (zone[i] != ':' || i != 3) {
+                    return false;
+                }
+            }
+            if (digits.size() != 2 && digits.size() != 4) {
+                return false;
+            }
+            const int hh = std::stoi(digits.substr(0, 2));
+            const int mm = digits.size() == 4 ? std::stoi(digits.substr(2, 2)) : 0;
+            if (hh > 23 || mm > 59) {
+                return false;
+            }
+            offsetMinutes = (zone[0] == '-' ? -1 : 1) * (hh * 60 + mm);
+            hasZone = true;
+        } else {
+            return false;
+        }
+    }
+
+    std::time_t tt;
+    if (hasZone) {
+        tt = utcTimeToTimeT(tm);
+        if (tt == static_cast<std::time_t>(-1)) {
+            return false;
+        }
+        tt -= static_cast<std::time_t>(offsetMinutes) * 60;
+    } else {
+        tm.tm_isdst = -1;
+        tt = std::mktime(&tm);
+        if (tt == static_cast<std::time_t>(-1)) {
+            return false;
+        }
+    }
+
+    out = std::chrono::system_clock::from_time_t(tt) +
+          std::chrono::duration_cast<std::chrono::system_clock::duration>(
+              std::chrono::microseconds(fracMicros));
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Frame/image helpers
+//------------------------------------------------------------------------------
+
+// Resize a frame so that max(width, height) <= maxDim, preserving aspect ratio.
+// If maxDim <= 0, resizing is disabled. With sideMultiple > 1 both sides are
+// then rounded down to a multiple of it, for vision encoders that work on a
+// fixed patch grid and would otherwise resample the image again.
+inline cv::Mat resizeMaxDim(const cv::Mat& frame, int maxDim, int interpolation = cv::INTER_AREA,
+                            int sideMultiple = 1)
+{
+    if (frame.empty()) {
+        return frame;
+    }
+
+    const int w = frame.cols;
+    const int h = frame.rows;
+    const int m = (w > h) ? w : h;
+    int nw = w;
+    int nh = h;
+    if (maxDim > 0 && m > maxDim) {
+        const double scale = static_cast<double>(maxDim) / static_cast<double>(m);
+        nw = std::max(1, static_cast<int>(std::lround(w * scale)));
+        nh = std::max(1, static_cast<int>(std::lround(h * scale)));
+    }
+    if (sideMultiple > 1) {
+        nw = std::max(sideMultiple, nw / sideMultiple * sideMultiple);
+        nh = std::max(sideMultiple, nh / sideMultiple * sideMultiple);
+    }
+    if (nw == w && nh == h) {
+        return frame;
+    }
+
+    cv::Mat resized;
+    cv::resize(frame, resized, cv::Size(nw, nh), 0, 0, interpolation);
+    return resized;
+}
+
+// JPEG-encode a frame. Quality outside 1..100 keeps the OpenCV default (95).
+inline bool encodeJpeg(const cv::Mat& frame, int jpegQuality, std::vector<uchar>& buffer)
+{
+    std::vector<int> params;
+    if (jpegQuality > 0 && jpegQuality <= 100) {
+        params = {cv::IMWRITE_JPEG_QUALITY, jpegQuality};
+    }
+    return cv::imencode(".jpg", frame, buffer, params);
+}
+
+//------------------------------------------------------------------------------
+// Request construction
+//------------------------------------------------------------------------------
+
+// Chat-completions body with one user message holding the prompt text and the
+// images, in order. All strings are moved into the document, so the (large)
+// data URLs are never copied.
+inline nlohmann::json buildChatRequestBody(
+    const std::string& model,
+    std::string promptText,
+    std::vector<std::string> dataUrls,
+    bool stream)
+{
+    using json = nlohmann::json;
+    json content = json::array({
+        {{"type", "text"}, {"text", std::move(promptText)}},
+    });
+    for (std::string& dataUrl : dataUrls) {
+        content.push_back({{"type", "image_url"}, {"image_url", {{"url", std::move(dataUrl)}}}});
+    }
+    return {
+        {"model", model},
+        {"messages", json::array({
+            {
+                {"role", "user"},
+                {"content", std::move(content)}
+            }
+        })},
+        {"stream", stream}
+    };
+}
+
+// Single-image form of the above.
+inline nlohmann::json buildChatRequestBody(
+    const std::string& model,
+    std::string promptText,
+    std::string dataUrl,
+    bool stream)
+{
+    std::vector<std::string> dataUrls;
+    dataUrls.push_back(std::move(dataUrl));
+    return buildChatRequestBody(model, std::move(promptText), std::move(dataUrls), stream);
+}
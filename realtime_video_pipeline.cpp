@@ -11,27 +11,48 @@
 // https://spazioit.com
 //
 #include <opencv2/opencv.hpp>
-#include <openai.hpp>
 #include <nlohmann/json.hpp>
+#include <curl/curl.h>
+#include <zlib.h>
+
+#include "async_writer.hpp"
+#include "base64.hpp"
+#include "knowledge_store.hpp"
+#include "media_probe.hpp"
+#include "metrics.hpp"
+#include "pipeline_helpers.hpp"
+#include "segment_merger.hpp"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <chrono>
 #include <cmath>
 #include <condition_variable>
 #include <cctype>
+#include <csignal>
 #include <cstdint>
 #include <ctime>
 #include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
@@ -46,11 +67,37 @@ struct OpenAIConfig {
     std::string baseUrl;
     std::string apiKey;
     std::string vmodelName;
+    bool tlsVerify = true;   // openai.tls_verify; false accepts any certificate
+};
+
+// A video source: camera index, stream URI or media file path.
+struct SourceSpec {
+    std::string label;  // short name used in logs (INI key or "src<N>")
+    std::string uri;
+};
+
+// What happens to a source's pending jobs when triggers outpace the workers
+// (--queue-policy).
+enum class QueuePolicy {
+    Latest,       // one slot: a new job replaces the pending one
+    DropOldest,   // up to queueDepth jobs; when full the oldest is dropped
+    Block,        // up to queueDepth jobs; when full the source's due triggers are
+                  // held (up to queueDepth more) until there is room
+    Deadline,     // like DropOldest, and jobs pending longer than queueDeadlineSec are dropped
+};
+
+// Which frames offline files are sampled at (--keyframes).
+enum class KeyframeSampling {
+    Off,    // the frame at every --interval of media time
+    Near,   // the keyframe nearest to each --interval sample time
+    All,    // every keyframe
 };
 
 // Command-line options with defaults chosen to match the original behavior.
 struct ProgramOptions {
-    std::string src;
+    // Sources given on the command line. More may be appended from the
+    // [sources] section of the INI file.
+    std::vector<SourceSpec> sources;
     std::string configPath = "config.ini";
 
     double intervalSec = 10.0;
@@ -60,26 +107,161 @@ struct ProgramOptions {
     bool guiEnabled = true;
     int reconnectSec = 5;
 
+    // Motion gating: between heartbeats (--interval), fire early only when
+    // the scene changed, and never more often than motionMinIntervalSec.
+    bool motionGate = false;
+    double motionThreshold = 0.02;   // fraction of changed thumbnail pixels
+    int motionPixelDelta = 25;       // per-pixel intensity change that counts
+    double motionMinIntervalSec = 1.0;
+
+    // Response cache: reuse the answer for a near-identical frame of the same
+    // source (dHash Hamming distance <= cacheMaxDistance) for cacheTtlSec.
+    double cacheTtlSec = 0.0;   // 0 = disabled
+    int cacheMaxDistance = 4;
+
+    // Multi-frame requests: send clipFrames images per request, oldest first.
+    // With clipStrideSec 0 they are consecutive samples, so there is one
+    // request per clipFrames triggers; otherwise every trigger sends its frame
+    // with the frames clipStrideSec, 2 * clipStrideSec, ... before it.
+    int clipFrames = 1;
+    double clipStrideSec = 0.0;
+
+    // Adapt the trigger interval of live sources to what the model sustains,
+    // between adaptiveMinSec and adaptiveMaxSec, starting from intervalSec.
+    bool adaptiveInterval = false;
+    double adaptiveMinSec = 0.5;
+    double adaptiveMaxSec = 60.0;
+
+    // Payload control: fit each image into a byte budget and/or keep the
+    // model round trip within a latency budget by lowering JPEG quality and
+    // resolution per source. modelInputDim caps the resize at the vision
+    // encoder's native resolution; dimMultiple snaps sides to its patch grid.
+    double payloadBudgetKiB = 0.0;   // 0 = no byte budget
+    double latencyBudgetSec = 0.0;   // 0 = no latency budget
+    int modelInputDim = 0;           // 0 = only maxDim applies
+    int dimMultiple = 1;
+    int minDim = 256;
+    int minJpegQuality = 40;
+
+    // Pending jobs per source and what is dropped when triggers outpace the
+    // workers. Offline file sampling always waits for room instead.
+    QueuePolicy queuePolicy = QueuePolicy::Latest;
+    int queueDepth = 8;                // ignored by the latest policy
+    double queueDeadlineSec = 0.0;     // deadline policy; 0 = twice --interval
+
+    // Frames older than this when a worker takes their job are replaced by
+    // the source's latest frame if that one is young enough (or with
+    // refreshStaleFrames off, always dropped). 0 = no limit. Live sources only.
+    double maxFrameAgeSec = 0.0;
+    bool refreshStaleFrames = true;
+
+    // Also abort a request in flight once its frame exceeds maxFrameAgeSec
+    // and a newer job of the same source is waiting.
+    bool cancelStale = false;
+
+    // On quit (q/Esc, SIGINT/SIGTERM, a live stream giving up), requests in
+    // flight are cancelled; if threads still have not stopped after this
+    // long, the process exits anyway. 0 = wait indefinitely.
+    double shutdownTimeoutSec = 10.0;
+
+    // Number of inference workers shared by all sources. This is also the
+    // global cap on requests in flight against the model server.
+    int inflight = 1;
+
+    // Hold result lines back so they are printed in dispatch order even when
+    // a later request finishes first.
+    bool orderedOutput = false;
+
+    // Stream responses (SSE) and print sentences as they arrive.
+    bool stream = false;
+
+    // Analyze media files as fast as inference allows: sample every
+    // intervalSec of media time by seeking/grabbing, with no real-time pacing
+    // and no dropped samples. Live sources are unaffected.
+    bool offline = false;
+
+    // Split each offline file into up to this many time segments, each read
+    // by its own decoder; results are merged back into media order.
+    int segments = 1;
+
+    // Sample offline files at keyframes only, which decode without their
+    // predecessors, at the keyframe's exact time.
+    KeyframeSampling keyframes = KeyframeSampling::Off;
+
+    // Batch ingestion: analyze every recording in a directory (recursively)
+    // or listed in a manifest file, batchDecoders files at a time, offline.
+    // Results of each file also go to <batchOutputDir>/<file>.jsonl, and
+    // files recorded in the checkpoint are skipped on the next run.
+    std::string batchInput;
+    int batchDecoders = 0;           // 0 = up to 4, bounded by the CPU count
+    std::string batchOutputDir;
+    std::string checkpointPath;      // default <batchOutputDir>/checkpoint.txt
+
+    // Capture threads only grab() frames to keep the stream drained, and
+    // decode (retrieve()) one when a trigger is due or a consumer polls.
+    bool decodeOnDemand = false;
+
+    // Metrics: Prometheus endpoint (port 0 = disabled) and periodic stats
+    // on stderr (0 = disabled).
+    int metricsPort = 0;
+    std::string metricsBind = "127.0.0.1";
+    double statsIntervalSec = 0.0;
+
+    // Structured results: one JSON object per line, written by a background
+    // thread ("-" = stdout instead of the text lines). Rotation by size
+    // and/or age; 0 = never.
+    std::string jsonlPath;
+    double jsonlRotateMb = 0.0;
+    double jsonlRotateSec = 0.0;
+
+    // Knowledge store directory (empty = disabled): every result is also
+    // appended there, indexed by source, time and keywords.
+    std::string storeDir;
+
+    // HTTP transport to the model server.
+    double connectTimeoutSec = 5.0;
+    double requestTimeoutSec = 0.0;   // 0 = no limit
+    bool gzipRequest = false;
+    bool insecure = false;            // skip TLS certificate verification
+
     // Optional explicit base datetime for media files.
     // If absent, we try media metadata creation_time, then application start.
     bool hasPredefinedStartTime = false;
     std::chrono::system_clock::time_point predefinedStartTime{};
 };
 
-// Single-slot job exchanged between the main thread and the inference worker.
+// A decoded frame shared between the capture thread and its consumers.
+//
+// Frames are immutable once published. Consumers (scheduler, workers, GUI)
+// hold FrameRefs instead of copying pixels, and must not keep cv::Mat headers
+// of `image` beyond the lifetime of their FrameRef: the capture thread reuses
+// the buffer as soon as the last FrameRef is gone (see FramePool).
+struct Frame {
+    cv::Mat image;
+    double mediaPosSec = 0.0;   // position in the media timeline, if known
+    uint64_t seq = 0;           // per-source publication counter, from 1; offline
+                                // segment s counts on from s << 40
+    std::chrono::steady_clock::time_point capturedAt{};   // when grab() returned
+};
+using FrameRef = std::shared_ptr<const Frame>;
+
+// Job exchanged between the main thread and the inference workers.
 //
 // Design choice:
-// - We keep only one pending job.
-// - Newer frames overwrite older pending work.
+// - By default we keep only one pending job per source.
+// - Newer frames overwrite older pending work from the same source.
 // - This keeps the pipeline responsive for live streams and prevents latency
 //   from growing without bound under slow inference.
+// Other queue policies trade that for completeness (see QueuePolicy).
 struct PendingJob {
-    cv::Mat frame;
+    FrameRef frame;
+    size_t sourceIdx = 0;       // index into the source table
+    uint64_t dispatchSeq = 0;   // assigned by the scheduler when handed out
     double wallTimeSec = 0.0;   // elapsed program time when the trigger fired
     double mediaPosSec = 0.0;   // position in the media timeline, if known
     int triggerIdx = 0;
-    bool has = false;
-    bool stop = false;
+    size_t segment = 0;         // --segments: part of the file the sample is from
+    std::vector<FrameRef> context;   // --clip-frames: frames sent before `frame`, oldest first
 };
 
 //------------------------------------------------------------------------------
@@ -89,51 +271,146 @@ struct PendingJob {
 // Simple RAII joiner to ensure threads are joined on all exit paths.
 class ThreadJoiner {
 public:
-    explicit ThreadJoiner(std::thread& t) noexcept : thread_(t) {}
+    explicit ThreadJoiner(std::vector<std::thread>& threads) noexcept
+        : threads_(threads) {}
     ThreadJoiner(const ThreadJoiner&) = delete;
     ThreadJoiner& operator=(const ThreadJoiner&) = delete;
 
     ~ThreadJoiner() {
-        if (thread_.joinable()) {
-            thread_.join();
+        join();
+    }
+
+    void join() {
+        for (auto& t : threads_) {
+            if (t.joinable()) {
+                t.join();
+            }
         }
     }
 
 private:
-    std::thread& thread_;
+    std::vector<std::thread>& threads_;
 };
 
+// Cleared to stop the pipeline: by the main loop on quit or when every source
+// has ended, or asynchronously by SIGINT/SIGTERM.
+static std::atomic<bool> g_running{true};
+static_assert(std::atomic<bool>::is_always_lock_free, "g_running is set from a signal handler");
+
+// Signal that requested the shutdown, 0 if none.
+static volatile std::sig_atomic_t g_stopSignal = 0;
+
+// SIGINT/SIGTERM stop the pipeline like the 'q' key. A second signal exits
+// at once, for when the clean shutdown itself is stuck.
+static void handleStopSignal(int sig)
+{
+    if (g_stopSignal != 0) {
+        std::_Exit(128 + sig);
+    }
+    g_stopSignal = sig;
+    g_running.store(false);
+}
+
+// Name of a queue policy as given to --queue-policy.
+static const char* queuePolicyName(QueuePolicy policy)
+{
+    switch (policy) {
+    case QueuePolicy::Latest: return "latest";
+    case QueuePolicy::DropOldest: return "drop-oldest";
+    case QueuePolicy::Block: return "block";
+    case QueuePolicy::Deadline: return "deadline";
+    }
+    return "?";
+}
+
 // Print CLI help.
 static void printUsage(const char* argv0)
 {
     std::cerr
         << "Usage: " << argv0 << " <video_or_stream_uri> [config.ini] [options]\n"
+        << "       " << argv0 << " --config <config.ini> [options]\n"
         << "Options:\n"
+        << "  --source <uri>          Add a source (repeatable; see also [sources] in the INI)\n"
+        << "  --config <path>         INI config path (default config.ini)\n"
+        << "  --inflight <n>          Inference requests in flight across all sources (default 1)\n"
+        << "  --queue-policy <p>      Pending jobs per source when inference falls behind:\n"
+        << "                          latest (default; newest job wins), drop-oldest, block\n"
+        << "                          (due triggers are held until the source's queue has room)\n"
+        << "                          or deadline\n"
+        << "  --queue-depth <n>       Pending jobs per source for the other policies (default 8)\n"
+        << "  --queue-deadline <sec>  Drop jobs pending longer than this (deadline policy;\n"
+        << "                          default 2 x --interval)\n"
+        << "  --max-frame-age <sec>   Do not send frames older than this (live sources)\n"
+        << "  --stale-frames <mode>   What to do with them: refresh (default; use the source's\n"
+        << "                          latest frame if young enough, else drop) or drop\n"
+        << "  --cancel-stale          Abort a request once its frame exceeds --max-frame-age and a\n"
+        << "                          newer job of the same source is waiting\n"
+        << "  --shutdown-timeout <sec>\n"
+        << "                          Exit anyway if shutdown takes longer (default 10; 0 = wait)\n"
+        << "  --ordered               Print results in dispatch order (default: as they finish)\n"
+        << "  --stream                Stream responses and print each sentence as it arrives\n"
+        << "  --offline               Analyze files as fast as inference allows (no 1x pacing,\n"
+        << "                          every --interval of media time is sampled)\n"
+        << "  --segments <n>          Decode each offline file as up to <n> time segments in\n"
+        << "                          parallel, printing results in media order (default 1)\n"
+        << "  --keyframes <mode>      Offline: sample only keyframes, 'near' each --interval or\n"
+        << "                          'all' of them (default off; MP4/MKV files only)\n"
+        << "  --batch <dir|list>      Analyze every recording in <dir> (recursively) or listed in\n"
+        << "                          the text file <list>, offline, instead of --source\n"
+        << "  --batch-decoders <n>    Files decoded in parallel in batch mode (default: CPU\n"
+        << "                          count, at most 4)\n"
+        << "  --batch-output <dir>    Also write each file's results to <dir>/<file>.jsonl\n"
+        << "  --checkpoint <path>     Record finished files and skip them when the batch is\n"
+        << "                          restarted (default <batch-output>/checkpoint.txt)\n"
+        << "  --decode-on-demand      Grab every frame but decode only the ones that are used\n"
+        << "  --connect-timeout <sec> Timeout for opening a connection to the model server (default 5)\n"
+        << "  --request-timeout <sec> Timeout for a whole request (default 0 = none)\n"
+        << "  --gzip-request          Compress request bodies (the server must accept gzip)\n"
+        << "  --insecure              Do not verify the model server's TLS certificate\n"
+        << "  --metrics-port <port>   Serve Prometheus metrics on http://<bind>:<port>/metrics\n"
+        << "  --metrics-bind <addr>   Address for the metrics endpoint (default 127.0.0.1)\n"
+        << "  --stats-interval <sec>  Print per-stage latency stats to stderr every <sec> seconds\n"
+        << "  --jsonl <path>          Also write results as JSON lines to <path> (\"-\" = stdout,\n"
+        << "                          replacing the text lines)\n"
+        << "  --jsonl-rotate-mb <n>   Rotate the JSONL file before it exceeds <n> MB (default 0 = never)\n"
+        << "  --jsonl-rotate-sec <sec>\n"
+        << "                          Rotate the JSONL file every <sec> seconds (default 0 = never)\n"
+        << "  --store <dir>           Append results to a knowledge store (see knowledge_query)\n"
         << "  --interval <sec>        Prompt repetition interval in seconds (default 10)\n"
+        << "  --adaptive-interval     Adjust the interval of live sources to the measured inference\n"
+        << "                          latency, keeping the model just saturated (starts at --interval)\n"
+        << "  --adaptive-min <sec>    Lower bound of the adaptive interval (default 0.5)\n"
+        << "  --adaptive-max <sec>    Upper bound of the adaptive interval (default 60)\n"
         << "  --max-dim <px>          Resize frames so max(width,height)<=px (default 1024)\n"
         << "  --jpeg-quality <1-100>  JPEG quality (default 85)\n"
+        << "  --payload-budget <KiB>  Lower JPEG quality, then resolution, to keep each image\n"
+        << "                          within <KiB> (learnt per source from previous frames)\n"
+        << "  --latency-budget <sec>  Shrink images while requests take longer than <sec>\n"
+        << "  --min-dim <px>          Smallest max(width,height) the budgets may resize to (default 256)\n"
+        << "  --min-jpeg-quality <1-100>\n"
+        << "                          Lowest JPEG quality the budgets may use (default 40)\n"
+        << "  --model-input-dim <px>  Never send more than the model's native vision resolution\n"
+        << "                          (e.g. 896 for Gemma 3)\n"
+        << "  --dim-multiple <px>     Round image sides down to a multiple of <px> (e.g. 28 for\n"
+        << "                          Qwen2-VL)\n"
         << "  --prompt <text>         Prompt prefix (default: \"Analyze this frame.\")\n"
         << "  --no-gui                Disable OpenCV imshow/waitKey\n"
         << "  --reconnect-sec <sec>   Reconnect window for live streams (default 5)\n"
+        << "  --motion-gate           Trigger early on scene change; --interval becomes the heartbeat\n"
+        << "  --motion-threshold <f>  Fraction of changed pixels that counts as motion (default 0.02)\n"
+        << "  --motion-pixel-delta <n>\n"
+        << "                          Per-pixel intensity change that counts (default 25)\n"
+        << "  --motion-min-interval <sec>\n"
+        << "                          Minimum spacing between triggers (default 1)\n"
+        << "  --cache-ttl <sec>       Reuse responses for near-identical frames (default 0 = off)\n"
+        << "  --cache-distance <bits> Max dHash Hamming distance for a cache hit (default 4)\n"
+        << "  --clip-frames <k>       Send <k> frames per request, oldest first (default 1)\n"
+        << "  --clip-stride <sec>     Take a trigger's earlier frames <sec> apart instead of\n"
+        << "                          sending <k> consecutive samples (default 0)\n"
         << "  --predefined_start_time \"YYYY-mm-dd HH:MM:SS\"\n"
         << "                          Override base datetime for media files\n";
 }
 
-// Trim leading and trailing whitespace in place.
-// Returns false if the resulting string is empty.
-static bool trimInPlace(std::string& s)
-{
-    const auto start = s.find_first_not_of(" \t\r\n");
-    if (start == std::string::npos) {
-        s.clear();
-        return false;
-    }
-
-    const auto end = s.find_last_not_of(" \t\r\n");
-    s = s.substr(start, end - start + 1);
-    return true;
-}
-
 //------------------------------------------------------------------------------
 // INI/config parsing
 //------------------------------------------------------------------------------
@@ -219,10 +496,11 @@ static std::string ensureTrailingSlash(const std::string& url)
 }
 
 // Load and validate the required OpenAI config values.
-static bool loadOpenAIConfig(const std::string& path, OpenAIConfig& cfg)
+static bool loadOpenAIConfig(
+    const std::map<std::string, std::string>& config,
+    const std::string& path,
+    OpenAIConfig& cfg)
 {
-    const auto config = parseIni(path);
-
     auto getValue = [&](const std::string& key, std::string& out) {
         const auto it = config.find(key);
         if (it != config.end()) {
@@ -234,6 +512,16 @@ static bool loadOpenAIConfig(const std::string& path, OpenAIConfig& cfg)
     getValue("openai.api_key", cfg.apiKey);
     getValue("openai.vmodel_name", cfg.vmodelName);
 
+    std::string tlsVerify;
+    getValue("openai.tls_verify", tlsVerify);
+    if (tlsVerify == "false" || tlsVerify == "0" || tlsVerify == "no" || tlsVerify == "off") {
+        cfg.tlsVerify = false;
+    } else if (!tlsVerify.empty() && tlsVerify != "true" && tlsVerify != "1" &&
+               tlsVerify != "yes" && tlsVerify != "on") {
+        std::cerr << "[ERROR] openai.tls_verify in " << path << " must be true or false\n";
+        return false;
+    }
+
     std::vector<std::string> missing;
     if (cfg.baseUrl.empty()) {
         missing.push_back("openai.base_url");
@@ -258,208 +546,28 @@ static bool loadOpenAIConfig(const std::string& path, OpenAIConfig& cfg)
     return true;
 }
 
-//------------------------------------------------------------------------------
-// Encoding and API response parsing
-//------------------------------------------------------------------------------
-
-// Base64-encode a binary buffer.
-//
-// Used to embed a JPEG frame as a data URL in the API request body.
-static std::string base64Encode(const std::vector<uchar>& data)
-{
-    static const char table[] =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    std::string encoded;
-    encoded.reserve(((data.size() + 2) / 3) * 4);
-
-    size_t i = 0;
-    while (i + 2 < data.size()) {
-        const uint32_t triple =
-            (static_cast<uint32_t>(data[i]) << 16) |
-            (static_cast<uint32_t>(data[i + 1]) << 8) |
-            static_cast<uint32_t>(data[i + 2]);
-
-        encoded.push_back(table[(triple >> 18) & 0x3F]);
-        encoded.push_back(table[(triple >> 12) & 0x3F]);
-        encoded.push_back(table[(triple >> 6) & 0x3F]);
-        encoded.push_back(table[triple & 0x3F]);
-        i += 3;
-    }
-
-    const size_t rem = data.size() - i;
-    if (rem == 1) {
-        const uint32_t triple = (static_cast<uint32_t>(data[i]) << 16);
-        encoded.push_back(table[(triple >> 18) & 0x3F]);
-        encoded.push_back(table[(triple >> 12) & 0x3F]);
-        encoded.push_back('=');
-        encoded.push_back('=');
-    } else if (rem == 2) {
-        const uint32_t triple =
-            (static_cast<uint32_t>(data[i]) << 16) |
-            (static_cast<uint32_t>(data[i + 1]) << 8);
-        encoded.push_back(table[(triple >> 18) & 0x3F]);
-        encoded.push_back(table[(triple >> 12) & 0x3F]);
-        encoded.push_back(table[(triple >> 6) & 0x3F]);
-        encoded.push_back('=');
-    }
-
-    return encoded;
-}
-
-// Extract human-readable text from an API response.
+// Append sources listed in the [sources] section ("label = uri").
 //
-// We support a few plausible shapes because deployments using "OpenAI-like"
-// compatibility layers may not always return identical JSON structures.
-static std::string extractMessageText(const json& response)
+// Keys become source labels, so the INI can give each camera a meaningful
+// name (e.g. "or3 = rtsp://..."). Sections are flattened by parseIni(), which
+// also means sources are visited in label order.
+static void appendIniSources(
+    const std::map<std::string, std::string>& config,
+    std::vector<SourceSpec>& sources)
 {
-    const auto choicesIt = response.find("choices");
-    if (choicesIt != response.end() && choicesIt->is_array() && !choicesIt->empty()) {
-        const auto& first = (*choicesIt)[0];
-
-        // Typical chat-completions shape:
-        // choices[0].message.content
-        const auto messageIt = first.find("message");
-        if (messageIt != first.end()) {
-            const auto contentIt = messageIt->find("content");
-            if (contentIt != messageIt->end()) {
-                if (contentIt->is_string()) {
-                    return contentIt->get<std::string>();
-                }
-                if (contentIt->is_array()) {
-                    std::string combined;
-                    for (const auto& part : *contentIt) {
-                        const auto textIt = part.find("text");
-                        if (textIt != part.end() && textIt->is_string()) {
-                            combined += textIt->get<std::string>();
-                        }
-                    }
-                    if (!combined.empty()) {
-                        return combined;
-                    }
-                }
-            }
-        }
-
-        // Fallback shape sometimes seen in wrappers.
-        const auto textIt = first.find("text");
-        if (textIt != first.end() && textIt->is_string()) {
-            return textIt->get<std::string>();
-        }
-    }
-
-    // Additional defensive fallbacks.
-    const auto outputTextIt = response.find("output_text");
-    if (outputTextIt != response.end() && outputTextIt->is_string()) {
-        return outputTextIt->get<std::string>();
-    }
-
-    const auto outputIt = response.find("output");
-    if (outputIt != response.end() && outputIt->is_array()) {
-        std::string combined;
-        for (const auto& item : *outputIt) {
-            const auto contentIt = item.find("content");
-            if (contentIt == item.end() || !contentIt->is_array()) {
-                continue;
-            }
-            for (const auto& part : *contentIt) {
-                const auto textIt = part.find("text");
-                if (textIt != part.end() && textIt->is_string()) {
-                    combined += textIt->get<std::string>();
-                }
-            }
-        }
-        if (!combined.empty()) {
-            return combined;
+    static const std::string prefix = "sources.";
+    for (const auto& [key, value] : config) {
+        if (key.rfind(prefix, 0) != 0 || value.empty()) {
+            continue;
         }
+        sources.push_back({key.substr(prefix.size()), value});
     }
-
-    return {};
 }
 
 //------------------------------------------------------------------------------
-// Time helpers
+// Media timestamps
 //------------------------------------------------------------------------------
 
-// Thread-safe localtime wrapper.
-//
-// std::localtime() is not thread-safe, so we use platform-specific safe forms.
-static bool safeLocalTime(std::time_t t, std::tm& out)
-{
-#ifdef _WIN32
-    return localtime_s(&out, &t) == 0;
-#else
-    return localtime_r(&t, &out) != nullptr;
-#endif
-}
-
-// Format a system_clock time point as "[YYYY-mm-dd HH:MM:SS]".
-static std::string formatDateTime(const std::chrono::system_clock::time_point& tp)
-{
-    const std::time_t t = std::chrono::system_clock::to_time_t(tp);
-    std::tm tm{};
-    if (!safeLocalTime(t, tm)) {
-        return "[invalid-local-time]";
-    }
-
-    std::ostringstream oss;
-    oss << '[' << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << ']';
-    return oss.str();
-}
-
-// Parse a local datetime string of the form "YYYY-mm-dd HH:MM:SS".
-static bool parseDateTime(const std::string& s, std::chrono::system_clock::time_point& out)
-{
-    std::tm tm{};
-    std::istringstream iss(s);
-    iss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
-    if (iss.fail()) {
-        return false;
-    }
-
-    const std::time_t tt = std::mktime(&tm);
-    if (tt == static_cast<std::time_t>(-1)) {
-        return false;
-    }
-
-    out = std::chrono::system_clock::from_time_t(tt);
-    return true;
-}
-
-// Normalize metadata datetime variants (T/Z/fractional/tz suffixes) then parse.
-static bool parseMetadataDateTime(
-    std::string value,
-    std::chrono::system_clock::time_point& out)
-{
-    if (!trimInPlace(value)) {
-        return false;
-    }
-
-    std::replace(value.begin(), value.end(), 'T', ' ');
-    if (!value.empty() && (value.back() == 'Z' || value.back() == 'z')) {
-        value.pop_back();
-    }
-
-    const size_t fracPos = value.find('.');
-    if (fracPos != std::string::npos) {
-        value.erase(fracPos);
-    }
-
-    const size_t tzPos = value.find_first_of("+-", 19);
-    if (tzPos != std::string::npos) {
-        value.erase(tzPos);
-    }
-
-    if (!trimInPlace(value)) {
-        return false;
-    }
-    if (value.size() < 19) {
-        return false;
-    }
-
-    value = value.substr(0, 19);
-    return parseDateTime(value, out);
-}
-
 // Probe ffprobe start_time_realtime (microseconds since epoch) for media files.
 static std::optional<std::chrono::system_clock::time_point>
 probeFileEncodedTimelineStart(const std::string& path)
@@ -513,7 +621,7 @@ probeFileEncodedTimelineStart(const std::string& path)
     return std::nullopt;
 }
 
-// Probe ffprobe creation_time tags and parse to local system_clock time.
+// Probe ffprobe creation_time tags; "Z"/offset values are read as UTC.
 static std::optional<std::chrono::system_clock::time_point>
 probeFileEncodedStartTime(const std::string& path)
 {
@@ -573,58 +681,134 @@ static std::chrono::system_clock::time_point addSecondsToTimePoint(
 // Frame/image helpers
 //------------------------------------------------------------------------------
 
-// Resize a frame so that max(width, height) <= maxDim, preserving aspect ratio.
-// If maxDim <= 0, resizing is disabled.
-static cv::Mat resizeMaxDim(const cv::Mat& frame, int maxDim)
-{
-    if (maxDim <= 0 || frame.empty()) {
-        return frame;
+// Frame buffers recycled by one capture thread.
+//
+// acquire() hands out a buffer that no consumer references any more, so the
+// decoder can write into it in place (cv::VideoCapture::read() reuses the
+// destination when size and type match) without disturbing frames still held
+// by a worker or the GUI. Publishing is then a shared_ptr swap, so a sampled
+// frame is never deep-copied on its way to the encoder.
+class FramePool {
+public:
+    std::shared_ptr<Frame> acquire()
+    {
+        for (const auto& buffer : buffers_) {
+            if (buffer.use_count() == 1) {
+                // Pairs with the release decrement of the last consumer's
+                // FrameRef, so its reads happen before we overwrite the pixels.
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return buffer;
+            }
+        }
+
+        auto buffer = std::make_shared<Frame>();
+        if (buffers_.size() < kMaxBuffers) {
+            buffers_.push_back(buffer);
+        }
+        // Otherwise every pooled buffer is in use (many slow workers); the
+        // fresh buffer is simply freed once its last consumer drops it.
+        return buffer;
     }
 
-    const int w = frame.cols;
-    const int h = frame.rows;
-    const int m = (w > h) ? w : h;
-    if (m <= maxDim) {
-        return frame;
+private:
+    // Latest slot + pending slot + a frame being decoded + a few in flight.
+    static constexpr size_t kMaxBuffers = 8;
+
+    std::vector<std::shared_ptr<Frame>> buffers_;
+};
+
+// Scene-change detector used to gate triggers.
+//
+// Frames are reduced to a small blurred grayscale thumbnail and compared with
+// the thumbnail of the last frame sent to the model, so slow changes still
+// add up. The score is the fraction of thumbnail pixels whose intensity moved
+// by more than pixelDelta. Plain differencing is used rather than a
+// background-subtraction model: it is cheap, needs only imgproc, and "has
+// anything changed since the model last looked" is exactly the question.
+class MotionGate {
+public:
+    // Score the frame against the reference. Without a reference it is 1.0.
+    double score(const cv::Mat& frame, int pixelDelta) const
+    {
+        const cv::Mat current = thumbnail(frame);
+        if (reference_.empty() || reference_.size().area() != current.size().area()) {
+            return 1.0;
+        }
+
+        cv::Mat diff;
+        cv::absdiff(current, reference_, diff);
+        cv::threshold(diff, diff, pixelDelta, 255, cv::THRESH_BINARY);
+        return static_cast<double>(cv::countNonZero(diff)) /
+               static_cast<double>(diff.total());
     }
 
-    const double scale = static_cast<double>(maxDim) / static_cast<double>(m);
-    const int nw = std::max(1, static_cast<int>(std::lround(w * scale)));
-    const int nh = std::max(1, static_cast<int>(std::lround(h * scale)));
+    // Make the frame that was just sent the new reference.
+    void accept(const cv::Mat& frame)
+    {
+        reference_ = thumbnail(frame);
+    }
 
-    cv::Mat resized;
-    cv::resize(frame, resized, cv::Size(nw, nh), 0, 0, cv::INTER_AREA);
-    return resized;
-}
+private:
+    static constexpr int kThumbWidth = 160;
 
-//------------------------------------------------------------------------------
-// Strict numeric parsing helpers
-//------------------------------------------------------------------------------
+    static cv::Mat thumbnail(const cv::Mat& frame)
+    {
+        if (frame.empty()) {
+            return {};
+        }
 
-// Parse a double and require that the whole string is consumed.
-static bool parseDoubleStrict(const std::string& s, double& out)
-{
-    try {
-        size_t idx = 0;
-        out = std::stod(s, &idx);
-        return idx == s.size();
-    } catch (...) {
-        return false;
+        const int th = std::max(1, frame.rows * kThumbWidth / std::max(1, frame.cols));
+        cv::Mat small;
+        cv::Mat gray;
+        cv::resize(frame, small, cv::Size(kThumbWidth, th), 0, 0, cv::INTER_AREA);
+        if (small.channels() == 3) {
+            cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+        } else {
+            gray = small;
+        }
+        cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
+        return gray;
     }
-}
 
-// Parse an int and require that the whole string is consumed.
-static bool parseIntStrict(const std::string& s, int& out)
+    cv::Mat reference_;
+};
+
+// 64-bit difference hash (dHash) of a frame.
+//
+// The frame is reduced to a 9x8 grayscale image and each bit records whether
+// a pixel is brighter than its right neighbour. Small changes in noise,
+// compression or exposure flip few bits, so the Hamming distance between two
+// hashes measures visual similarity.
+static uint64_t differenceHash(const cv::Mat& frame)
 {
-    try {
-        size_t idx = 0;
-        out = std::stoi(s, &idx);
-        return idx == s.size();
-    } catch (...) {
-        return false;
+    if (frame.empty()) {
+        return 0;
+    }
+
+    cv::Mat small;
+    cv::Mat gray;
+    cv::resize(frame, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+    if (small.channels() == 3) {
+        cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    } else {
+        gray = small;
+    }
+
+    uint64_t hash = 0;
+    for (int y = 0; y < 8; ++y) {
+        const uchar* row = gray.ptr<uchar>(y);
+        for (int x = 0; x < 8; ++x) {
+            hash = (hash << 1) | (row[x] > row[x + 1] ? 1u : 0u);
+        }
     }
+    return hash;
 }
 
+//------------------------------------------------------------------------------
+// Strict numeric parsing helpers (parseDoubleStrict/parseIntStrict live in
+// pipeline_helpers.hpp, shared with the tools)
+//------------------------------------------------------------------------------
+
 // Return true if the entire string is composed of decimal digits.
 static bool isUnsignedIntegerString(const std::string& s)
 {
@@ -663,176 +847,2915 @@ static bool openCapture(cv::VideoCapture& cap, const std::string& src)
 }
 
 //------------------------------------------------------------------------------
-// OpenAI request
+// Response cache
 //------------------------------------------------------------------------------
 
-// Encode a frame as JPEG, wrap it into a data URL, and send it to the model.
-//
-// We include both:
-// - wall time: how long the program has been running
-// - media position: where the frame sits in the media timeline
+// Cache of model responses keyed by source, prompt and frame dHash.
 //
-// Keeping those separate matters for offline file playback, where media time
-// should not drift if inference becomes slower or faster.
-static bool sendFrameToOpenAI(
-    const cv::Mat& frame,
-    double wallTimeSec,
-    double mediaPosSec,
-    int triggerIdx,
-    const OpenAIConfig& cfg,
-    const std::string& prompt,
-    int maxDim,
-    int jpegQuality)
-{
-    cv::Mat resized = resizeMaxDim(frame, maxDim);
-
-    std::vector<uchar> buffer;
-    std::vector<int> params;
-    if (jpegQuality > 0 && jpegQuality <= 100) {
-        params = {cv::IMWRITE_JPEG_QUALITY, jpegQuality};
-    }
-
-    if (!cv::imencode(".jpg", resized, buffer, params)) {
-        std::cerr << "[ERROR] Interval #" << triggerIdx
-                  << " failed to encode frame to JPEG\n";
-        return false;
+// A lookup hits when an entry of the same source and prompt has a hash within
+// maxDistance bits and is younger than the TTL; the closest such entry wins.
+// Entries live in a fixed ring, so lookups are a linear scan over a few
+// hundred 64-bit keys, which is negligible next to a model call.
+class ResponseCache {
+public:
+    ResponseCache(double ttlSec, int maxDistance)
+        : ttl_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(ttlSec))),
+          maxDistance_(maxDistance)
+    {
+        entries_.reserve(kCapacity);
     }
 
-    const std::string dataUrl = "data:image/jpeg;base64," + base64Encode(buffer);
+    std::optional<std::string> lookup(size_t sourceIdx, uint64_t promptKey, uint64_t frameHash)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        const Entry* best = nullptr;
+        int bestDistance = maxDistance_ + 1;
+        for (const auto& entry : entries_) {
+            if (entry.sourceIdx != sourceIdx || entry.promptKey != promptKey ||
+                now - entry.stored > ttl_) {
+                continue;
+            }
+            const int distance = std::popcount(entry.frameHash ^ frameHash);
+            if (distance < bestDistance ||
+                (distance == bestDistance && best != nullptr && entry.stored > best->stored)) {
+                best = &entry;
+                bestDistance = distance;
+            }
+        }
 
-    std::ostringstream promptStream;
-    promptStream
-        << prompt
-        << " Wall time: " << std::fixed << std::setprecision(3) << wallTimeSec << "s;"
-        << " media position: " << std::fixed << std::setprecision(3) << mediaPosSec << "s;"
-        << " interval #" << triggerIdx;
+        if (best == nullptr) {
+            ++misses_;
+            return std::nullopt;
+        }
+        ++hits_;
+        return best->text;
+    }
 
-    json body = {
-        {"model", cfg.vmodelName},
-        {"messages", json::array({
-            {
-                {"role", "user"},
-                {"content", json::array({
-                    {{"type", "text"}, {"text", promptStream.str()}},
-                    {{"type", "image_url"}, {"image_url", {{"url", dataUrl}}}}
-                })}
-            }
-        })},
-        {"stream", false}
-    };
+    void insert(size_t sourceIdx, uint64_t promptKey, uint64_t frameHash, std::string text)
+    {
+        Entry entry{sourceIdx, promptKey, frameHash,
+                    std::chrono::steady_clock::now(), std::move(text)};
 
-    try {
-        auto chat = openai::chat().create(body);
-        const std::string message = extractMessageText(chat);
-        if (!message.empty()) {
-            std::cout << message << std::endl;
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (entries_.size() < kCapacity) {
+            entries_.push_back(std::move(entry));
         } else {
-            std::cout << "(no text content)" << std::endl;
+            entries_[nextSlot_] = std::move(entry);
+            nextSlot_ = (nextSlot_ + 1) % kCapacity;
         }
-        return true;
-    } catch (const std::exception& e) {
-        std::cerr << "[ERROR] OpenAI request failed for interval #"
-                  << triggerIdx << ": " << e.what() << "\n";
-        return false;
     }
-}
+
+    uint64_t hits() const { return hits_.load(); }
+    uint64_t misses() const { return misses_.load(); }
+
+private:
+    static constexpr size_t kCapacity = 256;
+
+    struct Entry {
+        size_t sourceIdx;
+        uint64_t promptKey;
+        uint64_t frameHash;
+        std::chrono::steady_clock::time_point stored;
+        std::string text;
+    };
+
+    const std::chrono::steady_clock::duration ttl_;
+    const int maxDistance_;
+
+    std::mutex mtx_;
+    std::vector<Entry> entries_;
+    size_t nextSlot_ = 0;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
 
 //------------------------------------------------------------------------------
-// CLI parsing
+// Metrics
 //------------------------------------------------------------------------------
 
-// Parse command-line arguments into ProgramOptions.
+// Per-stage latencies and event counters of the whole pipeline.
 //
-// Design goals:
-// - preserve the original CLI shape
-// - validate values with clear error messages
-// - avoid uncaught exceptions from stod/stoi
-static bool parseCommandLine(int argc, char** argv, ProgramOptions& opt)
-{
-    if (argc < 2) {
-        printUsage(argv[0]);
-        return false;
-    }
+// Stages, in pipeline order:
+// - grab, retrieve: cv::VideoCapture::grab() (for live sources this includes
+//   waiting for the next frame) and retrieve() (decode/colour conversion)
+// - queue_wait: trigger until a worker picks the job up
+// - resize, jpeg_encode, base64, json_build: building the request body
+// - http: request round trip (the whole stream with --stream)
+// - ttft: time to first token (--stream only)
+// - parse: response JSON parsing and text extraction
+// - end_to_end: trigger until the result line is handed to the printer
+// - frame_age: capture of the analysed frame until its result is handed to
+//   the printer, i.e. how old the scene is when the answer arrives
+struct PipelineMetrics {
+    LatencyHistogram grab;
+    LatencyHistogram retrieve;
+    LatencyHistogram queueWait;
+    LatencyHistogram resize;
+    LatencyHistogram jpegEncode;
+    LatencyHistogram base64;
+    LatencyHistogram jsonBuild;
+    LatencyHistogram http;
+    LatencyHistogram ttft;
+    LatencyHistogram parse;
+    LatencyHistogram endToEnd;
+    LatencyHistogram frameAge;
+
+    Counter framesCaptured;
+    Counter triggers;          // jobs queued for inference (a clip counts once)
+    Counter jobsOverwritten;   // pending job pushed out by a newer one before a worker took it
+    Counter jobsExpired;       // pending job dropped by the deadline policy
+    Counter jobsBlocked;       // triggers held because their source's queue was full (block policy)
+    Counter jobsSkipped;       // triggers dropped because the held triggers were full too (block policy)
+    Counter jobsStale;         // dropped by a worker: frame older than --max-frame-age
+    Counter framesRefreshed;   // stale job frame swapped for the source's latest
+    Counter requests;
+    Counter requestsFailed;
+    Counter requestsCancelled;
+    Counter imageBytes;
+    Counter cacheHits;
+    Counter reconnects;
+    Counter batchFilesDone;
+    Counter batchFilesFailed;   // skipped, or with failed requests (retried next run)
+
+    // Current trigger interval of live sources (changes with --adaptive-interval).
+    std::atomic<double> triggerIntervalSec{0.0};
+
+    struct Stage {
+        const char* name;
+        const LatencyHistogram* histogram;
+    };
 
-    opt.src = argv[1];
+    struct CounterInfo {
+        const char* name;     // Prometheus name without the v2k_ prefix
+        const char* help;
+        const Counter* counter;
+    };
 
-    // Optional positional config path:
-    //   program <src> config.ini --interval 10
-    if (argc >= 3 && std::string(argv[2]).rfind("--", 0) != 0) {
-        opt.configPath = argv[2];
+    std::vector<Stage> stages() const
+    {
+        return {
+            {"grab", &grab}, {"retrieve", &retrieve}, {"queue_wait", &queueWait},
+            {"resize", &resize}, {"jpeg_encode", &jpegEncode}, {"base64", &base64},
+            {"json_build", &jsonBuild}, {"http", &http}, {"ttft", &ttft},
+            {"parse", &parse}, {"end_to_end", &endToEnd}, {"frame_age", &frameAge},
+        };
     }
 
-    int argi = 2;
-    if (argc >= 3 && std::string(argv[2]).rfind("--", 0) != 0) {
-        argi = 3;
+    std::vector<CounterInfo> counters() const
+    {
+        return {
+            {"frames_captured_total", "Frames decoded by the capture threads", &framesCaptured},
+            {"triggers_total", "Inference jobs submitted", &triggers},
+            {"jobs_overwritten_total", "Pending jobs replaced by a newer frame", &jobsOverwritten},
+            {"jobs_expired_total", "Pending jobs dropped after their deadline", &jobsExpired},
+            {"jobs_blocked_total", "Triggers held until their source's queue had room", &jobsBlocked},
+            {"jobs_skipped_total", "Triggers skipped because their source already held the maximum", &jobsSkipped},
+            {"jobs_stale_total", "Jobs dropped because their frame exceeded the maximum age", &jobsStale},
+            {"frames_refreshed_total", "Stale job frames replaced by a newer frame", &framesRefreshed},
+            {"requests_total", "Model requests sent", &requests},
+            {"requests_failed_total", "Model requests that failed", &requestsFailed},
+            {"requests_cancelled_total", "Model requests cancelled in flight", &requestsCancelled},
+            {"image_bytes_total", "JPEG bytes sent to the model", &imageBytes},
+            {"cache_hits_total", "Responses served from the response cache", &cacheHits},
+            {"reconnects_total", "Reconnect attempts of live sources", &reconnects},
+            {"batch_files_done_total", "Batch files analysed completely", &batchFilesDone},
+            {"batch_files_failed_total", "Batch files skipped or left incomplete", &batchFilesFailed},
+        };
     }
 
-    auto needValue = [&](const char* name) -> std::optional<std::string> {
-        if (argi + 1 >= argc) {
-            std::cerr << "[ERROR] Missing value for " << name << "\n";
-            return std::nullopt;
+    std::string renderPrometheus() const
+    {
+        std::string out;
+        appendPrometheusHeader(out, "v2k_stage_seconds", "summary",
+                               "Latency of each pipeline stage");
+        for (const auto& stage : stages()) {
+            appendPrometheusSummary(out, "v2k_stage_seconds",
+                                    std::string("stage=\"") + stage.name + "\"",
+                                    stage.histogram->snapshot());
         }
-        return std::string(argv[++argi]);
-    };
-
-    for (; argi < argc; ++argi) {
-        const std::string a = argv[argi];
+        for (const auto& c : counters()) {
+            const std::string name = std::string("v2k_") + c.name;
+            appendPrometheusHeader(out, name, "counter", c.help);
+            appendPrometheusSample(out, name, "", static_cast<double>(c.counter->value()));
+        }
+        appendPrometheusHeader(out, "v2k_trigger_interval_seconds", "gauge",
+                               "Trigger interval of live sources");
+        appendPrometheusSample(out, "v2k_trigger_interval_seconds", "",
+                               triggerIntervalSec.load(std::memory_order_relaxed));
+        return out;
+    }
+};
 
-        if (a == "--interval") {
-            auto v = needValue("--interval");
-            if (!v) return false;
+// Periodic stats on stderr (--stats-interval): counter increments and
+// per-stage quantiles since the previous report, so a change in load shows up
+// immediately instead of being averaged over the whole run.
+class StatsReporter {
+public:
+    explicit StatsReporter(const PipelineMetrics& metrics)
+        : metrics_(metrics),
+          lastStages_(metrics.stages().size()),
+          lastCounters_(metrics.counters().size(), 0),
+          lastReport_(std::chrono::steady_clock::now()) {}
 
-            double parsed = 0.0;
-            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
-                std::cerr << "[ERROR] --interval must be a positive number\n";
-                return false;
+    void report()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const double windowSec = std::chrono::duration<double>(now - lastReport_).count();
+        lastReport_ = now;
+
+        std::ostringstream out;
+        out << "[STATS] last " << std::fixed << std::setprecision(1) << windowSec << "s:";
+        const auto counters = metrics_.counters();
+        for (size_t i = 0; i < counters.size(); ++i) {
+            const uint64_t value = counters[i].counter->value();
+            std::string name = counters[i].name;
+            name.resize(name.size() - 6);   // drop "_total"
+            out << ' ' << name << '=' << (value - lastCounters_[i]);
+            lastCounters_[i] = value;
+        }
+        out << "\n";
+
+        const auto stages = metrics_.stages();
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const auto snap = stages[i].histogram->snapshot();
+            const auto window = snap.since(lastStages_[i]);
+            lastStages_[i] = snap;
+            if (window.count == 0) {
+                continue;
             }
-            opt.intervalSec = std::max(0.1, parsed);
-        } else if (a == "--max-dim") {
-            auto v = needValue("--max-dim");
-            if (!v) return false;
+            out << "[STATS]   " << std::left << std::setw(12) << stages[i].name << std::right
+                << " n=" << std::setw(6) << window.count << std::setprecision(2)
+                << " p50=" << std::setw(9) << window.quantile(0.50) * 1e3 << "ms"
+                << " p95=" << std::setw(9) << window.quantile(0.95) * 1e3 << "ms"
+                << " p99=" << std::setw(9) << window.quantile(0.99) * 1e3 << "ms\n";
+        }
+        std::cerr << out.str();
+    }
 
-            int parsed = 0;
-            if (!parseIntStrict(*v, parsed) || parsed < 0) {
-                std::cerr << "[ERROR] --max-dim must be an integer >= 0\n";
-                return false;
-            }
-            opt.maxDim = parsed;
-        } else if (a == "--jpeg-quality") {
-            auto v = needValue("--jpeg-quality");
+private:
+    const PipelineMetrics& metrics_;
+    std::vector<LatencyHistogram::Snapshot> lastStages_;
+    std::vector<uint64_t> lastCounters_;
+    std::chrono::steady_clock::time_point lastReport_;
+};
+
+//------------------------------------------------------------------------------
+// HTTP client
+//------------------------------------------------------------------------------
+
+// Transport settings shared by all inference requests.
+struct HttpClientOptions {
+    double connectTimeoutSec = 5.0;
+    double requestTimeoutSec = 0.0;   // whole request incl. response; 0 = none
+    bool gzipRequest = false;         // send the body with Content-Encoding: gzip
+    bool verifyTls = true;            // check the server certificate and host name
+};
+
+// DNS and TLS session caches shared by the per-worker sessions, so a new
+// connection skips the lookup and resumes the TLS session of another worker.
+//
+// The connection cache itself is deliberately not shared: libcurl does not
+// support one connection cache for transfers running concurrently on several
+// threads. Each worker's easy handle keeps its own keep-alive connections
+// across requests instead.
+class HttpSharedCache {
+public:
+    HttpSharedCache() : share_(curl_share_init())
+    {
+        if (share_ == nullptr) {
+            throw std::runtime_error("curl_share_init failed");
+        }
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &HttpSharedCache::lock);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &HttpSharedCache::unlock);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ~HttpSharedCache()
+    {
+        curl_share_cleanup(share_);
+    }
+
+    HttpSharedCache(const HttpSharedCache&) = delete;
+    HttpSharedCache& operator=(const HttpSharedCache&) = delete;
+
+    CURLSH* handle() const { return share_; }
+
+private:
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr)
+    {
+        static_cast<HttpSharedCache*>(userptr)->mutexFor(data).lock();
+    }
+
+    static void unlock(CURL*, curl_lock_data data, void* userptr)
+    {
+        static_cast<HttpSharedCache*>(userptr)->mutexFor(data).unlock();
+    }
+
+    std::mutex& mutexFor(curl_lock_data data)
+    {
+        return mutexes_[static_cast<size_t>(data) % mutexes_.size()];
+    }
+
+    CURLSH* share_;
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> mutexes_;
+};
+
+// gzip-compress `in` (RFC 1952 framing, as expected for Content-Encoding: gzip).
+static bool gzipCompress(std::string_view in, std::string& out)
+{
+    z_stream zs{};
+    if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    out.resize(deflateBound(&zs, static_cast<uLong>(in.size())));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+
+    const int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+// Thrown by HttpSession::post() when the cancel check aborted the transfer.
+class RequestCancelled : public std::runtime_error {
+public:
+    RequestCancelled() : std::runtime_error("request cancelled") {}
+};
+
+// libcurl easy handle owned by one worker.
+//
+// Transport options are set once; every request then only swaps URL, headers
+// and body, and the handle reuses its own idle connection to base_url.
+// Requests are sent with TCP_NODELAY (the body goes out in one burst and the
+// reply is awaited), TCP keep-alive probes on idle connections, and
+// any response compression the server offers.
+class HttpSession {
+public:
+    HttpSession(HttpSharedCache& cache, const HttpClientOptions& options)
+        : curl_(curl_easy_init()), options_(options)
+    {
+        if (curl_ == nullptr) {
+            throw std::runtime_error("curl_easy_init failed");
+        }
+
+        curl_easy_setopt(curl_, CURLOPT_SHARE, cache.handle());
+        curl_easy_setopt(curl_, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl_, CURLOPT_TCP_NODELAY, 1L);
+        curl_easy_setopt(curl_, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl_, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(curl_, CURLOPT_CONNECTTIMEOUT_MS,
+                         static_cast<long>(options.connectTimeoutSec * 1000.0));
+        curl_easy_setopt(curl_, CURLOPT_TIMEOUT_MS,
+                         static_cast<long>(options.requestTimeoutSec * 1000.0));
+        curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYPEER, options.verifyTls ? 1L : 0L);
+        curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYHOST, options.verifyTls ? 2L : 0L);
+        curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, &HttpSession::writeCallback);
+        curl_easy_setopt(curl_, CURLOPT_XFERINFOFUNCTION, &HttpSession::progressCallback);
+        curl_easy_setopt(curl_, CURLOPT_XFERINFODATA, this);
+    }
+
+    ~HttpSession()
+    {
+        curl_easy_cleanup(curl_);
+    }
+
+    HttpSession(const HttpSession&) = delete;
+    HttpSession& operator=(const HttpSession&) = delete;
+
+    // Polled while a request is in flight: while data flows, and about once
+    // a second while waiting for the server. Returning true aborts the
+    // request. Runs on the thread calling post().
+    void setCancelCheck(std::function<bool()> cancelled)
+    {
+        cancelled_ = std::move(cancelled);
+        curl_easy_setopt(curl_, CURLOPT_NOPROGRESS, cancelled_ ? 0L : 1L);
+    }
+
+    // POST `body` to `url`, passing response bytes to onData as they arrive.
+    // Returns the HTTP status; throws RequestCancelled if the cancel check
+    // fired and std::runtime_error on other transport errors.
+    long post(
+        const std::string& url,
+        const std::vector<std::string>& headers,
+        const std::string& body,
+        const std::function<void(std::string_view)>& onData)
+    {
+        const std::string* payload = &body;
+        std::string compressed;
+        curl_slist* headerList = nullptr;
+        if (options_.gzipRequest && gzipCompress(body, compressed)) {
+            payload = &compressed;
+            headerList = curl_slist_append(headerList, "Content-Encoding: gzip");
+        }
+        for (const auto& h : headers) {
+            headerList = curl_slist_append(headerList, h.c_str());
+        }
+        // Skip the "Expect: 100-continue" round trip libcurl adds for large bodies.
+        headerList = curl_slist_append(headerList, "Expect:");
+
+        curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headerList);
+        curl_easy_setopt(curl_, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, payload->data());
+        curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE_LARGE,
+                         static_cast<curl_off_t>(payload->size()));
+        curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &onData);
+
+        const CURLcode rc = curl_easy_perform(curl_);
+        curl_slist_free_all(headerList);
+        curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, nullptr);
+
+        long newConnections = 0;
+        curl_easy_getinfo(curl_, CURLINFO_NUM_CONNECTS, &newConnections);
+        ++requests_;
+        connects_ += static_cast<uint64_t>(newConnections);
+
+        if (rc == CURLE_ABORTED_BY_CALLBACK) {
+            throw RequestCancelled();
+        }
+        if (rc != CURLE_OK) {
+            throw std::runtime_error(curl_easy_strerror(rc));
+        }
+
+        long status = 0;
+        curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &status);
+        return status;
+    }
+
+    // Requests sent and new connections opened for them. Read after the
+    // owning worker has stopped.
+    uint64_t requests() const { return requests_; }
+    uint64_t connects() const { return connects_; }
+
+private:
+    static size_t writeCallback(char* ptr, size_t size, size_t nmemb, void* userdata)
+    {
+        const auto& onData = *static_cast<const std::function<void(std::string_view)>*>(userdata);
+        onData(std::string_view(ptr, size * nmemb));
+        return size * nmemb;
+    }
+
+    static int progressCallback(void* userdata, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+    {
+        const auto* self = static_cast<const HttpSession*>(userdata);
+        return self->cancelled_ && self->cancelled_() ? 1 : 0;
+    }
+
+    CURL* curl_;
+    HttpClientOptions options_;
+    std::function<bool()> cancelled_;
+    uint64_t requests_ = 0;
+    uint64_t connects_ = 0;
+};
+
+//------------------------------------------------------------------------------
+// OpenAI request
+//------------------------------------------------------------------------------
+
+// How a frame is turned into the image sent to the model.
+struct ImageEncoding {
+    int maxDim = 1024;        // longest side; <= 0 keeps the frame size
+    int jpegQuality = 85;
+    int sideMultiple = 1;     // round both sides down to a multiple of this
+};
+
+// Time spent in each stage of one request, for PipelineMetrics.
+struct RequestTiming {
+    double resizeSec = 0.0;
+    double jpegEncodeSec = 0.0;
+    double base64Sec = 0.0;
+    double jsonBuildSec = 0.0;           // body construction and serialization
+    double httpSec = 0.0;                // round trip, or whole stream
+    double timeToFirstTokenSec = -1.0;   // streamed only; < 0 if no text arrived
+    double parseSec = 0.0;
+    bool cancelled = false;   // aborted in flight (shutdown, superseded frame)
+
+    // Which of the stages above ran to completion; a request that failed
+    // while being built leaves the later ones out of the histograms.
+    bool imagesEncoded = false;   // resize, jpeg_encode and base64, every image
+    bool bodyBuilt = false;       // json_build
+
+    // What was actually sent.
+    size_t jpegBytes = 0;
+    int imageWidth = 0;
+    int imageHeight = 0;
+};
+
+// Encode a frame as JPEG, wrap it into a data URL, and build the
+// chat-completions request body around it.
+//
+// We include both:
+// - wall time: how long the program has been running
+// - media position: where the frame sits in the media timeline
+//
+// Keeping those separate matters for offline file playback, where media time
+// should not drift if inference becomes slower or faster.
+//
+// With --clip-frames the `context` frames are sent first, in order (the
+// caller describes them in `prompt`). Timing sums over all images; the
+// reported size is that of `frame`.
+static bool buildFrameRequest(
+    const cv::Mat& frame,
+    const std::vector<FrameRef>& context,
+    double wallTimeSec,
+    double mediaPosSec,
+    int triggerIdx,
+    const OpenAIConfig& cfg,
+    const std::string& prompt,
+    const ImageEncoding& encoding,
+    bool stream,
+    json& body,
+    RequestTiming& timing)
+{
+    std::vector<const cv::Mat*> images;
+    for (const FrameRef& earlier : context) {
+        images.push_back(&earlier->image);
+    }
+    images.push_back(&frame);
+
+    Stopwatch stopwatch;
+    std::vector<std::string> dataUrls;
+    std::vector<uchar> buffer;
+    for (const cv::Mat* image : images) {
+        cv::Mat resized = resizeMaxDim(*image, encoding.maxDim, cv::INTER_AREA, encoding.sideMultiple);
+        timing.resizeSec += stopwatch.lap();
+
+        if (!encodeJpeg(resized, encoding.jpegQuality, buffer)) {
+            std::cerr << "[ERROR] Interval #" << triggerIdx
+                      << " failed to encode frame to JPEG\n";
+            return false;
+        }
+        timing.jpegEncodeSec += stopwatch.lap();
+        timing.jpegBytes += buffer.size();
+        timing.imageWidth = resized.cols;
+        timing.imageHeight = resized.rows;
+
+        // Encoded straight into the URL string, which is then moved into the body.
+        dataUrls.push_back(base64DataUrl("data:image/jpeg;base64,", buffer));
+        timing.base64Sec += stopwatch.lap();
+    }
+    timing.imagesEncoded = true;
+
+    std::ostringstream promptStream;
+    promptStream
+        << prompt
+        << " Wall time: " << std::fixed << std::setprecision(3) << wallTimeSec << "s;"
+        << " media position: " << std::fixed << std::setprecision(3) << mediaPosSec << "s;"
+        << " interval #" << triggerIdx;
+
+    body = buildChatRequestBody(cfg.vmodelName, promptStream.str(), std::move(dataUrls), stream);
+    timing.jsonBuildSec = stopwatch.lap();
+    timing.bodyBuilt = true;
+    return true;
+}
+
+// Send a frame to the model and wait for the complete response.
+//
+// The response text is returned in `message` rather than printed here so that
+// concurrent workers can emit each result line in a single write.
+static bool sendFrameToOpenAI(
+    HttpSession& session,
+    const cv::Mat& frame,
+    const std::vector<FrameRef>& context,
+    double wallTimeSec,
+    double mediaPosSec,
+    int triggerIdx,
+    const OpenAIConfig& cfg,
+    const std::string& prompt,
+    const ImageEncoding& encoding,
+    std::string& message,
+    RequestTiming& timing)
+{
+    json body;
+    if (!buildFrameRequest(frame, context, wallTimeSec, mediaPosSec, triggerIdx, cfg,
+                           prompt, encoding, false, body, timing)) {
+        return false;
+    }
+
+    try {
+        const std::vector<std::string> headers = {
+            "Content-Type: application/json",
+            "Authorization: Bearer " + cfg.apiKey,
+        };
+
+        Stopwatch stopwatch;
+        const std::string payload = body.dump();
+        timing.jsonBuildSec += stopwatch.lap();
+
+        std::string raw;
+        const long status = session.post(
+            cfg.baseUrl + "chat/completions", headers, payload,
+            [&](std::string_view bytes) { raw.append(bytes); });
+        timing.httpSec = stopwatch.lap();
+
+        if (status >= 400) {
+            throw std::runtime_error("HTTP " + std::to_string(status) + ": " + raw.substr(0, 512));
+        }
+        const json response = json::parse(raw);
+        if (response.contains("error")) {
+            throw std::runtime_error(response["error"].dump());
+        }
+
+        message = extractMessageText(response);
+        timing.parseSec = stopwatch.lap();
+        if (message.empty()) {
+            message = "(no text content)";
+        }
+        return true;
+    } catch (const RequestCancelled&) {
+        timing.cancelled = true;
+        return false;
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] OpenAI request failed for interval #"
+                  << triggerIdx << ": " << e.what() << "\n";
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Streaming requests (server-sent events)
+//------------------------------------------------------------------------------
+
+// Incremental parser for text/event-stream bodies.
+//
+// Bytes arrive in arbitrary chunks; each complete event's data is passed to
+// onEvent. Multi-line data fields are joined with '\n' as the SSE spec
+// requires, and comment lines (":" keep-alives) are ignored.
+class SseParser {
+public:
+    explicit SseParser(std::function<void(const std::string&)> onEvent)
+        : onEvent_(std::move(onEvent)) {}
+
+    void feed(std::string_view bytes)
+    {
+        for (const char ch : bytes) {
+            if (ch != '\n') {
+                line_.push_back(ch);
+                continue;
+            }
+            if (!line_.empty() && line_.back() == '\r') {
+                line_.pop_back();
+            }
+            processLine();
+            line_.clear();
+        }
+    }
+
+    // Dispatch a trailing event that was not terminated by a blank line.
+    void finish()
+    {
+        if (!line_.empty()) {
+            processLine();
+            line_.clear();
+        }
+        dispatch();
+    }
+
+private:
+    void processLine()
+    {
+        if (line_.empty()) {
+            dispatch();
+            return;
+        }
+        if (line_.rfind("data:", 0) != 0) {
+            return;  // comments, event:, id:, retry:
+        }
+
+        std::string_view value(line_);
+        value.remove_prefix(5);
+        if (!value.empty() && value.front() == ' ') {
+            value.remove_prefix(1);
+        }
+        if (hasData_) {
+            data_.push_back('\n');
+        }
+        data_.append(value);
+        hasData_ = true;
+    }
+
+    void dispatch()
+    {
+        if (hasData_) {
+            onEvent_(data_);
+        }
+        data_.clear();
+        hasData_ = false;
+    }
+
+    std::function<void(const std::string&)> onEvent_;
+    std::string line_;
+    std::string data_;
+    bool hasData_ = false;
+};
+
+// Extract the text delta from one streamed chat-completions chunk.
+static std::string extractDeltaText(const json& chunk)
+{
+    const auto choicesIt = chunk.find("choices");
+    if (choicesIt == chunk.end() || !choicesIt->is_array() || choicesIt->empty()) {
+        return {};
+    }
+    const auto& first = (*choicesIt)[0];
+
+    const auto deltaIt = first.find("delta");
+    if (deltaIt != first.end() && deltaIt->is_object()) {
+        const auto contentIt = deltaIt->find("content");
+        if (contentIt != deltaIt->end()) {
+            if (contentIt->is_string()) {
+                return contentIt->get<std::string>();
+            }
+            if (contentIt->is_array()) {
+                std::string combined;
+                for (const auto& part : *contentIt) {
+                    const auto textIt = part.find("text");
+                    if (textIt != part.end() && textIt->is_string()) {
+                        combined += textIt->get<std::string>();
+                    }
+                }
+                return combined;
+            }
+        }
+        return {};
+    }
+
+    // Completions-style streams.
+    const auto textIt = first.find("text");
+    if (textIt != first.end() && textIt->is_string()) {
+        return textIt->get<std::string>();
+    }
+    return {};
+}
+
+// Send a frame with "stream": true and report text as it arrives.
+//
+// Deltas are buffered and handed to onPartial at sentence boundaries
+// (".", "!" or "?" followed by whitespace, or a newline), which is what an
+// operator can act on; decimals such as "3.5 ml" do not split. A terminator at the
+// end of the buffer waits for the next delta, and the remainder is flushed
+// when the stream ends. The full text is also returned
+// in `message`. Servers that ignore "stream" and answer with a plain JSON body
+// are handled too.
+static bool streamFrameToOpenAI(
+    HttpSession& session,
+    const cv::Mat& frame,
+    const std::vector<FrameRef>& context,
+    double wallTimeSec,
+    double mediaPosSec,
+    int triggerIdx,
+    const OpenAIConfig& cfg,
+    const std::string& prompt,
+    const ImageEncoding& encoding,
+    const std::function<void(const std::string&)>& onPartial,
+    std::string& message,
+    RequestTiming& timing)
+{
+    json body;
+    if (!buildFrameRequest(frame, context, wallTimeSec, mediaPosSec, triggerIdx, cfg,
+                           prompt, encoding, true, body, timing)) {
+        return false;
+    }
+
+    message.clear();
+    std::string unflushed;
+    std::string raw;            // kept for error reporting and non-SSE replies
+    bool sawEvent = false;
+    std::string streamError;
+
+    auto flush = [&](bool all) {
+        size_t count = all ? unflushed.size() : 0;
+        for (size_t i = unflushed.size(); !all && i-- > 0;) {
+            const char c = unflushed[i];
+            if (c == '\n' ||
+                ((c == '.' || c == '!' || c == '?') && i + 1 < unflushed.size() &&
+                 std::isspace(static_cast<unsigned char>(unflushed[i + 1])))) {
+                count = i + 1;
+                break;
+            }
+        }
+        if (count == 0) {
+            return;
+        }
+        std::string sentence = unflushed.substr(0, count);
+        unflushed.erase(0, count);
+        if (trimInPlace(sentence)) {
+            onPartial(sentence);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    SseParser parser([&](const std::string& data) {
+        sawEvent = true;
+        if (data == "[DONE]") {
+            return;
+        }
+
+        const json chunk = json::parse(data, nullptr, false);
+        if (chunk.is_discarded()) {
+            return;
+        }
+        if (chunk.contains("error")) {
+            streamError = chunk["error"].dump();
+            return;
+        }
+
+        const std::string delta = extractDeltaText(chunk);
+        if (delta.empty()) {
+            return;
+        }
+        if (timing.timeToFirstTokenSec < 0.0) {
+            timing.timeToFirstTokenSec = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        message += delta;
+        unflushed += delta;
+        flush(false);
+    });
+
+    try {
+        const std::vector<std::string> headers = {
+            "Content-Type: application/json",
+            "Accept: text/event-stream",
+            "Authorization: Bearer " + cfg.apiKey,
+        };
+
+        const std::string payload = body.dump();
+        const auto posted = std::chrono::steady_clock::now();
+        timing.jsonBuildSec += std::chrono::duration<double>(posted - start).count();
+        start = posted;
+
+        const long status = session.post(
+            cfg.baseUrl + "chat/completions", headers, payload,
+            [&](std::string_view bytes) {
+                if (raw.size() < 64 * 1024) {
+                    raw.append(bytes);
+                }
+                parser.feed(bytes);
+            });
+        parser.finish();
+        timing.httpSec = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (status >= 400) {
+            throw std::runtime_error("HTTP " + std::to_string(status) + ": " + raw.substr(0, 512));
+        }
+        if (!streamError.empty()) {
+            throw std::runtime_error(streamError);
+        }
+        if (!sawEvent) {
+            const json response = json::parse(raw, nullptr, false);
+            if (!response.is_discarded()) {
+                message = extractMessageText(response);
+                timing.timeToFirstTokenSec = timing.httpSec;
+            }
+        }
+    } catch (const RequestCancelled&) {
+        timing.cancelled = true;
+        return false;
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] OpenAI request failed for interval #"
+                  << triggerIdx << ": " << e.what() << "\n";
+        return false;
+    }
+
+    flush(true);
+    if (message.empty()) {
+        message = "(no text content)";
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Capture and scheduling
+//------------------------------------------------------------------------------
+
+// Runtime state of one source.
+//
+// The capture thread owns `cap` and publishes into the latest-frame slot.
+// The main loop owns the trigger bookkeeping.
+struct SourceState {
+    SourceSpec spec;
+    size_t index = 0;
+
+    cv::VideoCapture cap;
+    bool likelyFile = false;
+    std::chrono::system_clock::time_point fileBaseTime{};
+
+    // Presentation time of each frame in decode output order, read from the
+    // container by probeMedia(). Empty when the container was not parsed,
+    // and for Matroska files that are not sampled offline; the capture loops
+    // then use the backend's CAP_PROP_POS_MSEC.
+    std::vector<double> framePts;
+
+    // The keyframes on the framePts scale (--keyframes); empty if not probed.
+    std::vector<double> keyframePts;
+
+    // Sampled by fileSampleLoop() (--offline) instead of the main loop.
+    bool offline = false;
+
+    // Cleared by the capture thread on EOF or when reconnecting gives up.
+    std::atomic<bool> active{true};
+
+    // Latest published frame. The mutex only guards the pointer swap.
+    std::mutex frameMtx;
+    FrameRef latestFrame;
+
+    // --clip-stride (live sources): published frames kept about half a stride
+    // apart, oldest first, for the earlier frames of a trigger. Guarded by
+    // frameMtx; historyLength 0 disables it.
+    double historyStrideSec = 0.0;
+    size_t historyLength = 0;
+    std::deque<FrameRef> history;
+
+    // --decode-on-demand: set by the main loop to have the capture thread
+    // decode the next grabbed frame. frameRequested/requestedAfterSeq are the
+    // main loop's side of the handshake.
+    std::atomic<bool> wantFrame{false};
+    bool frameRequested = false;
+    uint64_t requestedAfterSeq = 0;
+
+    double nextTrigger = 0.0;
+    int triggerIdx = 0;
+
+    // Motion gating state, owned by the main loop.
+    MotionGate motion;
+    uint64_t lastCheckedSeq = 0;
+    double lastCheckSec = 0.0;
+    double lastTriggerSec = 0.0;
+
+    uint64_t lastShownSeq = 0;   // GUI: last frame passed to imshow
+
+    // --clip-frames without --clip-stride: samples collected for the next
+    // request, owned by the main loop.
+    std::vector<FrameRef> clip;
+
+    // --queue-policy block: due jobs waiting for room in this source's
+    // queue, oldest first, owned by the main loop. At most queueDepth.
+    std::deque<PendingJob> heldJobs;
+
+    // --batch: the slot is reused for one file after another. Its jobs are
+    // counted until a worker is done with them, so the decoder can tell when
+    // a file is finished; `results` receives that file's JSONL records.
+    std::mutex jobsMtx;
+    std::condition_variable jobsDone;
+    size_t jobsOutstanding = 0;
+    std::atomic<uint64_t> jobsFailed{0};
+    std::unique_ptr<AsyncLineWriter> results;
+
+    // --segments: set while a file is sampled in segments; results then go
+    // through it instead of straight to the printer.
+    std::unique_ptr<SegmentMerger> merger;
+
+    FrameRef latest()
+    {
+        std::lock_guard<std::mutex> lock(frameMtx);
+        return latestFrame;
+    }
+
+    void publish(FrameRef frame)
+    {
+        std::lock_guard<std::mutex> lock(frameMtx);
+        if (historyLength > 0 && frame &&
+            (history.empty() || std::chrono::duration<double>(
+                                    frame->capturedAt - history.back()->capturedAt).count() >=
+                                    0.5 * historyStrideSec)) {
+            history.push_back(frame);
+            if (history.size() > historyLength) {
+                history.pop_front();
+            }
+        }
+        latestFrame = std::move(frame);
+    }
+
+    // The kept frames closest to strideSec * count, ..., strideSec * 1 before
+    // `frame`, oldest first. Targets without a frame within half a stride
+    // (e.g. right after start) are left out.
+    std::vector<FrameRef> framesBefore(const Frame& frame, size_t count, double strideSec)
+    {
+        std::lock_guard<std::mutex> lock(frameMtx);
+        std::vector<FrameRef> frames;
+        size_t next = 0;   // entries before this one are taken or too old
+        for (size_t j = count; j >= 1; --j) {
+            auto distance = [&](size_t i) {
+                return std::abs(std::chrono::duration<double>(
+                    frame.capturedAt - history[i]->capturedAt).count() - j * strideSec);
+            };
+            size_t best = history.size();
+            for (size_t i = next; i < history.size() && history[i]->seq < frame.seq; ++i) {
+                if (best == history.size() || distance(i) < distance(best)) {
+                    best = i;
+                }
+            }
+            if (best < history.size() && distance(best) <= 0.5 * strideSec) {
+                frames.push_back(history[best]);
+                next = best + 1;
+            }
+        }
+        return frames;
+    }
+
+    void jobStarted()
+    {
+        std::lock_guard<std::mutex> lock(jobsMtx);
+        ++jobsOutstanding;
+    }
+
+    void jobFinished()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobsMtx);
+            --jobsOutstanding;
+        }
+        jobsDone.notify_all();
+    }
+
+    // Wait until every job started so far is finished. Returns false if
+    // `running` was cleared first.
+    bool waitForJobs(const std::atomic<bool>& running)
+    {
+        std::unique_lock<std::mutex> lock(jobsMtx);
+        while (jobsOutstanding > 0 && running.load()) {
+            jobsDone.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        return jobsOutstanding == 0;
+    }
+};
+
+// Marks a job of an offline source finished (SourceState::jobFinished, and
+// its segment in the merger) when the worker is done with it, however it
+// ends. Offline sources count their jobs; live sources do not, as their
+// pending jobs may be replaced.
+class JobFinishedGuard {
+public:
+    JobFinishedGuard(SourceState& src, size_t segment)
+        : src_(src.offline ? &src : nullptr), segment_(segment) {}
+    ~JobFinishedGuard()
+    {
+        if (src_ != nullptr) {
+            if (src_->merger) {
+                src_->merger->jobFinished(segment_);
+            }
+            src_->jobFinished();
+        }
+    }
+
+    JobFinishedGuard(const JobFinishedGuard&) = delete;
+    JobFinishedGuard& operator=(const JobFinishedGuard&) = delete;
+
+private:
+    SourceState* src_;
+    size_t segment_;
+};
+
+// Base timestamp used to map media position -> absolute datetime.
+//
+// Priority:
+// 1. explicit --predefined_start_time
+// 2. encoded timeline start (start_time_realtime)
+// 3. encoded start from media metadata (creation_time)
+// 4. `fallback` (application start time)
+//
+// MP4/QuickTime and Matroska/WebM files are read in-process, which also
+// yields the keyframe index and, for offline sampling, the frame timeline;
+// ffprobe is only run for other containers.
+static void resolveFileBaseTime(
+    SourceState& src,
+    const ProgramOptions& options,
+    std::chrono::system_clock::time_point fallback)
+{
+    src.fileBaseTime = fallback;
+    src.framePts.clear();
+    src.keyframePts.clear();
+    if (!src.likelyFile) {
+        return;
+    }
+
+    MediaProbe probe;
+    const bool probed = probeMedia(src.spec.uri, probe, src.offline);
+    if (probed) {
+        src.framePts = std::move(probe.framePtsSec);
+        src.keyframePts = std::move(probe.keyframePtsSec);
+    }
+
+    if (options.hasPredefinedStartTime) {
+        src.fileBaseTime = options.predefinedStartTime;
+    } else if (probed) {
+        if (probe.startTimeRealtime.has_value()) {
+            src.fileBaseTime = *probe.startTimeRealtime;
+        } else if (probe.creationTime.has_value()) {
+            src.fileBaseTime = *probe.creationTime;
+        }
+    } else {
+        const auto timeline = probeFileEncodedTimelineStart(src.spec.uri);
+        if (timeline.has_value()) {
+            src.fileBaseTime = *timeline;
+        } else {
+            const auto created = probeFileEncodedStartTime(src.spec.uri);
+            if (created.has_value()) {
+                src.fileBaseTime = *created;
+            }
+        }
+    }
+}
+
+// Whether sampleFile() can follow the media timeline of a file: it needs a
+// frame rate, the frame times from the container, or a backend that reports
+// CAP_PROP_POS_MSEC; without any of them the position never advances. The
+// backend is only asked when the first two are missing, on the first frames,
+// after which the file is opened again.
+static bool hasMediaTimeline(SourceState& src)
+{
+    const double fps = src.cap.get(cv::CAP_PROP_FPS);
+    if ((std::isfinite(fps) && fps > 1e-6) || !src.framePts.empty()) {
+        return true;
+    }
+    // The first frame may report 0 either way; the second tells.
+    bool reported = false;
+    for (int i = 0; i < 2 && src.cap.grab(); ++i) {
+        const double posMsec = src.cap.get(cv::CAP_PROP_POS_MSEC);
+        reported = std::isfinite(posMsec) && posMsec >= 1e-3;
+    }
+    src.cap.release();
+    return openCapture(src.cap, src.spec.uri) && src.cap.isOpened() && reported;
+}
+
+// Inference scheduler shared by all sources.
+//
+// Each source owns a bounded FIFO of pending jobs whose overflow is handled
+// by the queue policy; with the default "latest" policy it is a single slot
+// where the newest job wins. Workers take jobs by visiting the sources
+// round-robin, so one busy camera cannot starve the others. The number of
+// workers calling next() is the global in-flight cap.
+//
+// Every job queued is counted in PipelineMetrics::triggers, so a
+// --clip-frames clip counts once. Jobs the policy discards are counted as
+// jobsOverwritten (pushed out by a newer job) and jobsExpired (deadline
+// passed). The block policy never waits here: the scheduling loop offers
+// each job with tryQueue() and holds it per source while the queue is full.
+class InferenceScheduler {
+public:
+    InferenceScheduler(size_t sourceCount, QueuePolicy policy, size_t depth, double deadlineSec,
+                       PipelineMetrics& metrics)
+        : queues_(sourceCount),
+          policy_(policy),
+          depth_(policy == QueuePolicy::Latest ? 1 : std::max<size_t>(1, depth)),
+          deadline_(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(deadlineSec))),
+          metrics_(metrics) {}
+
+    // Queue a job for its source according to the (non-block) policy.
+    void submit(PendingJob job)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            std::deque<Entry>& queue = queues_[job.sourceIdx];
+            const auto now = Clock::now();
+            if (policy_ == QueuePolicy::Deadline) {
+                dropExpired(queue, now);
+            }
+            while (queue.size() >= depth_) {
+                queue.pop_front();
+                metrics_.jobsOverwritten.add();
+            }
+            const auto expires = policy_ == QueuePolicy::Deadline ? now + deadline_ : Clock::time_point::max();
+            queue.push_back(Entry{std::move(job), expires});
+            metrics_.triggers.add();
+        }
+        cv_.notify_one();
+    }
+
+    // Queue the job if its source's queue has room, without waiting. The job
+    // is left untouched when it was not queued (block policy).
+    bool tryQueue(PendingJob& job)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            std::deque<Entry>& queue = queues_[job.sourceIdx];
+            if (stop_ || queue.size() >= depth_) {
+                return false;
+            }
+            queue.push_back(Entry{std::move(job), Clock::time_point::max()});
+            metrics_.triggers.add();
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    // Wait for room in the source's queue whatever the policy, then queue the
+    // job, which never expires. Used for offline sampling, where no sample
+    // may be dropped. Returns false if `running` was cleared or the scheduler
+    // stopped while waiting.
+    bool submitWhenFree(PendingJob job, const std::atomic<bool>& running)
+    {
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            std::deque<Entry>& queue = queues_[job.sourceIdx];
+            if (!waitForRoom(lk, queue, running)) {
+                return false;
+            }
+            queue.push_back(Entry{std::move(job), Clock::time_point::max()});
+            metrics_.triggers.add();
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    // True if a job of the source is waiting for a worker.
+    bool hasPending(size_t sourceIdx)
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return !queues_[sourceIdx].empty();
+    }
+
+    // Block until a job is available. Returns false once stop() was called.
+    bool next(PendingJob& out)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        while (!stop_) {
+            const auto now = Clock::now();
+            for (size_t n = 0; n < queues_.size(); ++n) {
+                const size_t i = (cursor_ + n) % queues_.size();
+                std::deque<Entry>& queue = queues_[i];
+                if (policy_ == QueuePolicy::Deadline) {
+                    dropExpired(queue, now);
+                }
+                if (queue.empty()) {
+                    continue;
+                }
+
+                out = std::move(queue.front().job);
+                queue.pop_front();
+                cursor_ = (i + 1) % queues_.size();
+                out.dispatchSeq = nextSeq_++;
+                roomFreed_.notify_all();
+                return true;
+            }
+            if (finishing_) {
+                break;
+            }
+            cv_.wait(lk);
+        }
+        return false;
+    }
+
+    // Wake all workers and make next() return false.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        roomFreed_.notify_all();
+    }
+
+    // Like stop(), but next() first hands out the jobs still pending.
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            finishing_ = true;
+        }
+        cv_.notify_all();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        PendingJob job;
+        Clock::time_point expires;
+    };
+
+    bool waitForRoom(std::unique_lock<std::mutex>& lk, std::deque<Entry>& queue,
+                     const std::atomic<bool>& running)
+    {
+        while (queue.size() >= depth_ && !stop_ && running.load()) {
+            roomFreed_.wait_for(lk, std::chrono::milliseconds(100));
+        }
+        return queue.size() < depth_ && !stop_;
+    }
+
+    // Jobs are queued in submission order, so expired ones are at the front.
+    void dropExpired(std::deque<Entry>& queue, Clock::time_point now)
+    {
+        bool dropped = false;
+        while (!queue.empty() && queue.front().expires <= now) {
+            queue.pop_front();
+            metrics_.jobsExpired.add();
+            dropped = true;
+        }
+        if (dropped) {
+            roomFreed_.notify_all();
+        }
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable roomFreed_;
+    std::vector<std::deque<Entry>> queues_;
+    QueuePolicy policy_;
+    size_t depth_;
+    Clock::duration deadline_;
+    PipelineMetrics& metrics_;
+    size_t cursor_ = 0;
+    uint64_t nextSeq_ = 0;
+    bool stop_ = false;
+    bool finishing_ = false;
+};
+
+// Result printer shared by the workers.
+//
+// With several workers a fast response can overtake a slow one. In ordered
+// mode results are held until all earlier dispatches have reported. Every job
+// handed out by the scheduler reports exactly once (an empty result marks a
+// failed request), so holding results back never stalls the output.
+//
+// Each result is a text line and/or a JSONL record. Both go to asynchronous
+// writers, so workers never block on stdout or the disk; the mutex only
+// guards the ordering bookkeeping.
+class ResultPrinter {
+public:
+    // `text` or `jsonl` may be null when that output is disabled.
+    ResultPrinter(bool ordered, AsyncLineWriter* text, AsyncLineWriter* jsonl)
+        : ordered_(ordered), text_(text), jsonl_(jsonl) {}
+
+    bool wantsRecords() const { return jsonl_ != nullptr; }
+
+    // Print a streamed partial line immediately, whatever the ordering mode.
+    void partial(std::string line)
+    {
+        if (text_ != nullptr) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            text_->push(std::move(line));
+        }
+    }
+
+    // Print a result immediately, outside the dispatch order: it was put in
+    // order elsewhere (SegmentMerger). Its dispatch still has to complete().
+    void write(std::string line, std::string record)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        emit(std::move(line), std::move(record));
+    }
+
+    void complete(uint64_t dispatchSeq, std::string line, std::string record = {})
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!ordered_) {
+            emit(std::move(line), std::move(record));
+            return;
+        }
+
+        held_.emplace(dispatchSeq, std::make_pair(std::move(line), std::move(record)));
+        while (!held_.empty() && held_.begin()->first == nextSeq_) {
+            auto& [heldLine, heldRecord] = held_.begin()->second;
+            emit(std::move(heldLine), std::move(heldRecord));
+            held_.erase(held_.begin());
+            ++nextSeq_;
+        }
+    }
+
+private:
+    void emit(std::string line, std::string record)
+    {
+        if (text_ != nullptr && !line.empty()) {
+            text_->push(std::move(line));
+        }
+        if (jsonl_ != nullptr && !record.empty()) {
+            jsonl_->push(std::move(record));
+        }
+    }
+
+    std::mutex mtx_;
+    std::map<uint64_t, std::pair<std::string, std::string>> held_;
+    uint64_t nextSeq_ = 0;
+    bool ordered_;
+    AsyncLineWriter* text_;
+    AsyncLineWriter* jsonl_;
+};
+
+// AIMD controller for the trigger interval of live sources
+// (--adaptive-interval).
+//
+// The scheduler makes overload visible: a job that is overwritten, expires or
+// goes stale before a worker takes it, or a submission that has to wait for
+// queue room, means triggers arrive faster than the model serves them. Each
+// control window, the trigger rate is cut multiplicatively if any such
+// overload event occurred, and otherwise raised by a tenth of the rate the
+// workers could sustain at the measured service time. The rate thus probes
+// up to the point where the model is just saturated and backs off as soon as
+// it is exceeded, following the model as its latency changes. A window spans
+// a few intervals, so each decision sees several triggers per source.
+class AdaptiveInterval {
+public:
+    AdaptiveInterval(double initialSec, double minSec, double maxSec, size_t workers)
+        : intervalSec_(std::clamp(initialSec, minSec, maxSec)),
+          minSec_(minSec),
+          maxSec_(maxSec),
+          workers_(workers) {}
+
+    // Time a worker spent on one job (request, cache hit or failure).
+    void recordServiceTime(double sec)
+    {
+        serviceUsSum_.fetch_add(static_cast<uint64_t>(sec * 1e6), std::memory_order_relaxed);
+        serviceCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Main loop only. Returns true when the interval changed.
+    bool update(double nowSec, uint64_t overloadTotal, size_t liveSources)
+    {
+        if (nowSec - windowStartSec_ < std::max(1.0, 3.0 * intervalSec_)) {
+            return false;
+        }
+        windowStartSec_ = nowSec;
+
+        const uint64_t overload = overloadTotal - lastOverload_;
+        lastOverload_ = overloadTotal;
+        lastOverloadInWindow_ = overload;
+
+        const uint64_t count = serviceCount_.exchange(0, std::memory_order_relaxed);
+        const uint64_t sumUs = serviceUsSum_.exchange(0, std::memory_order_relaxed);
+        if (count > 0) {
+            const double mean = static_cast<double>(sumUs) * 1e-6 / static_cast<double>(count);
+            serviceSec_ = serviceSec_ > 0.0 ? 0.7 * serviceSec_ + 0.3 * mean : mean;
+        }
+
+        const double before = intervalSec_;
+        if (overload > 0) {
+            intervalSec_ *= kBackoff;
+        } else if (serviceSec_ > 0.0 && liveSources > 0) {
+            const double sustainableRate =
+                static_cast<double>(workers_) / serviceSec_ / static_cast<double>(liveSources);
+            intervalSec_ = 1.0 / (1.0 / intervalSec_ + kProbeFraction * sustainableRate);
+        }
+        intervalSec_ = std::clamp(intervalSec_, minSec_, maxSec_);
+        return intervalSec_ != before;
+    }
+
+    double intervalSec() const { return intervalSec_; }
+    double serviceSec() const { return serviceSec_; }
+    uint64_t lastOverload() const { return lastOverloadInWindow_; }
+
+private:
+    static constexpr double kBackoff = 1.5;
+    static constexpr double kProbeFraction = 0.1;
+
+    std::atomic<uint64_t> serviceUsSum_{0};
+    std::atomic<uint64_t> serviceCount_{0};
+
+    double intervalSec_;
+    double minSec_;
+    double maxSec_;
+    size_t workers_;
+    double serviceSec_ = 0.0;   // smoothed mean service time
+    double windowStartSec_ = 0.0;
+    uint64_t lastOverload_ = 0;
+    uint64_t lastOverloadInWindow_ = 0;
+};
+
+// Per-source choice of resize and JPEG quality under a payload and/or a
+// latency budget (--payload-budget, --latency-budget).
+//
+// The JPEG size is modelled as pixels x bytes per pixel at quality 85 x the
+// typical libjpeg size at the chosen quality relative to 85. Bytes per pixel
+// depend mostly on the scene, so they are learnt from this source's previous
+// encodes. To fit the budget, quality is lowered first, but not below 70,
+// where vision models lose little detail; then the image is shrunk, down to
+// --min-dim; only then is quality lowered further, to --min-jpeg-quality.
+//
+// A latency budget scales the byte budget with the observed round trip: it
+// shrinks below the last payload when a request took longer than the budget
+// and grows back by 10% per request while there is at least 30% headroom,
+// never past --payload-budget.
+class PayloadBudget {
+public:
+    explicit PayloadBudget(const ProgramOptions& options)
+        : payloadBudgetBytes_(options.payloadBudgetKiB > 0.0
+                                  ? options.payloadBudgetKiB * 1024.0
+                                  : std::numeric_limits<double>::infinity()),
+          budgetBytes_(payloadBudgetBytes_),
+          latencyBudgetSec_(options.latencyBudgetSec),
+          maxDim_(options.maxDim),
+          maxQuality_(options.jpegQuality),
+          minDim_(options.minDim),
+          minQuality_(std::min(options.minJpegQuality, options.jpegQuality)),
+          sideMultiple_(options.dimMultiple)
+    {
+        if (options.modelInputDim > 0) {
+            maxDim_ = maxDim_ > 0 ? std::min(maxDim_, options.modelInputDim) : options.modelInputDim;
+        }
+    }
+
+    ImageEncoding choose(int frameWidth, int frameHeight)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        const int longSide = std::max(frameWidth, frameHeight);
+        const int cap = maxDim_ > 0 ? std::min(maxDim_, longSide) : longSide;
+        const double aspect = longSide > 0
+                                  ? static_cast<double>(std::min(frameWidth, frameHeight)) / longSide
+                                  : 1.0;
+        ImageEncoding encoding{cap, maxQuality_, sideMultiple_};
+        if (bytesPerPixel85_ <= 0.0 || !std::isfinite(budgetBytes_)) {
+            return encoding;
+        }
+
+        // Relative JPEG size (vs. quality 85) that fits the budget at `dim`.
+        const auto fittingSize = [&](int dim) {
+            return budgetBytes_ / (static_cast<double>(dim) * dim * aspect * bytesPerPixel85_);
+        };
+
+        if (relativeJpegSize(maxQuality_) <= fittingSize(cap)) {
+            return encoding;
+        }
+
+        const int preferredMinQuality = std::max(minQuality_, std::min(maxQuality_, kPreferredMinQuality));
+        encoding.jpegQuality = highestQualityWithin(fittingSize(cap), preferredMinQuality, maxQuality_);
+        if (encoding.jpegQuality > 0) {
+            return encoding;
+        }
+
+        const int floorDim = std::min(minDim_, cap);
+        const int dim = static_cast<int>(std::sqrt(
+            budgetBytes_ / (aspect * bytesPerPixel85_ * relativeJpegSize(preferredMinQuality))));
+        if (dim >= floorDim) {
+            encoding.maxDim = dim;
+            encoding.jpegQuality = preferredMinQuality;
+            return encoding;
+        }
+
+        encoding.maxDim = floorDim;
+        encoding.jpegQuality = highestQualityWithin(fittingSize(floorDim), minQuality_, preferredMinQuality);
+        if (encoding.jpegQuality <= 0) {
+            encoding.jpegQuality = minQuality_;   // best effort: over budget at the floor
+        }
+        return encoding;
+    }
+
+    // Feedback from one request: the encode actually produced, and the HTTP
+    // round trip (negative if the request failed, which says nothing about
+    // how the payload size affects latency).
+    void observe(int jpegQuality, size_t jpegBytes, int width, int height, double httpSec)
+    {
+        if (jpegBytes == 0 || width <= 0 || height <= 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        const double sample = static_cast<double>(jpegBytes) /
+                              (static_cast<double>(width) * height * relativeJpegSize(jpegQuality));
+        bytesPerPixel85_ = bytesPerPixel85_ > 0.0 ? 0.7 * bytesPerPixel85_ + 0.3 * sample : sample;
+
+        if (latencyBudgetSec_ <= 0.0 || httpSec < 0.0) {
+            return;
+        }
+        if (httpSec > latencyBudgetSec_) {
+            budgetBytes_ = std::min(budgetBytes_, static_cast<double>(jpegBytes)) * kShrink;
+        } else if (httpSec < kHeadroom * latencyBudgetSec_) {
+            budgetBytes_ = std::min(budgetBytes_ * kGrow, payloadBudgetBytes_);
+        }
+        budgetBytes_ = std::max(budgetBytes_, kMinBudgetBytes);
+    }
+
+    // Current byte budget (infinite when unconstrained).
+    double budgetBytes()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return budgetBytes_;
+    }
+
+private:
+    static constexpr int kPreferredMinQuality = 70;
+    static constexpr double kShrink = 0.85;
+    static constexpr double kGrow = 1.1;
+    static constexpr double kHeadroom = 0.7;
+    static constexpr double kMinBudgetBytes = 4.0 * 1024.0;
+
+    // Typical libjpeg output size relative to quality 85 (4:2:0, natural
+    // images), interpolated linearly between the tabulated qualities.
+    static double relativeJpegSize(int quality)
+    {
+        static constexpr std::pair<int, double> kTable[] = {
+            {10, 0.25}, {20, 0.36}, {30, 0.42}, {40, 0.50}, {50, 0.57}, {60, 0.65},
+            {70, 0.76}, {80, 0.90}, {85, 1.00}, {90, 1.22}, {95, 1.65}, {100, 3.00},
+        };
+        if (quality <= kTable[0].first) {
+            return kTable[0].second;
+        }
+        for (size_t i = 1; i < std::size(kTable); ++i) {
+            if (quality <= kTable[i].first) {
+                const auto& [q0, s0] = kTable[i - 1];
+                const auto& [q1, s1] = kTable[i];
+                return s0 + (s1 - s0) * (quality - q0) / (q1 - q0);
+            }
+        }
+        return kTable[std::size(kTable) - 1].second;
+    }
+
+    // Highest quality in [lo, hi] whose relative size is within `size`, or 0.
+    static int highestQualityWithin(double size, int lo, int hi)
+    {
+        for (int q = hi; q >= lo; --q) {
+            if (relativeJpegSize(q) <= size) {
+                return q;
+            }
+        }
+        return 0;
+    }
+
+    std::mutex mtx_;
+    double payloadBudgetBytes_;   // --payload-budget; infinite if unset
+    double budgetBytes_;          // current budget, lowered by the latency budget
+    double latencyBudgetSec_;
+    int maxDim_;
+    int maxQuality_;
+    int minDim_;
+    int minQuality_;
+    int sideMultiple_;
+    double bytesPerPixel85_ = 0.0;   // smoothed; 0 until the first encode
+};
+
+// Capture loop for one source.
+//
+// Responsibilities:
+// - continuously read frames from OpenCV
+// - keep only the latest frame
+// - for files, pace playback approximately in real time
+// - for streams, attempt reconnects on transient failures
+//
+// Notes:
+// - For media files, the timeline is the frame times probed from the
+//   container (src.framePts), indexed by the number of frames grabbed.
+// - Otherwise we prefer CAP_PROP_POS_MSEC, and if that is unavailable we
+//   fall back to FPS-derived progression.
+// - With --decode-on-demand every frame is still grabbed, so the stream stays
+//   drained and the next decoded frame is current, but only frames that are
+//   asked for (src.wantFrame) are retrieved. What that saves depends on the
+//   backend: FFmpeg decodes in grab() and skips the YUV->BGR conversion and
+//   copy, V4L2 MJPEG cameras skip the JPEG decode altogether. The GUI preview
+//   and motion gate poll continuously, so they get a decoded frame every
+//   kOnDemandRefreshSec instead.
+static void captureLoop(
+    SourceState& src,
+    const ProgramOptions& options,
+    PipelineMetrics& metrics,
+    const std::atomic<bool>& running)
+{
+    constexpr double kOnDemandRefreshSec = 0.1;
+
+    cv::VideoCapture& cap = src.cap;
+    FramePool pool;
+    uint64_t seq = 0;
+    auto lastOk = std::chrono::steady_clock::now();
+    auto lastDecode = std::chrono::steady_clock::time_point{};
+    const bool periodicDecode = options.guiEnabled || options.motionGate;
+
+    const double fps = cap.get(cv::CAP_PROP_FPS);
+    const bool hasValidFps = std::isfinite(fps) && fps > 1e-6;
+    const double frameDuration = hasValidFps ? (1.0 / fps) : 0.0;
+
+    const auto playbackStart = std::chrono::steady_clock::now();
+    double fallbackPosSec = 0.0;
+    size_t framesGrabbed = 0;
+    int reconnectAttempt = 0;
+
+    while (running.load()) {
+        // read() split into grab() + retrieve(), which is what it does
+        // internally, so both halves can be timed.
+        std::shared_ptr<Frame> frame;
+        Stopwatch stopwatch;
+        bool ok = cap.grab();
+        metrics.grab.record(stopwatch.lap());
+        const auto grabbedAt = std::chrono::steady_clock::now();
+        if (ok) {
+            ++framesGrabbed;
+            const auto now = grabbedAt;
+            bool decode = true;
+            if (options.decodeOnDemand) {
+                const bool requested = src.wantFrame.exchange(false);
+                decode = requested ||
+                         (periodicDecode &&
+                          std::chrono::duration<double>(now - lastDecode).count() >=
+                              kOnDemandRefreshSec);
+            }
+            if (decode) {
+                frame = pool.acquire();
+                stopwatch.lap();
+                ok = cap.retrieve(frame->image) && !frame->image.empty();
+                metrics.retrieve.record(stopwatch.lap());
+                lastDecode = now;
+            }
+        }
+
+        if (ok) {
+            reconnectAttempt = 0;
+            lastOk = std::chrono::steady_clock::now();
+
+            double mediaPosSec = fallbackPosSec;
+
+            if (src.likelyFile) {
+                if (framesGrabbed <= src.framePts.size()) {
+                    mediaPosSec = src.framePts[framesGrabbed - 1];
+                    fallbackPosSec = mediaPosSec;
+                } else {
+                    const double posMsec = cap.get(cv::CAP_PROP_POS_MSEC);
+
+                    if (std::isfinite(posMsec) && posMsec >= 1e-3) {
+                        mediaPosSec = posMsec / 1000.0;
+                        fallbackPosSec = mediaPosSec;
+                    } else if (hasValidFps) {
+                        fallbackPosSec += frameDuration;
+                        mediaPosSec = fallbackPosSec;
+                    }
+                }
+
+                // Throttle file reading to approximately real-time playback
+                // based on media position, not on loop speed.
+                if (mediaPosSec > 0.0) {
+                    const auto targetTime =
+                        playbackStart + std::chrono::duration<double>(mediaPosSec);
+                    const auto now = std::chrono::steady_clock::now();
+                    if (targetTime > now) {
+                        std::this_thread::sleep_for(targetTime - now);
+                    }
+                }
+            } else {
+                // For streams/cameras, media position is less meaningful.
+                // Use POS_MSEC only if the backend provides something sane.
+                const double posMsec = cap.get(cv::CAP_PROP_POS_MSEC);
+                if (std::isfinite(posMsec) && posMsec >= 0.0) {
+                    mediaPosSec = posMsec / 1000.0;
+                } else {
+                    mediaPosSec = 0.0;
+                }
+            }
+
+            if (frame) {
+                frame->mediaPosSec = mediaPosSec;
+                frame->seq = ++seq;
+                frame->capturedAt = grabbedAt;
+                src.publish(std::move(frame));
+                metrics.framesCaptured.add();
+            }
+            continue;
+        }
+
+        // For files, EOF/failure is expected termination.
+        if (src.likelyFile) {
+            break;
+        }
+
+        // For streams/cameras, treat failures as transient up to a limit.
+        const auto now = std::chrono::steady_clock::now();
+        const double downFor =
+            std::chrono::duration<double>(now - lastOk).count();
+
+        if (options.reconnectSec <= 0 ||
+            downFor > static_cast<double>(options.reconnectSec)) {
+            std::cerr << "[ERROR] Stream " << src.spec.label << " read failed for >"
+                      << options.reconnectSec << "s; stopping.\n";
+            break;
+        }
+
+        // Bounded exponential backoff:
+        // 250, 500, 1000, 2000, 2000, ...
+        ++reconnectAttempt;
+        metrics.reconnects.add();
+        const int backoffMs =
+            std::min(2000, 250 * (1 << std::min(reconnectAttempt - 1, 3)));
+
+        std::cerr << "[WARN] Stream " << src.spec.label
+                  << " read failed; attempting reconnect in "
+                  << backoffMs << " ms...\n";
+
+        cap.release();
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+
+        if (!running.load()) {
+            break;
+        }
+
+        if (!openCapture(cap, src.spec.uri) || !cap.isOpened()) {
+            continue;
+        }
+
+        cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+        lastOk = std::chrono::steady_clock::now();
+    }
+
+    src.active.store(false);
+}
+
+// Offline sampling loop for one media file (--offline).
+//
+// Instead of decoding every frame at 1x speed and letting the main loop pick
+// the latest one, this visits the sample times 0, interval, 2*interval, ...
+// of the media timeline directly and submits every sample, waiting for its
+// source slot to be free. Throughput is then bounded by inference alone.
+//
+// Far-away samples are reached by seeking, which decodes from the preceding
+// keyframe; nearby ones by grab(), which demuxes and decodes but skips the
+// colour conversion that retrieve() does for the sampled frame only.
+// Frame times come from the container (src.framePts) when it was probed.
+// Seeking needs a backend that reports CAP_PROP_POS_MSEC, which is also used
+// to find our place in src.framePts again after a seek; without it the
+// timeline is derived from the frame rate and every frame is grabbed.
+//
+// `range` selects the samples first <= k < end: the times k * interval, with
+// trigger index k, or with --keyframes the entries of `plan`. A seek lands
+// on the keyframe before its target and every grab() decodes, so with the
+// keyframe index at hand a seek is only made when it skips a whole GOP;
+// otherwise the frames up to the target are grabbed. With --clip-frames, samples are grouped
+// into jobs that never span ranges. Every submitted job is counted in
+// src.jobStarted() (and in the merger, if any). Returns true if the end of
+// the range or of the file was reached, false if interrupted.
+struct SampleRange {
+    int first = 0;
+    int end = std::numeric_limits<int>::max();
+    size_t segment = 0;
+};
+
+// A sample time chosen ahead of decoding (--keyframes).
+struct PlannedSample {
+    double timeSec = 0.0;
+    int triggerIdx = 0;
+};
+
+static bool sampleFile(
+    SourceState& src,
+    cv::VideoCapture& cap,
+    const SampleRange& range,
+    const std::vector<PlannedSample>* plan,
+    const ProgramOptions& options,
+    InferenceScheduler& scheduler,
+    PipelineMetrics& metrics,
+    std::chrono::steady_clock::time_point t0,
+    const std::atomic<bool>& running)
+{
+    // Below this gap, grabbing forward is cheaper than a seek, which has to
+    // decode from the previous keyframe anyway.
+    constexpr double kSeekMinGapSec = 3.0;
+
+    FramePool pool;
+    // Segments publish concurrently to one source; disjoint seq ranges keep
+    // the GUI's "new frame" check working.
+    uint64_t seq = static_cast<uint64_t>(range.segment) << 40;
+
+    const double fps = cap.get(cv::CAP_PROP_FPS);
+    const double frameDuration = (std::isfinite(fps) && fps > 1e-6) ? (1.0 / fps) : 0.0;
+
+    double posSec = -1.0;           // media time of the last grabbed frame
+    bool backendTimeline = true;    // CAP_PROP_POS_MSEC usable (required to seek)
+
+    const std::vector<double>& pts = src.framePts;
+    size_t frameIdx = 0;            // index in `pts` of the next grabbed frame
+    bool usePts = !pts.empty();
+    bool seeked = false;            // frameIdx unknown until POS_MSEC relocates it
+
+    auto grabNext = [&]() {
+        if (!cap.grab()) {
+            return false;
+        }
+        if (usePts && !seeked && frameIdx < pts.size()) {
+            posSec = pts[frameIdx++];
+            return true;
+        }
+        const double posMsec = cap.get(cv::CAP_PROP_POS_MSEC);
+        if (backendTimeline && std::isfinite(posMsec) && (posMsec >= 1e-3 || posSec < 0.0)) {
+            posSec = std::max(0.0, posMsec / 1000.0);
+            if (usePts && seeked) {
+                // Snap to the nearest listed frame and carry on from there.
+                auto it = std::lower_bound(pts.begin(), pts.end(), posSec);
+                if (it == pts.end() || (it != pts.begin() && posSec - *(it - 1) < *it - posSec)) {
+                    --it;
+                }
+                frameIdx = static_cast<size_t>(it - pts.begin());
+                posSec = pts[frameIdx++];
+                seeked = false;
+            }
+        } else {
+            usePts = usePts && !seeked;
+            backendTimeline = false;
+            posSec = posSec < 0.0 ? 0.0 : posSec + frameDuration;
+        }
+        return true;
+    };
+
+    const int end = plan ? std::min(range.end, static_cast<int>(plan->size())) : range.end;
+    auto sampleTime = [&](int k) { return plan ? (*plan)[k].timeSec : k * options.intervalSec; };
+
+    // Whether seeking to `t` decodes less than grabbing forward to it. A seek
+    // decodes from the keyframe before `t` (the backend seeks slightly ahead
+    // of the target), so with the keyframe index it pays off once another
+    // keyframe lies between the current position and `t`.
+    const std::vector<double>& keyframes = src.keyframePts;
+    auto worthSeeking = [&](double t) {
+        if (!plan) {
+            return t - std::max(posSec, 0.0) > kSeekMinGapSec;
+        }
+        const auto next = std::lower_bound(keyframes.begin(), keyframes.end(), t - 0.5 * frameDuration);
+        return next != keyframes.begin() && *(next - 1) > posSec + 0.5 * frameDuration;
+    };
+
+    // Move to the first frame at (or within half a frame of) time `t`.
+    auto grabAt = [&](double t) {
+        if (backendTimeline && worthSeeking(t)) {
+            seeked = cap.set(cv::CAP_PROP_POS_MSEC, t * 1000.0);
+        }
+        bool ok = grabNext();
+        while (ok && posSec < t - 0.5 * frameDuration) {
+            ok = grabNext();
+        }
+        return ok;
+    };
+
+    // Decode the grabbed frame; null if that fails.
+    auto retrieveFrame = [&]() -> FrameRef {
+        const auto grabbedAt = std::chrono::steady_clock::now();
+        std::shared_ptr<Frame> frame = pool.acquire();
+        Stopwatch stopwatch;
+        if (!cap.retrieve(frame->image) || frame->image.empty()) {
+            return nullptr;
+        }
+        metrics.retrieve.record(stopwatch.lap());
+        metrics.framesCaptured.add();
+        frame->mediaPosSec = posSec;
+        frame->seq = ++seq;
+        frame->capturedAt = grabbedAt;
+        return frame;
+    };
+
+    // Frames of the next job, oldest first: with --clip-stride a sample and
+    // the frames leading up to it, otherwise up to --clip-frames samples.
+    std::vector<FrameRef> clip;
+    int clipTriggerIdx = 0;
+    auto submitClip = [&]() {
+        PendingJob job;
+        job.sourceIdx = src.index;
+        job.wallTimeSec = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count();
+        job.frame = std::move(clip.back());
+        clip.pop_back();
+        job.mediaPosSec = job.frame->mediaPosSec;
+        job.context = std::move(clip);
+        clip.clear();
+        job.triggerIdx = clipTriggerIdx;
+        job.segment = range.segment;
+        src.jobStarted();
+        if (src.merger) {
+            src.merger->jobStarted(range.segment);
+        }
+        if (!scheduler.submitWhenFree(std::move(job), running)) {
+            if (src.merger) {
+                src.merger->jobFinished(range.segment);
+            }
+            src.jobFinished();
+            return false;
+        }
+        return true;
+    };
+
+    const int contextFrames = options.clipStrideSec > 0.0 ? options.clipFrames - 1 : 0;
+    int samples = 0;
+    int k = range.first;
+    double target = k < end ? sampleTime(k) : 0.0;
+    bool reachedEnd = false;
+
+    // A later segment starts where the previous one left off: at the frame
+    // of the grid point before its first sample. Below 1/interval fps that
+    // frame may also be the one for the first sample times, which the
+    // previous segment has already sent. Keyframe plans list distinct frames.
+    if (!plan && k > 0 && k < end) {
+        if (!grabAt(sampleTime(k - 1))) {
+            reachedEnd = true;
+        }
+        while (k < end && (target = sampleTime(k)) - 0.5 * frameDuration <= posSec) {
+            ++k;
+        }
+    }
+
+    while (running.load() && !reachedEnd) {
+        if (k >= end) {
+            reachedEnd = true;
+            break;
+        }
+
+        // With --clip-stride the frames before the sample come first; times
+        // already passed are left out rather than sought back to.
+        const size_t clipStart = clip.size();
+        bool ok = true;
+        for (int j = contextFrames; ok && j >= 0; --j) {
+            const double t = target - j * options.clipStrideSec;
+            if (j > 0 && (t < 0.0 || t <= posSec)) {
+                continue;
+            }
+            if (!grabAt(t)) {
+                reachedEnd = true;
+                ok = false;
+            } else if (FrameRef frame = retrieveFrame()) {
+                clip.push_back(std::move(frame));
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            clip.resize(clipStart);
+            break;
+        }
+        src.publish(clip.back());   // GUI preview
+        clipTriggerIdx = plan ? (*plan)[k].triggerIdx : k;
+        ++samples;
+
+        if ((contextFrames > 0 || clip.size() >= static_cast<size_t>(options.clipFrames)) &&
+            !submitClip()) {
+            break;
+        }
+
+        // Skip sample times the file has no separate frame for (frame rate
+        // below 1/interval): grabAt() would land on the frame just sent. So
+        // every sample time maps to the same frame however the file is split.
+        do {
+            ++k;
+        } while (k < end && (target = sampleTime(k)) - 0.5 * frameDuration <= posSec);
+    }
+
+    // The last, incomplete clip of the range.
+    if (reachedEnd && !clip.empty()) {
+        submitClip();
+    }
+
+    std::cerr << "[INFO] Source " << src.spec.label;
+    if (src.merger) {
+        std::cerr << " segment " << range.segment;
+    }
+    std::cerr << ": " << samples << " samples up to media-time " << std::fixed
+              << std::setprecision(3) << std::max(0.0, posSec) << "s\n";
+    return reachedEnd;
+}
+
+// Sample times for --keyframes: every keyframe, numbered in order, or for
+// each sample time k * interval the nearest keyframe, with trigger index k.
+// Sample times without a keyframe within half an interval are left out.
+static std::vector<PlannedSample> planKeyframeSamples(
+    const std::vector<double>& keyframes,
+    const ProgramOptions& options)
+{
+    std::vector<PlannedSample> plan;
+    for (const double t : keyframes) {
+        if (options.keyframes == KeyframeSampling::All) {
+            plan.push_back({t, static_cast<int>(plan.size())});
+            continue;
+        }
+        const int k = static_cast<int>(std::llround(t / options.intervalSec));
+        const double offset = std::abs(t - k * options.intervalSec);
+        if (!plan.empty() && plan.back().triggerIdx == k) {
+            if (offset < std::abs(plan.back().timeSec - k * options.intervalSec)) {
+                plan.back().timeSec = t;
+            }
+        } else {
+            plan.push_back({t, k});
+        }
+    }
+    return plan;
+}
+
+// Sample a file for --offline/--batch, split into up to --segments time
+// segments when it is long enough.
+//
+// Segment 0 is read through src.cap on the calling thread, the others each
+// through their own VideoCapture on their own thread, after seeking to their
+// first sample; decoding a long file then uses as many cores as segments.
+// Segment boundaries lie on the sample grid, and each segment first moves to
+// the frame of the grid point before its range, so it skips the sample times
+// that the previous segment's last frame already covers. The samples are then
+// those of an unsplit run. With --keyframes the segments split the keyframe
+// plan instead. Results pass through a SegmentMerger into
+// `printer` (and the batch file's results) in media order. Returns once all
+// jobs of the file are finished, true if it was sampled to the end.
+static bool sampleFileSegments(
+    SourceState& src,
+    const ProgramOptions& options,
+    InferenceScheduler& scheduler,
+    ResultPrinter& printer,
+    PipelineMetrics& metrics,
+    std::chrono::steady_clock::time_point t0,
+    const std::atomic<bool>& running)
+{
+    // Shorter segments would spend more time seeking than decoding.
+    constexpr double kMinSegmentSec = 60.0;
+
+    double durationSec = src.framePts.empty() ? 0.0 : src.framePts.back();
+    if (durationSec <= 0.0) {
+        const double fps = src.cap.get(cv::CAP_PROP_FPS);
+        const double frameCount = src.cap.get(cv::CAP_PROP_FRAME_COUNT);
+        if (std::isfinite(fps) && fps > 1e-6 && std::isfinite(frameCount) && frameCount > 0.0) {
+            durationSec = frameCount / fps;
+        }
+    }
+    const double maxSegments = std::floor(durationSec / std::max(kMinSegmentSec, options.intervalSec));
+    const size_t segments = static_cast<size_t>(std::clamp(maxSegments, 1.0, static_cast<double>(options.segments)));
+
+    std::vector<PlannedSample> plan;
+    if (options.keyframes != KeyframeSampling::Off) {
+        if (src.keyframePts.empty()) {
+            std::cerr << "[WARN] Source " << src.spec.label
+                      << ": no keyframe index for this container; sampling every --interval\n";
+        } else {
+            plan = planKeyframeSamples(src.keyframePts, options);
+            std::cerr << "[INFO] Source " << src.spec.label << ": " << plan.size() << " of "
+                      << src.keyframePts.size() << " keyframes to sample\n";
+        }
+    }
+    const std::vector<PlannedSample>* planned = plan.empty() ? nullptr : &plan;
+
+    // Readers for segments 1..n-1. If one cannot be opened, the file is read
+    // in one pass instead.
+    std::vector<cv::VideoCapture> caps(segments - 1);
+    for (auto& cap : caps) {
+        if (!openCapture(cap, src.spec.uri) || !cap.isOpened()) {
+            std::cerr << "[WARN] Source " << src.spec.label
+                      << ": cannot open another reader; decoding in one segment\n";
+            caps.clear();
+            break;
+        }
+    }
+    if (caps.empty()) {
+        return sampleFile(src, src.cap, SampleRange{}, planned, options, scheduler, metrics, t0, running) &&
+               src.waitForJobs(running);
+    }
+
+    // Segment s holds the samples [first_s, first_{s+1}).
+    const double samplesTotal = planned ? static_cast<double>(plan.size()) : durationSec / options.intervalSec;
+    std::vector<SampleRange> ranges(segments);
+    for (size_t s = 0; s < segments; ++s) {
+        ranges[s].first = static_cast<int>(std::floor(samplesTotal * s / segments));
+        ranges[s].segment = s;
+        if (s > 0) {
+            ranges[s - 1].end = ranges[s].first;
+        }
+    }
+
+    src.merger = std::make_unique<SegmentMerger>(segments, [&src, &printer](std::string line, std::string record) {
+        if (src.results) {
+            src.results->push(record);
+        }
+        printer.write(std::move(line), std::move(record));
+    });
+
+    std::vector<char> complete(segments, 0);
+    std::vector<std::thread> threads;
+    ThreadJoiner joiner(threads);
+    for (size_t s = 1; s < segments; ++s) {
+        threads.emplace_back([&, s] {
+            complete[s] = sampleFile(src, caps[s - 1], ranges[s], planned, options, scheduler, metrics, t0, running);
+            src.merger->samplingDone(s);
+        });
+    }
+    complete[0] = sampleFile(src, src.cap, ranges[0], planned, options, scheduler, metrics, t0, running);
+    src.merger->samplingDone(0);
+    joiner.join();
+    caps.clear();
+
+    if (!src.waitForJobs(running)) {
+        src.merger->releaseAll();
+        return false;   // interrupted; workers may still use the merger
+    }
+    src.merger.reset();
+    return std::all_of(complete.begin(), complete.end(), [](char c) { return c != 0; });
+}
+
+static void fileSampleLoop(
+    SourceState& src,
+    const ProgramOptions& options,
+    InferenceScheduler& scheduler,
+    ResultPrinter& printer,
+    PipelineMetrics& metrics,
+    std::chrono::steady_clock::time_point t0,
+    const std::atomic<bool>& running)
+{
+    sampleFileSegments(src, options, scheduler, printer, metrics, t0, running);
+    src.active.store(false);
+}
+
+//------------------------------------------------------------------------------
+// Batch ingestion
+//------------------------------------------------------------------------------
+
+// One recording of a --batch run.
+struct BatchFile {
+    std::string path;
+    std::string label;   // path relative to the batch directory or manifest
+};
+
+// Extensions picked up when --batch names a directory.
+static bool isMediaFileName(const std::filesystem::path& path)
+{
+    static const char* const kExtensions[] = {
+        ".mp4", ".m4v", ".mov", ".3gp", ".mkv", ".webm", ".avi", ".ts",
+        ".mts", ".m2ts", ".mpg", ".mpeg", ".wmv", ".flv",
+    };
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return std::find(std::begin(kExtensions), std::end(kExtensions), ext) != std::end(kExtensions);
+}
+
+// Expand --batch into its files, sorted by label. A directory is searched
+// recursively for media files. Anything else is read as a manifest with one
+// path per line; blank lines and '#' comments are skipped and relative paths
+// are relative to the manifest.
+static bool collectBatchFiles(const std::string& input, std::vector<BatchFile>& files)
+{
+    namespace fs = std::filesystem;
+    const fs::path root(input);
+    std::error_code ec;
+    if (fs::is_directory(root, ec)) {
+        fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+        for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            std::error_code typeEc;
+            if (it->is_regular_file(typeEc) && isMediaFileName(it->path())) {
+                files.push_back({it->path().string(), it->path().lexically_relative(root).generic_string()});
+            }
+        }
+        if (ec) {
+            std::cerr << "[ERROR] Cannot list batch directory " << input << ": " << ec.message() << "\n";
+            return false;
+        }
+    } else {
+        std::ifstream in(input);
+        if (!in) {
+            std::cerr << "[ERROR] Cannot read batch directory or manifest " << input << "\n";
+            return false;
+        }
+        const fs::path base = root.parent_path();
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!trimInPlace(line) || line[0] == '#') {
+                continue;
+            }
+            const fs::path entry(line);
+            const fs::path path = (entry.is_relative() ? base / entry : entry).lexically_normal();
+
+            // Labels name output files below --batch-output, so they must
+            // stay inside it and still tell different directories apart.
+            fs::path label = entry.is_relative() ? entry.lexically_normal() : entry.lexically_relative(base);
+            if (label.empty() || *label.begin() == "..") {
+                label.clear();
+                for (const fs::path& part : path.relative_path()) {
+                    if (part != ".." || !label.empty()) {
+                        label /= part;
+                    }
+                }
+            }
+            files.push_back({path.string(), label.generic_string()});
+        }
+    }
+
+    std::sort(files.begin(), files.end(),
+              [](const BatchFile& a, const BatchFile& b) { return a.label < b.label; });
+    files.erase(std::unique(files.begin(), files.end(),
+                            [](const BatchFile& a, const BatchFile& b) { return a.label == b.label; }),
+                files.end());
+    return true;
+}
+
+// Files finished by this and earlier runs of a batch (--checkpoint), one
+// label per line. Each line is flushed once the file's results are written,
+// so after a crash only the files that were being decoded start over.
+class BatchCheckpoint {
+public:
+    ~BatchCheckpoint()
+    {
+        if (file_ != nullptr) {
+            std::fclose(file_);
+        }
+    }
+
+    bool open(const std::string& path, std::string& error)
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (trimInPlace(line)) {
+                done_.insert(line);
+            }
+        }
+        std::error_code ec;
+        const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        if (!parent.empty()) {
+            std::filesystem::create_directories(parent, ec);
+        }
+        file_ = std::fopen(path.c_str(), "a");
+        if (file_ == nullptr) {
+            error = "cannot open " + path + " for writing";
+            return false;
+        }
+        return true;
+    }
+
+    bool contains(const std::string& label) const { return done_.count(label) > 0; }
+
+    void record(const std::string& label)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::fprintf(file_, "%s\n", label.c_str());
+        std::fflush(file_);
+    }
+
+private:
+    std::set<std::string> done_;   // read at open(), then immutable
+    std::mutex mtx_;
+    std::FILE* file_ = nullptr;
+};
+
+// Decoder thread of --batch.
+//
+// Takes the next file from `files`, samples it into its slot as --offline
+// does, waits until the workers are done with its last job, then closes the
+// file's results and records it in the checkpoint. Slots share the
+// scheduler, so all decoders feed one queue bounded by --inflight workers.
+// A file counts as done only if it was read to the end with no failed
+// request and, with --batch-output, every result reached its file;
+// otherwise it is retried by the next run.
+static void batchDecodeLoop(
+    SourceState& slot,
+    const std::vector<BatchFile>& files,
+    std::atomic<size_t>& nextFile,
+    BatchCheckpoint* checkpoint,
+    const ProgramOptions& options,
+    InferenceScheduler& scheduler,
+    ResultPrinter& printer,
+    PipelineMetrics& metrics,
+    std::chrono::steady_clock::time_point t0,
+    std::chrono::system_clock::time_point applicationStartTime,
+    const std::atomic<bool>& running)
+{
+    namespace fs = std::filesystem;
+
+    for (size_t i = nextFile++; i < files.size() && running.load(); i = nextFile++) {
+        const BatchFile& file = files[i];
+
+        // The slot is idle here: no job of the previous file is left.
+        slot.spec = {file.label, file.path};
+        slot.jobsFailed.store(0);
+
+        const double frameCount =
+            openCapture(slot.cap, file.path) && slot.cap.isOpened() ? slot.cap.get(cv::CAP_PROP_FRAME_COUNT) : 0.0;
+        if (!std::isfinite(frameCount) || frameCount <= 0.0) {
+            std::cerr << "[WARN] Batch: cannot read " << file.path << " as a media file; skipped\n";
+            slot.cap.release();
+            metrics.batchFilesFailed.add();
+            continue;
+        }
+        resolveFileBaseTime(slot, options, applicationStartTime);
+        if (!hasMediaTimeline(slot)) {
+            // There is no real-time fallback in a batch.
+            std::cerr << "[WARN] Batch: " << file.path << " has no frame rate or media timeline; skipped\n";
+            slot.cap.release();
+            metrics.batchFilesFailed.add();
+            continue;
+        }
+
+        if (!options.batchOutputDir.empty()) {
+            // Rewritten from the start: a file interrupted by a crash is
+            // analysed again in full.
+            const fs::path out = fs::path(options.batchOutputDir) / (file.label + ".jsonl");
+            std::error_code ec;
+            fs::create_directories(out.parent_path(), ec);
+            fs::remove(out, ec);
+
+            AsyncLineWriterOptions resultOptions;
+            resultOptions.path = out.string();
+            resultOptions.flushIntervalSec = 1.0;
+            slot.results = std::make_unique<AsyncLineWriter>(resultOptions);
+            std::string error;
+            if (!slot.results->open(error)) {
+                std::cerr << "[WARN] Batch: " << error << "; " << file.label << " skipped\n";
+                slot.results.reset();
+                slot.cap.release();
+                metrics.batchFilesFailed.add();
+                continue;
+            }
+        }
+
+        const bool reachedEnd = sampleFileSegments(slot, options, scheduler, printer, metrics, t0, running);
+        const bool drained = slot.waitForJobs(running);
+        slot.cap.release();
+        if (!drained) {
+            break;   // interrupted; workers may still hold this file's jobs
+        }
+        // Results the per-file writer lost (backlog full, write or open
+        // error) would be missing from a file the checkpoint calls done.
+        bool outputComplete = true;
+        if (slot.results) {
+            slot.results->close();
+            outputComplete = slot.results->dropped() == 0 && !slot.results->failed();
+            slot.results.reset();
+        }
+
+        const uint64_t failed = slot.jobsFailed.load();
+        if (reachedEnd && failed == 0 && outputComplete) {
+            if (checkpoint != nullptr) {
+                checkpoint->record(file.label);
+            }
+            metrics.batchFilesDone.add();
+        } else if (running.load()) {
+            std::cerr << "[WARN] Batch: " << file.label << " not completed (" << failed
+                      << " requests failed";
+            if (!outputComplete) {
+                std::cerr << ", results file incomplete";
+            }
+            std::cerr << "); it will be retried\n";
+            metrics.batchFilesFailed.add();
+        }
+    }
+    slot.active.store(false);
+}
+
+//------------------------------------------------------------------------------
+// CLI parsing
+//------------------------------------------------------------------------------
+
+// Parse command-line arguments into ProgramOptions.
+//
+// Design goals:
+// - preserve the original CLI shape
+// - validate values with clear error messages
+// - avoid uncaught exceptions from stod/stoi
+static bool parseCommandLine(int argc, char** argv, ProgramOptions& opt)
+{
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return false;
+    }
+
+    auto isOption = [](const char* a) {
+        return std::string(a).rfind("--", 0) == 0 || std::string(a) == "-h";
+    };
+
+    // Optional positional source and config path:
+    //   program <src> config.ini --interval 10
+    //   program --config config.ini            (sources from [sources])
+    int argi = 1;
+    if (argi < argc && !isOption(argv[argi])) {
+        opt.sources.push_back({"src0", argv[argi]});
+        ++argi;
+        if (argi < argc && !isOption(argv[argi])) {
+            opt.configPath = argv[argi];
+            ++argi;
+        }
+    }
+
+    auto needValue = [&](const char* name) -> std::optional<std::string> {
+        if (argi + 1 >= argc) {
+            std::cerr << "[ERROR] Missing value for " << name << "\n";
+            return std::nullopt;
+        }
+        return std::string(argv[++argi]);
+    };
+
+    for (; argi < argc; ++argi) {
+        const std::string a = argv[argi];
+
+        if (a == "--source") {
+            auto v = needValue("--source");
+            if (!v) return false;
+            opt.sources.push_back({"src" + std::to_string(opt.sources.size()), *v});
+        } else if (a == "--config") {
+            auto v = needValue("--config");
+            if (!v) return false;
+            opt.configPath = *v;
+        } else if (a == "--inflight") {
+            auto v = needValue("--inflight");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1) {
+                std::cerr << "[ERROR] --inflight must be an integer >= 1\n";
+                return false;
+            }
+            opt.inflight = parsed;
+        } else if (a == "--queue-policy") {
+            auto v = needValue("--queue-policy");
+            if (!v) return false;
+
+            if (*v == "latest") {
+                opt.queuePolicy = QueuePolicy::Latest;
+            } else if (*v == "drop-oldest") {
+                opt.queuePolicy = QueuePolicy::DropOldest;
+            } else if (*v == "block") {
+                opt.queuePolicy = QueuePolicy::Block;
+            } else if (*v == "deadline") {
+                opt.queuePolicy = QueuePolicy::Deadline;
+            } else {
+                std::cerr << "[ERROR] --queue-policy must be latest, drop-oldest, block or deadline\n";
+                return false;
+            }
+        } else if (a == "--queue-depth") {
+            auto v = needValue("--queue-depth");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1) {
+                std::cerr << "[ERROR] --queue-depth must be an integer >= 1\n";
+                return false;
+            }
+            opt.queueDepth = parsed;
+        } else if (a == "--queue-deadline") {
+            auto v = needValue("--queue-deadline");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --queue-deadline must be a positive number\n";
+                return false;
+            }
+            opt.queueDeadlineSec = parsed;
+        } else if (a == "--max-frame-age") {
+            auto v = needValue("--max-frame-age");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --max-frame-age must be a positive number\n";
+                return false;
+            }
+            opt.maxFrameAgeSec = parsed;
+        } else if (a == "--stale-frames") {
+            auto v = needValue("--stale-frames");
+            if (!v) return false;
+
+            if (*v == "refresh") {
+                opt.refreshStaleFrames = true;
+            } else if (*v == "drop") {
+                opt.refreshStaleFrames = false;
+            } else {
+                std::cerr << "[ERROR] --stale-frames must be refresh or drop\n";
+                return false;
+            }
+        } else if (a == "--cancel-stale") {
+            opt.cancelStale = true;
+        } else if (a == "--shutdown-timeout") {
+            auto v = needValue("--shutdown-timeout");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --shutdown-timeout must be a number >= 0\n";
+                return false;
+            }
+            opt.shutdownTimeoutSec = parsed;
+        } else if (a == "--ordered") {
+            opt.orderedOutput = true;
+        } else if (a == "--stream") {
+            opt.stream = true;
+        } else if (a == "--offline") {
+            opt.offline = true;
+        } else if (a == "--segments") {
+            auto v = needValue("--segments");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1) {
+                std::cerr << "[ERROR] --segments must be an integer >= 1\n";
+                return false;
+            }
+            opt.segments = parsed;
+        } else if (a == "--keyframes") {
+            auto v = needValue("--keyframes");
+            if (!v) return false;
+
+            if (*v == "off") {
+                opt.keyframes = KeyframeSampling::Off;
+            } else if (*v == "near") {
+                opt.keyframes = KeyframeSampling::Near;
+            } else if (*v == "all") {
+                opt.keyframes = KeyframeSampling::All;
+            } else {
+                std::cerr << "[ERROR] --keyframes must be off, near or all\n";
+                return false;
+            }
+        } else if (a == "--batch") {
+            auto v = needValue("--batch");
+            if (!v) return false;
+            opt.batchInput = *v;
+        } else if (a == "--batch-decoders") {
+            auto v = needValue("--batch-decoders");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1) {
+                std::cerr << "[ERROR] --batch-decoders must be an integer >= 1\n";
+                return false;
+            }
+            opt.batchDecoders = parsed;
+        } else if (a == "--batch-output") {
+            auto v = needValue("--batch-output");
+            if (!v) return false;
+            opt.batchOutputDir = *v;
+        } else if (a == "--checkpoint") {
+            auto v = needValue("--checkpoint");
+            if (!v) return false;
+            opt.checkpointPath = *v;
+        } else if (a == "--decode-on-demand") {
+            opt.decodeOnDemand = true;
+        } else if (a == "--connect-timeout") {
+            auto v = needValue("--connect-timeout");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --connect-timeout must be a positive number\n";
+                return false;
+            }
+            opt.connectTimeoutSec = parsed;
+        } else if (a == "--request-timeout") {
+            auto v = needValue("--request-timeout");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --request-timeout must be a number >= 0\n";
+                return false;
+            }
+            opt.requestTimeoutSec = parsed;
+        } else if (a == "--gzip-request") {
+            opt.gzipRequest = true;
+        } else if (a == "--insecure") {
+            opt.insecure = true;
+        } else if (a == "--metrics-port") {
+            auto v = needValue("--metrics-port");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1 || parsed > 65535) {
+                std::cerr << "[ERROR] --metrics-port must be 1..65535\n";
+                return false;
+            }
+            opt.metricsPort = parsed;
+        } else if (a == "--metrics-bind") {
+            auto v = needValue("--metrics-bind");
+            if (!v) return false;
+            opt.metricsBind = *v;
+        } else if (a == "--stats-interval") {
+            auto v = needValue("--stats-interval");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --stats-interval must be a number >= 0\n";
+                return false;
+            }
+            opt.statsIntervalSec = parsed;
+        } else if (a == "--jsonl") {
+            auto v = needValue("--jsonl");
+            if (!v) return false;
+            opt.jsonlPath = *v;
+        } else if (a == "--jsonl-rotate-mb") {
+            auto v = needValue("--jsonl-rotate-mb");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --jsonl-rotate-mb must be a number >= 0\n";
+                return false;
+            }
+            opt.jsonlRotateMb = parsed;
+        } else if (a == "--jsonl-rotate-sec") {
+            auto v = needValue("--jsonl-rotate-sec");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --jsonl-rotate-sec must be a number >= 0\n";
+                return false;
+            }
+            opt.jsonlRotateSec = parsed;
+        } else if (a == "--store") {
+            auto v = needValue("--store");
+            if (!v) return false;
+            opt.storeDir = *v;
+        } else if (a == "--interval") {
+            auto v = needValue("--interval");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --interval must be a positive number\n";
+                return false;
+            }
+            opt.intervalSec = std::max(0.1, parsed);
+        } else if (a == "--adaptive-interval") {
+            opt.adaptiveInterval = true;
+        } else if (a == "--adaptive-min") {
+            auto v = needValue("--adaptive-min");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --adaptive-min must be a positive number\n";
+                return false;
+            }
+            opt.adaptiveMinSec = std::max(0.1, parsed);
+        } else if (a == "--adaptive-max") {
+            auto v = needValue("--adaptive-max");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --adaptive-max must be a positive number\n";
+                return false;
+            }
+            opt.adaptiveMaxSec = parsed;
+        } else if (a == "--max-dim") {
+            auto v = needValue("--max-dim");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 0) {
+                std::cerr << "[ERROR] --max-dim must be an integer >= 0\n";
+                return false;
+            }
+            opt.maxDim = parsed;
+        } else if (a == "--jpeg-quality") {
+            auto v = needValue("--jpeg-quality");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1 || parsed > 100) {
+                std::cerr << "[ERROR] --jpeg-quality must be 1..100\n";
+                return false;
+            }
+            opt.jpegQuality = parsed;
+        } else if (a == "--payload-budget") {
+            auto v = needValue("--payload-budget");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --payload-budget must be a positive number of KiB\n";
+                return false;
+            }
+            opt.payloadBudgetKiB = std::max(4.0, parsed);
+        } else if (a == "--latency-budget") {
+            auto v = needValue("--latency-budget");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed <= 0.0) {
+                std::cerr << "[ERROR] --latency-budget must be a positive number\n";
+                return false;
+            }
+            opt.latencyBudgetSec = parsed;
+        } else if (a == "--min-dim") {
+            auto v = needValue("--min-dim");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 16) {
+                std::cerr << "[ERROR] --min-dim must be an integer >= 16\n";
+                return false;
+            }
+            opt.minDim = parsed;
+        } else if (a == "--min-jpeg-quality") {
+            auto v = needValue("--min-jpeg-quality");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1 || parsed > 100) {
+                std::cerr << "[ERROR] --min-jpeg-quality must be 1..100\n";
+                return false;
+            }
+            opt.minJpegQuality = parsed;
+        } else if (a == "--model-input-dim") {
+            auto v = needValue("--model-input-dim");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 0) {
+                std::cerr << "[ERROR] --model-input-dim must be an integer >= 0\n";
+                return false;
+            }
+            opt.modelInputDim = parsed;
+        } else if (a == "--dim-multiple") {
+            auto v = needValue("--dim-multiple");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1 || parsed > 256) {
+                std::cerr << "[ERROR] --dim-multiple must be 1..256\n";
+                return false;
+            }
+            opt.dimMultiple = parsed;
+        } else if (a == "--predefined_start_time") {
+            auto v = needValue("--predefined_start_time");
+            if (!v) return false;
+
+            if (!parseDateTime(*v, opt.predefinedStartTime)) {
+                std::cerr << "[ERROR] --predefined_start_time expects \"YYYY-mm-dd HH:MM:SS\"\n";
+                return false;
+            }
+            opt.hasPredefinedStartTime = true;
+        } else if (a == "--prompt") {
+            auto v = needValue("--prompt");
+            if (!v) return false;
+            opt.prompt = *v;
+        } else if (a == "--no-gui") {
+            opt.guiEnabled = false;
+        } else if (a == "--reconnect-sec") {
+            auto v = needValue("--reconnect-sec");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 0) {
+                std::cerr << "[ERROR] --reconnect-sec must be an integer >= 0\n";
+                return false;
+            }
+            opt.reconnectSec = parsed;
+        } else if (a == "--motion-gate") {
+            opt.motionGate = true;
+        } else if (a == "--motion-threshold") {
+            auto v = needValue("--motion-threshold");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) ||
+                parsed < 0.0 || parsed > 1.0) {
+                std::cerr << "[ERROR] --motion-threshold must be 0..1\n";
+                return false;
+            }
+            opt.motionThreshold = parsed;
+        } else if (a == "--motion-pixel-delta") {
+            auto v = needValue("--motion-pixel-delta");
+            if (!v) return false;
+
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 0 || parsed > 255) {
+                std::cerr << "[ERROR] --motion-pixel-delta must be 0..255\n";
+                return false;
+            }
+            opt.motionPixelDelta = parsed;
+        } else if (a == "--motion-min-interval") {
+            auto v = needValue("--motion-min-interval");
+            if (!v) return false;
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --motion-min-interval must be a number >= 0\n";
+                return false;
+            }
+            opt.motionMinIntervalSec = parsed;
+        } else if (a == "--cache-ttl") {
+            auto v = needValue("--cache-ttl");
             if (!v) return false;
 
-            int parsed = 0;
-            if (!parseIntStrict(*v, parsed) || parsed < 1 || parsed > 100) {
-                std::cerr << "[ERROR] --jpeg-quality must be 1..100\n";
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --cache-ttl must be a number >= 0\n";
                 return false;
             }
-            opt.jpegQuality = parsed;
-        } else if (a == "--predefined_start_time") {
-            auto v = needValue("--predefined_start_time");
+            opt.cacheTtlSec = parsed;
+        } else if (a == "--clip-frames") {
+            auto v = needValue("--clip-frames");
             if (!v) return false;
 
-            if (!parseDateTime(*v, opt.predefinedStartTime)) {
-                std::cerr << "[ERROR] --predefined_start_time expects \"YYYY-mm-dd HH:MM:SS\"\n";
+            int parsed = 0;
+            if (!parseIntStrict(*v, parsed) || parsed < 1 || parsed > 16) {
+                std::cerr << "[ERROR] --clip-frames must be an integer in [1, 16]\n";
                 return false;
             }
-            opt.hasPredefinedStartTime = true;
-        } else if (a == "--prompt") {
-            auto v = needValue("--prompt");
+            opt.clipFrames = parsed;
+        } else if (a == "--clip-stride") {
+            auto v = needValue("--clip-stride");
             if (!v) return false;
-            opt.prompt = *v;
-        } else if (a == "--no-gui") {
-            opt.guiEnabled = false;
-        } else if (a == "--reconnect-sec") {
-            auto v = needValue("--reconnect-sec");
+
+            double parsed = 0.0;
+            if (!parseDoubleStrict(*v, parsed) || !std::isfinite(parsed) || parsed < 0.0) {
+                std::cerr << "[ERROR] --clip-stride must be a number >= 0\n";
+                return false;
+            }
+            opt.clipStrideSec = parsed;
+        } else if (a == "--cache-distance") {
+            auto v = needValue("--cache-distance");
             if (!v) return false;
 
             int parsed = 0;
-            if (!parseIntStrict(*v, parsed) || parsed < 0) {
-                std::cerr << "[ERROR] --reconnect-sec must be an integer >= 0\n";
+            if (!parseIntStrict(*v, parsed) || parsed < 0 || parsed > 64) {
+                std::cerr << "[ERROR] --cache-distance must be 0..64\n";
                 return false;
             }
-            opt.reconnectSec = parsed;
+            opt.cacheMaxDistance = parsed;
         } else if (a == "--help" || a == "-h") {
             printUsage(argv[0]);
             std::exit(0);
@@ -843,6 +3766,51 @@ static bool parseCommandLine(int argc, char** argv, ProgramOptions& opt)
         }
     }
 
+    if (opt.adaptiveInterval && opt.adaptiveMinSec > opt.adaptiveMaxSec) {
+        std::cerr << "[ERROR] --adaptive-min must not exceed --adaptive-max\n";
+        return false;
+    }
+    if (opt.cancelStale && opt.maxFrameAgeSec <= 0.0) {
+        std::cerr << "[ERROR] --cancel-stale requires --max-frame-age\n";
+        return false;
+    }
+    if (opt.queueDeadlineSec <= 0.0) {
+        opt.queueDeadlineSec = 2.0 * opt.intervalSec;
+    }
+    if (opt.batchInput.empty() &&
+        (opt.batchDecoders > 0 || !opt.batchOutputDir.empty() || !opt.checkpointPath.empty())) {
+        std::cerr << "[ERROR] --batch-decoders, --batch-output and --checkpoint require --batch\n";
+        return false;
+    }
+    if (!opt.batchInput.empty()) {
+        if (!opt.sources.empty()) {
+            std::cerr << "[ERROR] --batch cannot be combined with sources on the command line\n";
+            return false;
+        }
+        // A batch is an archive run: sampled offline, no preview windows.
+        opt.offline = true;
+        opt.guiEnabled = false;
+        if (opt.batchDecoders == 0) {
+            opt.batchDecoders = static_cast<int>(
+                std::clamp(std::thread::hardware_concurrency(), 1u, 4u));
+        }
+        if (opt.checkpointPath.empty() && !opt.batchOutputDir.empty()) {
+            opt.checkpointPath = (std::filesystem::path(opt.batchOutputDir) / "checkpoint.txt").string();
+        }
+    }
+    if (opt.segments > 1 && !opt.offline) {
+        std::cerr << "[ERROR] --segments requires --offline or --batch\n";
+        return false;
+    }
+    if (opt.keyframes != KeyframeSampling::Off && !opt.offline) {
+        std::cerr << "[ERROR] --keyframes requires --offline or --batch\n";
+        return false;
+    }
+    if (opt.clipStrideSec > 0.0 && opt.clipFrames < 2) {
+        std::cerr << "[ERROR] --clip-stride requires --clip-frames >= 2\n";
+        return false;
+    }
+
     return true;
 }
 
@@ -858,354 +3826,775 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    std::signal(SIGINT, handleStopSignal);
+    std::signal(SIGTERM, handleStopSignal);
+
+    const auto ini = parseIni(options.configPath);
+
     OpenAIConfig cfg;
-    if (!loadOpenAIConfig(options.configPath, cfg)) {
+    if (!loadOpenAIConfig(ini, options.configPath, cfg)) {
         return 1;
     }
 
+    // In batch mode the files take the place of the [sources] section.
+    const bool batchMode = !options.batchInput.empty();
+    std::vector<BatchFile> batchFiles;
+    std::unique_ptr<BatchCheckpoint> checkpoint;
+    if (batchMode) {
+        if (!collectBatchFiles(options.batchInput, batchFiles)) {
+            return 1;
+        }
+        const size_t total = batchFiles.size();
+        if (!options.checkpointPath.empty()) {
+            std::string error;
+            checkpoint = std::make_unique<BatchCheckpoint>();
+            if (!checkpoint->open(options.checkpointPath, error)) {
+                std::cerr << "[ERROR] Checkpoint: " << error << "\n";
+                return 1;
+            }
+            std::erase_if(batchFiles, [&](const BatchFile& f) { return checkpoint->contains(f.label); });
+        }
+        std::cerr << "[INFO] Batch: " << total << " files in " << options.batchInput;
+        if (batchFiles.size() < total) {
+            std::cerr << ", " << total - batchFiles.size() << " already done";
+        }
+        std::cerr << "\n";
+        if (batchFiles.empty()) {
+            return 0;
+        }
+    } else {
+        appendIniSources(ini, options.sources);
+        if (options.sources.empty()) {
+            std::cerr << "[ERROR] No sources given on the command line or in "
+                      << options.configPath << " [sources]\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    const bool multiSource = batchMode || options.sources.size() > 1;
+
     // Log the effective non-secret configuration for easier troubleshooting.
     std::cerr << "[INFO] OpenAI base URL: " << cfg.baseUrl << "\n";
     std::cerr << "[INFO] Vision model: " << cfg.vmodelName << "\n";
-    std::cerr << "[INFO] Source: " << options.src << "\n";
+    for (const auto& spec : options.sources) {
+        if (multiSource) {
+            std::cerr << "[INFO] Source " << spec.label << ": " << spec.uri << "\n";
+        } else {
+            std::cerr << "[INFO] Source: " << spec.uri << "\n";
+        }
+    }
 
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // One libcurl handle per worker, each keeping its own keep-alive
+    // connection to base_url, with shared DNS and TLS session caches.
+    // Created before any worker starts.
+    HttpClientOptions httpOptions;
+    httpOptions.connectTimeoutSec = options.connectTimeoutSec;
+    httpOptions.requestTimeoutSec = options.requestTimeoutSec;
+    httpOptions.gzipRequest = options.gzipRequest;
+    httpOptions.verifyTls = cfg.tlsVerify && !options.insecure;
+    if (!httpOptions.verifyTls && cfg.baseUrl.rfind("https://", 0) == 0) {
+        std::cerr << "[WARN] TLS certificate verification is disabled for " << cfg.baseUrl << "\n";
+    }
+
+    std::unique_ptr<HttpSharedCache> sharedCache;
+    std::vector<std::unique_ptr<HttpSession>> sessions;
     try {
-        openai::start(cfg.apiKey, "", true, cfg.baseUrl);
+        sharedCache = std::make_unique<HttpSharedCache>();
+        for (int i = 0; i < options.inflight; ++i) {
+            sessions.push_back(std::make_unique<HttpSession>(*sharedCache, httpOptions));
+        }
     } catch (const std::exception& e) {
-        std::cerr << "[ERROR] Failed to initialize OpenAI client: "
+        std::cerr << "[ERROR] Failed to initialize HTTP client: "
                   << e.what() << "\n";
         return 1;
     }
 
-    cv::VideoCapture cap;
-    if (!openCapture(cap, options.src) || !cap.isOpened()) {
-        std::cerr << "[ERROR] Could not open source\n";
-        return 1;
-    }
-
-    // Request a small internal buffer to reduce lag on live sources.
-    cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
-
-    // Heuristic:
-    // - if frame count is finite and > 0, and the source is not a camera index,
-    //   treat it as a media file
-    // - otherwise assume a live-ish source
-    const double frameCount = cap.get(cv::CAP_PROP_FRAME_COUNT);
-    const bool likelyFile =
-        std::isfinite(frameCount) &&
-        frameCount > 0.0 &&
-        !isCameraIndexSource(options.src);
-
     const auto applicationStartTime = std::chrono::system_clock::now();
 
-    // Base timestamp used to map media position -> absolute datetime.
-    //
-    // Priority:
-    // 1. explicit --predefined_start_time
-    // 2. encoded timeline start (start_time_realtime)
-    // 3. encoded start from media metadata (creation_time)
-    // 4. application start time
-    std::chrono::system_clock::time_point fileBaseTime =
-        applicationStartTime;
-
-    if (likelyFile) {
-        if (options.hasPredefinedStartTime) {
-            fileBaseTime = options.predefinedStartTime;
-        } else {
-            const auto timeline = probeFileEncodedTimelineStart(options.src);
-            if (timeline.has_value()) {
-                fileBaseTime = *timeline;
-            } else {
-                const auto probed = probeFileEncodedStartTime(options.src);
-                if (probed.has_value()) {
-                    fileBaseTime = *probed;
-                }
+    std::vector<std::unique_ptr<SourceState>> sources;
+    for (const auto& spec : options.sources) {
+        auto src = std::make_unique<SourceState>();
+        src->spec = spec;
+        src->index = sources.size();
+
+        if (!openCapture(src->cap, spec.uri) || !src->cap.isOpened()) {
+            std::cerr << "[ERROR] Could not open source";
+            if (multiSource) {
+                std::cerr << ' ' << spec.label;
             }
+            std::cerr << "\n";
+            return 1;
+        }
+
+        // Request a small internal buffer to reduce lag on live sources.
+        src->cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+
+        // Heuristic:
+        // - if frame count is finite and > 0, and the source is not a camera index,
+        //   treat it as a media file
+        // - otherwise assume a live-ish source
+        const double frameCount = src->cap.get(cv::CAP_PROP_FRAME_COUNT);
+        src->likelyFile =
+            std::isfinite(frameCount) &&
+            frameCount > 0.0 &&
+            !isCameraIndexSource(spec.uri);
+        src->offline = options.offline && src->likelyFile;
+        resolveFileBaseTime(*src, options, applicationStartTime);
+        if (src->offline && !hasMediaTimeline(*src)) {
+            std::cerr << "[WARN] Source " << spec.label
+                      << ": no frame rate or media timeline; played in real time instead of --offline\n";
+            src->offline = false;
         }
+        if (!src->offline && options.clipStrideSec > 0.0) {
+            src->historyStrideSec = options.clipStrideSec;
+            src->historyLength = 2 * static_cast<size_t>(options.clipFrames);
+        }
+
+        sources.push_back(std::move(src));
     }
 
-    // Shared latest frame state.
-    //
-    // The capture thread continuously updates this.
-    // The main loop periodically samples it and overwrites the single pending
-    // inference job.
-    std::mutex frameMtx;
-    cv::Mat latestFrame;
-    double latestMediaPosSec = 0.0;
+    // Batch decoder slots; each opens its files in batchDecodeLoop().
+    const size_t batchSlots = std::min(batchFiles.size(), static_cast<size_t>(options.batchDecoders));
+    for (size_t i = 0; i < batchSlots; ++i) {
+        auto slot = std::make_unique<SourceState>();
+        slot->spec.label = "decoder" + std::to_string(i);
+        slot->index = sources.size();
+        slot->likelyFile = true;
+        slot->offline = true;
+        sources.push_back(std::move(slot));
+    }
+    if (batchMode) {
+        std::cerr << "[INFO] Batch: " << batchFiles.size() << " files to analyse, decoders: "
+                  << batchSlots << ", in flight: " << options.inflight << "\n";
+    }
 
-    // Shared job state for the worker thread.
-    std::mutex jobMtx;
-    std::condition_variable jobCv;
-    PendingJob pending;
+    // Results leave through writer threads. Text lines go to stdout unless
+    // JSONL takes it over with "--jsonl -".
+    const bool jsonlToStdout = options.jsonlPath == "-";
+    AsyncLineWriter stdoutWriter(AsyncLineWriterOptions{});
+    std::unique_ptr<AsyncLineWriter> jsonlFileWriter;
+    {
+        std::string error;
+        if (!stdoutWriter.open(error)) {
+            std::cerr << "[ERROR] " << error << "\n";
+            return 1;
+        }
+        if (!options.jsonlPath.empty() && !jsonlToStdout) {
+            AsyncLineWriterOptions jsonlOptions;
+            jsonlOptions.path = options.jsonlPath;
+            jsonlOptions.rotateBytes = static_cast<uint64_t>(options.jsonlRotateMb * 1024.0 * 1024.0);
+            jsonlOptions.rotateSec = options.jsonlRotateSec;
+            jsonlOptions.flushIntervalSec = 1.0;
+            jsonlFileWriter = std::make_unique<AsyncLineWriter>(jsonlOptions);
+            if (!jsonlFileWriter->open(error)) {
+                std::cerr << "[ERROR] JSONL output: " << error << "\n";
+                return 1;
+            }
+        }
+    }
+    std::unique_ptr<KnowledgeStoreWriter> store;
+    if (!options.storeDir.empty()) {
+        std::string error;
+        store = std::make_unique<KnowledgeStoreWriter>();
+        if (!store->open(options.storeDir, error)) {
+            std::cerr << "[ERROR] Knowledge store: " << error << "\n";
+            return 1;
+        }
+        std::cerr << "[INFO] Knowledge store: " << options.storeDir << "\n";
+    }
+    ResultPrinter printer(
+        options.orderedOutput,
+        jsonlToStdout ? nullptr : &stdoutWriter,
+        jsonlToStdout ? &stdoutWriter : jsonlFileWriter.get());
+    std::atomic<bool>& running = g_running;
+
+    // Tag lines with the trigger index once results can arrive out of order.
+    const bool tagTrigger = options.inflight > 1;
+
+    std::unique_ptr<ResponseCache> cache;
+    if (options.cacheTtlSec > 0.0) {
+        cache = std::make_unique<ResponseCache>(options.cacheTtlSec, options.cacheMaxDistance);
+    }
+    const uint64_t promptKey = std::hash<std::string>{}(options.prompt);
+
+    PipelineMetrics metrics;
+    InferenceScheduler scheduler(sources.size(), options.queuePolicy,
+                                 static_cast<size_t>(options.queueDepth),
+                                 options.queueDeadlineSec, metrics);
+    MetricsServer metricsServer([&metrics] { return metrics.renderPrometheus(); });
+    if (options.metricsPort > 0) {
+        std::string error;
+        if (!metricsServer.start(options.metricsBind, options.metricsPort, error)) {
+            std::cerr << "[ERROR] Metrics endpoint: " << error << "\n";
+            return 1;
+        }
+        std::cerr << "[INFO] Metrics: http://" << options.metricsBind << ":"
+                  << options.metricsPort << "/metrics\n";
+    }
 
-    std::atomic<bool> running{true};
+    // Reference point of the jobs' wallTimeSec.
+    const auto t0 = std::chrono::steady_clock::now();
 
     //--------------------------------------------------------------------------
-    // Worker thread
+    // Worker threads
     //
     // Responsibilities:
-    // - wait for a pending job
-    // - process only the newest job
-    // - send frame to the model
+    // - take the next pending job, round-robin across sources
+    // - send frame to the model through the worker's own client
+    // - hand the result line to the printer
     //
     // Important:
     // For file playback, encoded timestamps are derived from mediaPosSec,
     // not wallTimeSec. This avoids drift when inference is slower than real
     // time or when file playback timing varies.
     //--------------------------------------------------------------------------
-    std::thread worker([&] {
-        while (true) {
-            PendingJob job;
-            {
-                std::unique_lock<std::mutex> lk(jobMtx);
-                jobCv.wait(lk, [&] { return pending.stop || pending.has; });
-
-                if (pending.stop) {
-                    break;
-                }
+    AdaptiveInterval adaptive(options.intervalSec, options.adaptiveMinSec,
+                              options.adaptiveMaxSec, sessions.size());
+    const double initialIntervalSec =
+        options.adaptiveInterval ? adaptive.intervalSec() : options.intervalSec;
+    metrics.triggerIntervalSec.store(initialIntervalSec);
+
+    // Resize and JPEG quality per source. Without --payload-budget or
+    // --latency-budget every frame gets --max-dim and --jpeg-quality.
+    std::vector<std::unique_ptr<PayloadBudget>> payloadBudgets;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        payloadBudgets.push_back(std::make_unique<PayloadBudget>(options));
+    }
 
-                job.wallTimeSec = pending.wallTimeSec;
-                job.mediaPosSec = pending.mediaPosSec;
-                job.triggerIdx = pending.triggerIdx;
-                pending.frame.copyTo(job.frame);
+    const auto maxFrameAge = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(options.maxFrameAgeSec));
 
-                // Clear the pending slot immediately so that newer work can be
-                // scheduled while inference is running.
-                pending.has = false;
-            }
+    // Set on quit to abort every request in flight.
+    std::atomic<bool> cancelInFlight{false};
 
-            if (job.frame.empty()) {
+    auto workerLoop = [&](size_t workerIdx) {
+        HttpSession& session = *sessions[workerIdx];
+        PendingJob job;
+        // Only polled inside post(), while `job` is the request in flight.
+        session.setCancelCheck([&] {
+            if (cancelInFlight.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            return options.cancelStale && !sources[job.sourceIdx]->offline &&
+                   std::chrono::steady_clock::now() - job.frame->capturedAt > maxFrameAge &&
+                   scheduler.hasPending(job.sourceIdx);
+        });
+        while (scheduler.next(job)) {
+            SourceState& src = *sources[job.sourceIdx];
+            const JobFinishedGuard finished(src, job.segment);
+
+            if (!job.frame || job.frame->image.empty()) {
+                printer.complete(job.dispatchSeq, {});
                 continue;
             }
 
-            const std::string acquisitionTag = formatDateTime(
-                addSecondsToTimePoint(applicationStartTime, job.wallTimeSec));
-
-            std::string mediaTag;
-            if (likelyFile) {
-                mediaTag = formatDateTime(
-                    addSecondsToTimePoint(fileBaseTime, job.mediaPosSec));
-            } else {
-                mediaTag = acquisitionTag;
+            // Queue wait and latency run from the trigger, even if the
+            // frame is refreshed below.
+            const auto triggeredAt = t0 + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(job.wallTimeSec));
+
+            // The job may have waited behind slow requests. Rather than
+            // spend a request on a scene that is long gone, send the source's
+            // current frame instead, or nothing. Offline samples are exempt:
+            // their frames do not age. The acquisition time then becomes
+            // that of the frame actually sent. A --clip-stride clip is
+            // rebuilt around the new frame; a clip of consecutive samples
+            // cannot be, and is dropped.
+            if (maxFrameAge.count() > 0 && !src.offline &&
+                std::chrono::steady_clock::now() - job.frame->capturedAt > maxFrameAge) {
+                FrameRef latest = options.refreshStaleFrames ? src.latest() : FrameRef{};
+                if (latest && latest->seq > job.frame->seq &&
+                    std::chrono::steady_clock::now() - latest->capturedAt <= maxFrameAge &&
+                    (job.context.empty() || options.clipStrideSec > 0.0)) {
+                    if (options.clipStrideSec > 0.0) {
+                        job.context = src.framesBefore(*latest, options.clipFrames - 1, options.clipStrideSec);
+                    }
+                    job.mediaPosSec = latest->mediaPosSec;
+                    job.wallTimeSec = std::chrono::duration<double>(latest->capturedAt - t0).count();
+                    job.frame = std::move(latest);
+                    metrics.framesRefreshed.add();
+                } else {
+                    metrics.jobsStale.add();
+                    printer.complete(job.dispatchSeq, {});
+                    continue;
+                }
             }
 
-            const bool useEncodedTimelineTag = likelyFile;
+            const auto acquiredAt = addSecondsToTimePoint(applicationStartTime, job.wallTimeSec);
+            const auto mediaAt = src.likelyFile
+                                     ? addSecondsToTimePoint(src.fileBaseTime, job.mediaPosSec)
+                                     : acquiredAt;
+            const std::string acquisitionTag = formatDateTime(acquiredAt);
+            const std::string mediaTag = formatDateTime(mediaAt);
+
+            const bool useEncodedTimelineTag = src.likelyFile;
             const std::string& logTimestamp = useEncodedTimelineTag
                                                   ? mediaTag
                                                   : acquisitionTag;
 
             // For files we log encoded media timeline time; for live sources we
             // fall back to acquisition time because no stable encoded timeline exists.
-            std::cout << logTimestamp
-                      << " media-time=" << std::fixed << std::setprecision(3)
-                      << job.mediaPosSec << "s";
+            std::ostringstream prefix;
+            prefix << logTimestamp;
+            if (multiSource) {
+                prefix << " source=" << src.spec.label;
+            }
+            if (tagTrigger) {
+                prefix << " trigger=" << job.triggerIdx;
+            }
+            prefix << " media-time=" << std::fixed << std::setprecision(3)
+                   << job.mediaPosSec << "s";
+            if (!job.context.empty()) {
+                prefix << " clip=" << job.context.size() + 1;
+            }
             if (!useEncodedTimelineTag) {
-                std::cout << " encoded-at=" << mediaTag;
+                prefix << " encoded-at=" << mediaTag;
             }
-            std::cout << "  ";
-
-            sendFrameToOpenAI(
-                job.frame,
-                job.wallTimeSec,
-                job.mediaPosSec,
-                job.triggerIdx,
-                cfg,
-                options.prompt,
-                options.maxDim,
-                options.jpegQuality);
-        }
-    });
-    ThreadJoiner workerJoiner(worker);
-
-    //--------------------------------------------------------------------------
-    // Capture thread
-    //
-    // Responsibilities:
-    // - continuously read frames from OpenCV
-    // - keep only the latest frame
-    // - for files, pace playback approximately in real time
-    // - for streams, attempt reconnects on transient failures
-    //
-    // Notes:
-    // - For media files, we prefer CAP_PROP_POS_MSEC as the media timeline.
-    // - If POS_MSEC is unavailable, we fall back to FPS-derived progression.
-    //--------------------------------------------------------------------------
-    std::thread captureThread([&] {
-        cv::Mat f;
-        auto lastOk = std::chrono::steady_clock::now();
-
-        const double fps = cap.get(cv::CAP_PROP_FPS);
-        const bool hasValidFps = std::isfinite(fps) && fps > 1e-6;
-        const double frameDuration = hasValidFps ? (1.0 / fps) : 0.0;
 
-        const auto playbackStart = std::chrono::steady_clock::now();
-        double fallbackPosSec = 0.0;
-        int reconnectAttempt = 0;
-
-        while (running.load()) {
-            if (cap.read(f) && !f.empty()) {
-                reconnectAttempt = 0;
-                lastOk = std::chrono::steady_clock::now();
-
-                double mediaPosSec = fallbackPosSec;
-
-                if (likelyFile) {
-                    const double posMsec = cap.get(cv::CAP_PROP_POS_MSEC);
+            // --clip-frames: when each image was taken, on the media timeline
+            // for files and on the wall-time scale for live sources.
+            std::vector<double> clipTimes;
+            std::string prompt = options.prompt;
+            if (!job.context.empty()) {
+                auto frameTime = [&](const Frame& frame) {
+                    return src.likelyFile ? frame.mediaPosSec
+                                          : std::chrono::duration<double>(frame.capturedAt - t0).count();
+                };
+                for (const FrameRef& earlier : job.context) {
+                    clipTimes.push_back(frameTime(*earlier));
+                }
+                clipTimes.push_back(src.likelyFile ? job.mediaPosSec : frameTime(*job.frame));
+
+                std::ostringstream clipPrompt;
+                clipPrompt << prompt << " The " << clipTimes.size()
+                           << " images are frames of the same video in time order, taken at "
+                           << (src.likelyFile ? "media positions" : "wall times") << std::fixed
+                           << std::setprecision(3);
+                for (size_t i = 0; i < clipTimes.size(); ++i) {
+                    clipPrompt << (i == 0 ? " " : ", ") << clipTimes[i] << "s";
+                }
+                clipPrompt << ".";
+                prompt = clipPrompt.str();
+            }
 
-                    if (std::isfinite(posMsec) && posMsec >= 1e-3) {
-                        mediaPosSec = posMsec / 1000.0;
-                        fallbackPosSec = mediaPosSec;
-                    } else if (hasValidFps) {
-                        fallbackPosSec += frameDuration;
-                        mediaPosSec = fallbackPosSec;
-                    }
+            const auto serviceStart = std::chrono::steady_clock::now();
+            metrics.queueWait.record(std::chrono::duration<double>(serviceStart - triggeredAt).count());
+
+            std::string message;
+            bool cacheHit = false;
+            RequestTiming timing;
+            ImageEncoding encoding;
+            uint64_t frameHash = 0;
+            // A clip's answer depends on all of its frames, so clips bypass
+            // the cache.
+            const bool cacheable = cache && job.context.empty();
+            if (cacheable) {
+                frameHash = differenceHash(job.frame->image);
+                if (auto cached = cache->lookup(job.sourceIdx, promptKey, frameHash)) {
+                    message = std::move(*cached);
+                    cacheHit = true;
+                }
+            }
 
-                    // Throttle file reading to approximately real-time playback
-                    // based on media position, not on loop speed.
-                    if (mediaPosSec > 0.0) {
-                        const auto targetTime =
-                            playbackStart + std::chrono::duration<double>(mediaPosSec);
-                        const auto now = std::chrono::steady_clock::now();
-                        if (targetTime > now) {
-                            std::this_thread::sleep_for(targetTime - now);
-                        }
-                    }
+            if (!cacheHit) {
+                PayloadBudget& budget = *payloadBudgets[job.sourceIdx];
+                encoding = budget.choose(job.frame->image.cols, job.frame->image.rows);
+                bool ok = false;
+                if (options.stream) {
+                    const std::string partialPrefix = prefix.str() + " ~ ";
+                    ok = streamFrameToOpenAI(
+                        session,
+                        job.frame->image,
+                        job.context,
+                        job.wallTimeSec,
+                        job.mediaPosSec,
+                        job.triggerIdx,
+                        cfg,
+                        prompt,
+                        encoding,
+                        [&](const std::string& sentence) {
+                            printer.partial(partialPrefix + sentence);
+                        },
+                        message,
+                        timing);
                 } else {
-                    // For streams/cameras, media position is less meaningful.
-                    // Use POS_MSEC only if the backend provides something sane.
-                    const double posMsec = cap.get(cv::CAP_PROP_POS_MSEC);
-                    if (std::isfinite(posMsec) && posMsec >= 0.0) {
-                        mediaPosSec = posMsec / 1000.0;
+                    ok = sendFrameToOpenAI(
+                        session,
+                        job.frame->image,
+                        job.context,
+                        job.wallTimeSec,
+                        job.mediaPosSec,
+                        job.triggerIdx,
+                        cfg,
+                        prompt,
+                        encoding,
+                        message,
+                        timing);
+                }
+
+                if (timing.imagesEncoded) {
+                    metrics.resize.record(timing.resizeSec);
+                    metrics.jpegEncode.record(timing.jpegEncodeSec);
+                    metrics.base64.record(timing.base64Sec);
+                }
+                if (timing.bodyBuilt) {
+                    // Only a built body was posted; encode failures send nothing.
+                    metrics.requests.add();
+                    metrics.jsonBuild.record(timing.jsonBuildSec);
+                    metrics.imageBytes.add(timing.jpegBytes);
+                }
+                budget.observe(encoding.jpegQuality, timing.jpegBytes, timing.imageWidth,
+                               timing.imageHeight, ok ? timing.httpSec : -1.0);
+                if (!ok) {
+                    src.jobsFailed.fetch_add(1);
+                    if (timing.cancelled) {
+                        metrics.requestsCancelled.add();
                     } else {
-                        mediaPosSec = 0.0;
+                        metrics.requestsFailed.add();
                     }
+                    adaptive.recordServiceTime(std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - serviceStart).count());
+                    printer.complete(job.dispatchSeq, {});
+                    continue;
                 }
-
-                {
-                    std::lock_guard<std::mutex> lock(frameMtx);
-                    f.copyTo(latestFrame);
-                    latestMediaPosSec = mediaPosSec;
+                metrics.http.record(timing.httpSec);
+                if (options.stream) {
+                    metrics.ttft.record(std::max(0.0, timing.timeToFirstTokenSec));
+                } else {
+                    metrics.parse.record(timing.parseSec);
+                }
+                if (cacheable) {
+                    cache->insert(job.sourceIdx, promptKey, frameHash, message);
                 }
-                continue;
             }
 
-            // For files, EOF/failure is expected termination.
-            if (likelyFile) {
-                running.store(false);
-                break;
+            std::ostringstream line;
+            line << prefix.str();
+            if (cacheHit) {
+                line << " cache=hit";
+                metrics.cacheHits.add();
+            } else if (options.stream) {
+                line << std::fixed << std::setprecision(3)
+                     << " ttft=" << std::max(0.0, timing.timeToFirstTokenSec) << "s"
+                     << " total=" << timing.httpSec << "s";
             }
-
-            // For streams/cameras, treat failures as transient up to a limit.
-            const auto now = std::chrono::steady_clock::now();
-            const double downFor =
-                std::chrono::duration<double>(now - lastOk).count();
-
-            if (options.reconnectSec <= 0 ||
-                downFor > static_cast<double>(options.reconnectSec)) {
-                std::cerr << "[ERROR] Stream read failed for >"
-                          << options.reconnectSec << "s; stopping.\n";
-                running.store(false);
-                break;
+            line << "  " << message;
+
+            const auto completedAt = std::chrono::steady_clock::now();
+            const double latencySec = std::chrono::duration<double>(completedAt - triggeredAt).count();
+            const double frameAgeSec =
+                std::chrono::duration<double>(completedAt - job.frame->capturedAt).count();
+
+            std::string record;
+            if (printer.wantsRecords() || store || src.results) {
+                // ordered_json keeps the fields in this order on every line.
+                nlohmann::ordered_json r = {
+                    {"trigger", job.triggerIdx},
+                    {"source", src.spec.label},
+                    {"wall_time_sec", job.wallTimeSec},
+                    {"media_time_sec", job.mediaPosSec},
+                    {"acquired_at", formatIsoDateTime(acquiredAt)},
+                    {"media_datetime", formatIsoDateTime(mediaAt)},
+                    {"latency_sec", latencySec},
+                    {"frame_age_sec", frameAgeSec},
+                    {"model", cfg.vmodelName},
+                    {"cache_hit", cacheHit},
+                };
+                if (!clipTimes.empty()) {
+                    r[src.likelyFile ? "clip_media_time_sec" : "clip_wall_time_sec"] = clipTimes;
+                }
+                if (!cacheHit) {
+                    r["image"] = {
+                        {"width", timing.imageWidth},
+                        {"height", timing.imageHeight},
+                        {"jpeg_quality", encoding.jpegQuality},
+                        {"bytes", timing.jpegBytes},
+                    };
+                    r["http_sec"] = timing.httpSec;
+                    if (options.stream) {
+                        r["ttft_sec"] = std::max(0.0, timing.timeToFirstTokenSec);
+                    }
+                }
+                r["text"] = message;
+                record = r.dump(-1, ' ', false, nlohmann::ordered_json::error_handler_t::replace);
             }
 
-            // Bounded exponential backoff:
-            // 250, 500, 1000, 2000, 2000, ...
-            ++reconnectAttempt;
-            const int backoffMs =
-                std::min(2000, 250 * (1 << std::min(reconnectAttempt - 1, 3)));
-
-            std::cerr << "[WARN] Stream read failed; attempting reconnect in "
-                      << backoffMs << " ms...\n";
-
-            cap.release();
-            std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
-
-            if (!running.load()) {
-                break;
+            if (store) {
+                store->append({
+                    src.spec.label,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(mediaAt.time_since_epoch()).count(),
+                    std::chrono::duration_cast<std::chrono::milliseconds>(acquiredAt.time_since_epoch()).count(),
+                    record});
             }
-
-            if (!openCapture(cap, options.src) || !cap.isOpened()) {
-                continue;
+            if (src.merger) {
+                src.merger->add(job.segment, job.triggerIdx, line.str(), std::move(record));
+                printer.complete(job.dispatchSeq, {});
+            } else {
+                if (src.results) {
+                    src.results->push(record);
+                }
+                printer.complete(job.dispatchSeq, line.str(), std::move(record));
             }
+            metrics.endToEnd.record(latencySec);
+            metrics.frameAge.record(frameAgeSec);
+            adaptive.recordServiceTime(std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - serviceStart).count());
+        }
+        session.setCancelCheck({});
+    };
 
-            cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
-            lastOk = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    ThreadJoiner workerJoiner(workers);
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        workers.emplace_back(workerLoop, i);
+    }
+
+    std::vector<std::thread> captureThreads;
+    ThreadJoiner captureJoiner(captureThreads);
+    std::atomic<size_t> nextBatchFile{0};
+    for (auto& src : sources) {
+        if (batchMode) {
+            captureThreads.emplace_back(
+                batchDecodeLoop, std::ref(*src), std::cref(batchFiles), std::ref(nextBatchFile),
+                checkpoint.get(), std::cref(options), std::ref(scheduler), std::ref(printer),
+                std::ref(metrics), t0, applicationStartTime, std::cref(running));
+        } else if (src->offline) {
+            captureThreads.emplace_back(
+                fileSampleLoop, std::ref(*src), std::cref(options), std::ref(scheduler),
+                std::ref(printer), std::ref(metrics), t0, std::cref(running));
+        } else {
+            captureThreads.emplace_back(
+                captureLoop, std::ref(*src), std::cref(options), std::ref(metrics),
+                std::cref(running));
         }
-    });
-    ThreadJoiner captureJoiner(captureThread);
+    }
 
     //--------------------------------------------------------------------------
     // Main scheduling loop
     //
     // Responsibilities:
-    // - periodically sample the newest available frame
-    // - overwrite the pending single-slot inference job
-    // - optionally display the current frame in a GUI window
+    // - periodically sample the newest available frame of each source
+    // - queue an inference job for that source (see --queue-policy)
+    // - optionally display the current frames in GUI windows
+    //
+    // Offline file sources submit their own samples; only their preview is
+    // handled here.
     //--------------------------------------------------------------------------
-    const auto t0 = std::chrono::steady_clock::now();
-    double nextTrigger = 0.0;
-    int triggerIdx = 0;
 
+    // Motion scoring costs a resize per check, so cap it at 10 Hz per source.
+    constexpr double kMotionCheckSec = 0.1;
+
+    if (options.motionGate) {
+        std::cerr << "[INFO] Motion gating: threshold " << options.motionThreshold
+                  << ", heartbeat " << options.intervalSec << "s, min spacing "
+                  << options.motionMinIntervalSec << "s\n";
+    }
+
+    // Trigger interval of live sources; fixed unless --adaptive-interval.
+    double intervalSec = initialIntervalSec;
+    double loggedIntervalSec = intervalSec;
+    double lastIntervalLogSec = -1e9;
+    if (options.adaptiveInterval) {
+        std::cerr << "[INFO] Adaptive interval: start " << intervalSec << "s, bounds ["
+                  << options.adaptiveMinSec << "s, " << options.adaptiveMaxSec << "s]\n";
+    }
+
+    StatsReporter statsReporter(metrics);
+    double nextStatsSec = options.statsIntervalSec;
+
+    bool quitRequested = false;
     while (running.load()) {
         const auto tNow = std::chrono::steady_clock::now();
         const double wallSec = std::chrono::duration<double>(tNow - t0).count();
 
-        // Fire at fixed intervals.
-        //
-        // We overwrite the pending job rather than queueing indefinitely,
-        // because freshness matters more than completeness for this workload.
-        if (wallSec >= nextTrigger) {
-            cv::Mat frameCopy;
-            double mediaPosSec = 0.0;
-
-            {
-                std::lock_guard<std::mutex> lock(frameMtx);
-                if (!latestFrame.empty()) {
-                    latestFrame.copyTo(frameCopy);
+        bool anyActive = false;
+        bool anyShown = false;
+
+        for (auto& srcPtr : sources) {
+            SourceState& src = *srcPtr;
+
+            // Block policy: jobs held while the queue was full go first, in
+            // order, as room frees up. Only this source waits for it.
+            while (!src.heldJobs.empty() && scheduler.tryQueue(src.heldJobs.front())) {
+                src.heldJobs.pop_front();
+            }
+
+            if (!src.active.load()) {
+                continue;
+            }
+            anyActive = true;
+
+            // Fire at fixed intervals.
+            //
+            // By default the pending job is overwritten rather than queued,
+            // because freshness matters more than completeness for live
+            // monitoring; --queue-policy selects other trade-offs.
+            bool fire = !src.offline && wallSec >= src.nextTrigger;
+
+            // With decode-on-demand the latest frame may be old: ask the
+            // capture thread for a fresh one and fire once it is published.
+            // The request is repeated until then, in case a retrieve failed.
+            if (fire && options.decodeOnDemand) {
+                const FrameRef latest = src.latest();
+                const uint64_t latestSeq = latest ? latest->seq : 0;
+                if (!src.frameRequested) {
+                    src.frameRequested = true;
+                    src.requestedAfterSeq = latestSeq;
+                }
+                if (latestSeq > src.requestedAfterSeq) {
+                    src.frameRequested = false;
+                } else {
+                    src.wantFrame.store(true);
+                    fire = false;
+                }
+            }
+
+            // With motion gating, --interval is only the heartbeat. In between,
+            // each new frame (at most every kMotionCheckSec) is compared with
+            // the last frame sent, and a large enough change fires early.
+            // latest() only holds frameMtx to copy the reference, so scoring
+            // never stalls the capture thread's publish().
+            if (!fire && !src.frameRequested && !src.offline && options.motionGate &&
+                wallSec - src.lastTriggerSec >= options.motionMinIntervalSec &&
+                wallSec - src.lastCheckSec >= kMotionCheckSec) {
+                const FrameRef frame = src.latest();
+                if (frame && frame->seq != src.lastCheckedSeq) {
+                    src.lastCheckedSeq = frame->seq;
+                    src.lastCheckSec = wallSec;
+                    fire = src.motion.score(frame->image, options.motionPixelDelta) >=
+                           options.motionThreshold;
                 }
-                mediaPosSec = latestMediaPosSec;
             }
 
-            if (!frameCopy.empty()) {
-                {
-                    std::lock_guard<std::mutex> lk(jobMtx);
-                    pending.frame = frameCopy;
-                    pending.wallTimeSec = wallSec;
-                    pending.mediaPosSec = mediaPosSec;
-                    pending.triggerIdx = triggerIdx++;
-                    pending.has = true;
+            if (fire) {
+                // Sampling takes a reference; the pixels are not copied.
+                FrameRef frame = src.latest();
+
+                if (frame) {
+                    if (options.motionGate) {
+                        src.motion.accept(frame->image);
+                    }
+
+                    PendingJob job;
+                    job.sourceIdx = src.index;
+                    job.wallTimeSec = wallSec;
+                    job.mediaPosSec = frame->mediaPosSec;
+                    job.triggerIdx = src.triggerIdx++;
+                    bool clipComplete = true;
+                    if (options.clipStrideSec > 0.0) {
+                        job.context = src.framesBefore(*frame, options.clipFrames - 1, options.clipStrideSec);
+                    } else if (options.clipFrames > 1) {
+                        // Collect samples until the clip is complete.
+                        src.clip.push_back(frame);
+                        clipComplete = src.clip.size() >= static_cast<size_t>(options.clipFrames);
+                        if (clipComplete) {
+                            src.clip.pop_back();
+                            job.context = std::move(src.clip);
+                            src.clip.clear();
+                        }
+                    }
+                    job.frame = std::move(frame);
+                    if (clipComplete && options.queuePolicy != QueuePolicy::Block) {
+                        scheduler.submit(std::move(job));
+                    } else if (clipComplete && (!src.heldJobs.empty() || !scheduler.tryQueue(job))) {
+                        // The queue is full: hold the job (its frames are
+                        // references) and keep serving the other sources.
+                        // Beyond queueDepth held jobs the trigger is skipped.
+                        if (src.heldJobs.size() < static_cast<size_t>(options.queueDepth)) {
+                            src.heldJobs.push_back(std::move(job));
+                            metrics.jobsBlocked.add();
+                        } else {
+                            metrics.jobsSkipped.add();
+                        }
+                    }
+                    src.lastTriggerSec = wallSec;
+
+                    if (options.motionGate) {
+                        // The heartbeat restarts from the last trigger, whatever fired it.
+                        src.nextTrigger = wallSec + intervalSec;
+                    } else {
+                        // If the main loop was delayed, catch up by advancing the next
+                        // trigger beyond the current time; the frames of the
+                        // triggers passed over are gone.
+                        const double nowSec = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - t0).count();
+                        src.nextTrigger += intervalSec;
+                        while (nowSec >= src.nextTrigger) {
+                            src.nextTrigger += intervalSec;
+                        }
+                    }
                 }
-                jobCv.notify_one();
+            }
 
-                // If the main loop was delayed, catch up by advancing the next
-                // trigger beyond the current wall time.
-                while (wallSec >= nextTrigger) {
-                    nextTrigger += options.intervalSec;
+            // Optional local preview window, refreshed only for new frames.
+            if (options.guiEnabled) {
+                const FrameRef frame = src.latest();
+                if (frame && frame->seq != src.lastShownSeq) {
+                    cv::imshow(multiSource ? "Live - " + src.spec.label : "Live", frame->image);
+                    src.lastShownSeq = frame->seq;
+                }
+                if (src.lastShownSeq != 0) {
+                    anyShown = true;
                 }
             }
         }
 
-        // Optional local preview window.
-        //
-        // This is deliberately non-blocking: waitKey(1) allows GUI events to be
-        // processed without stalling capture/inference scheduling.
-        if (options.guiEnabled) {
-            cv::Mat toShow;
-            {
-                std::lock_guard<std::mutex> lock(frameMtx);
-                if (!latestFrame.empty()) {
-                    latestFrame.copyTo(toShow);
-                }
+        if (options.adaptiveInterval) {
+            size_t liveSources = 0;
+            for (const auto& src : sources) {
+                liveSources += src->active.load() && !src->offline ? 1 : 0;
             }
+            const uint64_t overloadTotal = metrics.jobsOverwritten.value() +
+                                           metrics.jobsExpired.value() +
+                                           metrics.jobsBlocked.value() +
+                                           metrics.jobsSkipped.value() +
+                                           metrics.jobsStale.value();
+            if (adaptive.update(wallSec, overloadTotal, liveSources)) {
+                intervalSec = adaptive.intervalSec();
+                metrics.triggerIntervalSec.store(intervalSec);
+
+                // A shorter interval applies right away, not after the
+                // trigger already scheduled with the old one.
+                for (auto& src : sources) {
+                    src->nextTrigger = std::min(src->nextTrigger, src->lastTriggerSec + intervalSec);
+                }
 
-            if (!toShow.empty()) {
-                cv::imshow("Live", toShow);
-                const int key = cv::waitKey(1);
-                if (key == 'q' || key == 27) {
-                    running.store(false);
+                // The interval oscillates around the saturation point by
+                // design, so only larger moves are logged, at most every 30 s.
+                if (std::abs(intervalSec - loggedIntervalSec) >= 0.1 * loggedIntervalSec &&
+                    wallSec - lastIntervalLogSec >= 30.0) {
+                    std::cerr << "[INFO] Adaptive interval: " << std::fixed << std::setprecision(2)
+                              << intervalSec << "s (service time " << adaptive.serviceSec()
+                              << "s, " << adaptive.lastOverload() << " jobs dropped or delayed)\n";
+                    loggedIntervalSec = intervalSec;
+                    lastIntervalLogSec = wallSec;
                 }
             }
         }
 
+        if (options.statsIntervalSec > 0.0 && wallSec >= nextStatsSec) {
+            statsReporter.report();
+            nextStatsSec = wallSec + options.statsIntervalSec;
+        }
+
+        // Stop once every capture thread has finished (EOF or given up).
+        if (!anyActive) {
+            break;
+        }
+
+        // This is deliberately non-blocking: waitKey(1) allows GUI events to be
+        // processed without stalling capture/inference scheduling.
+        if (anyShown) {
+            const int key = cv::waitKey(1);
+            if (key == 'q' || key == 27) {
+                quitRequested = true;
+                running.store(false);
+            }
+        }
+
         // Small sleep to avoid a busy-spin main loop.
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
     }
@@ -1213,16 +4602,147 @@ int main(int argc, char** argv)
     //--------------------------------------------------------------------------
     // Shutdown
     //
-    // Signal the worker explicitly instead of faking a pending job.
+    // When all sources were files that ended, the jobs still pending are
+    // processed first (the last samples of a file). On quit (q/Esc, a signal)
+    // or when a live stream gave up, pending jobs are dropped and requests in
+    // flight are cancelled, and a watchdog bounds the whole shutdown.
     //--------------------------------------------------------------------------
+    if (g_stopSignal != 0) {
+        std::cerr << "[INFO] Signal " << static_cast<int>(g_stopSignal) << " received; shutting down\n";
+        quitRequested = true;
+    }
+    const bool liveSourceEnded = std::any_of(sources.begin(), sources.end(), [](const auto& src) {
+        return !src->likelyFile;
+    });
+    const bool abortPending = quitRequested || liveSourceEnded;
+
+    std::mutex shutdownMtx;
+    std::condition_variable shutdownDone;
+    bool shutdownComplete = false;
+    std::vector<std::thread> watchdog;
+    ThreadJoiner watchdogJoiner(watchdog);
+    if (abortPending && options.shutdownTimeoutSec > 0.0) {
+        watchdog.emplace_back([&] {
+            std::unique_lock<std::mutex> lock(shutdownMtx);
+            const auto timeout = std::chrono::duration<double>(options.shutdownTimeoutSec);
+            if (!shutdownDone.wait_for(lock, timeout, [&] { return shutdownComplete; })) {
+                std::cerr << "[WARN] Shutdown did not complete within " << options.shutdownTimeoutSec
+                          << "s; exiting\n";
+                std::_Exit(1);
+            }
+        });
+    }
+
+    // Files that ended still send the jobs the block policy was holding.
+    if (!abortPending) {
+        for (auto& src : sources) {
+            for (PendingJob& job : src->heldJobs) {
+                scheduler.submitWhenFree(std::move(job), running);
+            }
+            src->heldJobs.clear();
+        }
+    }
+
+    // Workers are released first so cancelled requests return while the
+    // capture threads wind down; the VideoCapture objects are only released
+    // once the capture threads have stopped.
+    running.store(false);
+    if (abortPending) {
+        cancelInFlight.store(true);
+        scheduler.stop();
+    }
+    captureJoiner.join();
+    if (!abortPending) {
+        scheduler.finish();
+    }
+    workerJoiner.join();
+
+    // Everything handed to the writers is on stdout/disk after this.
+    stdoutWriter.close();
+    if (jsonlFileWriter) {
+        jsonlFileWriter->close();
+        std::cerr << "[INFO] JSONL: " << jsonlFileWriter->written() << " records";
+        if (jsonlFileWriter->rotations() > 0) {
+            std::cerr << ", " << jsonlFileWriter->rotations() << " rotations";
+        }
+        if (jsonlFileWriter->failed()) {
+            std::cerr << ", write errors (records may be missing)";
+        }
+        std::cerr << "\n";
+    }
+    if (store) {
+        store->close();
+        std::cerr << "[INFO] Knowledge store: " << store->appended() << " records appended\n";
+    }
     {
-        std::lock_guard<std::mutex> lk(jobMtx);
-        pending.stop = true;
-        pending.has = false;
+        std::lock_guard<std::mutex> lock(shutdownMtx);
+        shutdownComplete = true;
+    }
+    shutdownDone.notify_all();
+    watchdogJoiner.join();
+    if (options.queuePolicy != QueuePolicy::Latest) {
+        std::cerr << "[INFO] Queue (" << queuePolicyName(options.queuePolicy) << ", depth "
+                  << options.queueDepth << "): " << metrics.jobsOverwritten.value()
+                  << " dropped, " << metrics.jobsExpired.value() << " expired, "
+                  << metrics.jobsBlocked.value() << " held for room, " << metrics.jobsSkipped.value()
+                  << " triggers skipped\n";
+    }
+    if (batchMode) {
+        std::cerr << "[INFO] Batch: " << metrics.batchFilesDone.value() << " of " << batchFiles.size()
+                  << " files done";
+        if (metrics.batchFilesFailed.value() > 0) {
+            std::cerr << ", " << metrics.batchFilesFailed.value() << " skipped or incomplete";
+        }
+        std::cerr << "\n";
+    }
+    if (metrics.requestsCancelled.value() > 0) {
+        std::cerr << "[INFO] " << metrics.requestsCancelled.value() << " requests cancelled in flight\n";
+    }
+    const uint64_t droppedLines = stdoutWriter.dropped() + (jsonlFileWriter ? jsonlFileWriter->dropped() : 0);
+    if (droppedLines > 0) {
+        std::cerr << "[WARN] " << droppedLines << " result lines dropped (output backlog full)\n";
+    }
+    if (stdoutWriter.failed()) {
+        std::cerr << "[WARN] stdout: write errors, result lines may be missing\n";
+    }
+
+    for (auto& src : sources) {
+        src->cap.release();
+    }
+
+    if (options.statsIntervalSec > 0.0) {
+        statsReporter.report();
+    }
+
+    if (cache) {
+        std::cerr << "[INFO] Response cache: " << cache->hits() << " hits, "
+                  << cache->misses() << " misses\n";
+    }
+
+    if (options.stream) {
+        const auto ttft = metrics.ttft.snapshot();
+        if (ttft.count > 0) {
+            std::cerr << "[INFO] Streaming: " << ttft.count << " responses, mean TTFT "
+                      << std::fixed << std::setprecision(3) << ttft.mean()
+                      << "s, mean total " << metrics.http.snapshot().mean() << "s\n";
+        }
+    }
+
+    uint64_t httpRequests = 0;
+    uint64_t httpConnects = 0;
+    for (const auto& session : sessions) {
+        httpRequests += session->requests();
+        httpConnects += session->connects();
+    }
+    if (httpRequests > 0) {
+        std::cerr << "[INFO] HTTP: " << httpRequests << " requests over "
+                  << httpConnects << " new connections\n";
     }
-    jobCv.notify_one();
 
-    cap.release();
+    // Easy handles must be gone before the share object they are attached to.
+    sessions.clear();
+    sharedCache.reset();
+    curl_global_cleanup();
 
     if (options.guiEnabled) {
         cv::destroyAllWindows();
@@ -0,0 +1,115 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Reordering of the results of a file decoded in segments (--segments).
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Puts the results of a file sampled in segments (--segments) back into
+// media order.
+//
+// A segment's results are held until it has been sampled to its end and all
+// of its jobs are finished. Finished segments are then released in order,
+// each sorted by trigger index (the sample's position on the interval grid),
+// so output trails the slowest earlier segment but never goes backwards.
+class SegmentMerger {
+public:
+    using Sink = std::function<void(std::string line, std::string record)>;
+
+    SegmentMerger(size_t segments, Sink sink) : segments_(segments), sink_(std::move(sink)) {}
+
+    void jobStarted(size_t segment)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        ++segments_[segment].outstanding;
+    }
+
+    // A result of a job, given before jobFinished(). Empty for failed jobs.
+    void add(size_t segment, int triggerIdx, std::string line, std::string record)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (segment < head_) {
+            sink_(std::move(line), std::move(record));   // after releaseAll()
+            return;
+        }
+        segments_[segment].results.push_back({triggerIdx, std::move(line), std::move(record)});
+    }
+
+    void jobFinished(size_t segment)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (segment >= head_) {
+            --segments_[segment].outstanding;
+        }
+        releaseLocked();
+    }
+
+    // The segment's sampler has submitted its last job.
+    void samplingDone(size_t segment)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        segments_[segment].sampled = true;
+        releaseLocked();
+    }
+
+    // On quit: release what is held, in order, finished or not; results
+    // that still arrive are passed straight through.
+    void releaseAll()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (Segment& segment : segments_) {
+            segment.sampled = true;
+            segment.outstanding = 0;
+        }
+        releaseLocked();
+    }
+
+private:
+    struct Result {
+        int triggerIdx;
+        std::string line;
+        std::string record;
+    };
+
+    struct Segment {
+        size_t outstanding = 0;
+        bool sampled = false;
+        std::vector<Result> results;
+    };
+
+    void releaseLocked()
+    {
+        while (head_ < segments_.size() && segments_[head_].sampled && segments_[head_].outstanding == 0) {
+            std::vector<Result>& results = segments_[head_].results;
+            std::sort(results.begin(), results.end(),
+                      [](const Result& a, const Result& b) { return a.triggerIdx < b.triggerIdx; });
+            for (Result& r : results) {
+                sink_(std::move(r.line), std::move(r.record));
+            }
+            results.clear();
+            results.shrink_to_fit();
+            ++head_;
+        }
+    }
+
+    std::mutex mtx_;
+    std::vector<Segment> segments_;
+    size_t head_ = 0;   // first segment not yet released
+    Sink sink_;
+};
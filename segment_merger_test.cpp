@@ -0,0 +1,156 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Tests of segment_merger.hpp: results finishing in any order, from any
+// thread, are released in media order, and nothing is lost on quit.
+//
+// Usage: segment_merger_test.exe (run by ctest)
+#include "segment_merger.hpp"
+#include "test_check.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string label(size_t segment, int triggerIdx)
+{
+    return std::to_string(segment) + ":" + std::to_string(triggerIdx);
+}
+
+// A later segment finishing first waits for the earlier ones; each segment
+// comes out sorted by trigger index.
+static void testOrder()
+{
+    std::vector<std::string> out;
+    SegmentMerger merger(3, [&](std::string line, std::string) { out.push_back(std::move(line)); });
+
+    for (size_t s = 0; s < 3; ++s) {
+        merger.jobStarted(s);
+        merger.jobStarted(s);
+    }
+    merger.add(2, 7, label(2, 7), "");
+    merger.jobFinished(2);
+    merger.add(2, 6, label(2, 6), "");
+    merger.jobFinished(2);
+    merger.samplingDone(2);
+    merger.add(1, 4, label(1, 4), "");
+    merger.jobFinished(1);
+    merger.add(1, 3, label(1, 3), "");
+    merger.jobFinished(1);
+    merger.samplingDone(1);
+    CHECK(out.empty());
+
+    merger.add(0, 1, label(0, 1), "");
+    merger.jobFinished(0);
+    merger.samplingDone(0);
+    CHECK(out.empty());   // one job of segment 0 still running
+
+    merger.add(0, 0, label(0, 0), "");
+    merger.jobFinished(0);
+    CHECK((out == std::vector<std::string>{"0:0", "0:1", "1:3", "1:4", "2:6", "2:7"}));
+}
+
+// A segment with all jobs finished is held until its sampler is done.
+static void testSamplingDone()
+{
+    std::vector<std::string> out;
+    SegmentMerger merger(2, [&](std::string line, std::string) { out.push_back(std::move(line)); });
+    merger.jobStarted(0);
+    merger.add(0, 0, label(0, 0), "");
+    merger.jobFinished(0);
+    CHECK(out.empty());
+    merger.samplingDone(0);
+    CHECK((out == std::vector<std::string>{"0:0"}));
+}
+
+// On quit what is held comes out in order, and late results pass through.
+static void testReleaseAll()
+{
+    std::vector<std::string> out;
+    SegmentMerger merger(2, [&](std::string line, std::string) { out.push_back(std::move(line)); });
+    merger.jobStarted(0);
+    merger.jobStarted(1);
+    merger.jobStarted(1);
+    merger.add(1, 5, label(1, 5), "");
+    merger.jobFinished(1);
+    merger.releaseAll();
+    CHECK((out == std::vector<std::string>{"1:5"}));
+
+    merger.add(0, 0, label(0, 0), "");
+    merger.jobFinished(0);
+    merger.add(1, 6, label(1, 6), "");
+    merger.jobFinished(1);
+    CHECK((out == std::vector<std::string>{"1:5", "0:0", "1:6"}));
+}
+
+// Workers finish jobs of all segments concurrently and in random order.
+static void testConcurrent()
+{
+    constexpr size_t kSegments = 4;
+    constexpr int kJobs = 200;
+    std::mutex outMtx;
+    std::vector<std::string> out;
+    SegmentMerger merger(kSegments, [&](std::string line, std::string record) {
+        std::lock_guard<std::mutex> lock(outMtx);
+        out.push_back(line + "|" + record);
+    });
+
+    struct Job {
+        size_t segment;
+        int triggerIdx;
+    };
+    std::vector<Job> jobs;
+    for (size_t s = 0; s < kSegments; ++s) {
+        for (int t = 0; t < kJobs; ++t) {
+            merger.jobStarted(s);
+            jobs.push_back({s, static_cast<int>(s) * kJobs + t});
+        }
+    }
+    std::shuffle(jobs.begin(), jobs.end(), std::mt19937(7));
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < 4; ++w) {
+        workers.emplace_back([&, w] {
+            for (size_t i = w; i < jobs.size(); i += 4) {
+                merger.add(jobs[i].segment, jobs[i].triggerIdx, label(jobs[i].segment, jobs[i].triggerIdx), "r");
+                merger.jobFinished(jobs[i].segment);
+            }
+        });
+    }
+    for (size_t s = kSegments; s-- > 0;) {
+        merger.samplingDone(s);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::vector<std::string> want;
+    for (size_t s = 0; s < kSegments; ++s) {
+        for (int t = 0; t < kJobs; ++t) {
+            want.push_back(label(s, static_cast<int>(s) * kJobs + t) + "|r");
+        }
+    }
+    CHECK(out == want);
+}
+
+int main()
+{
+    testOrder();
+    testSamplingDone();
+    testReleaseAll();
+    testConcurrent();
+    return testResult("segment_merger");
+}
@@ -0,0 +1,39 @@
+// -*- coding: utf-8 -*-
+//
+// This file is part of the Spazio IT Video-to-Knowledge project.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+//
+// Copyright (c) 2026 Spazio IT
+// Spazio - IT Soluzioni Informatiche s.a.s.
+// via Manzoni 40
+// 46051 San Giorgio Bigarello
+// https://spazioit.com
+//
+// Minimal checks shared by the *_test.cpp programs run by ctest: CHECK()
+// reports a failed condition and carries on, and main() ends with
+// `return testResult("<name>");`.
+#pragma once
+
+#include <iostream>
+
+inline int checkFailures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond "\n"; \
+            ++checkFailures;                                                         \
+        }                                                                            \
+    } while (0)
+
+// Summary line and exit status: 0 if every check passed.
+inline int testResult(const char* name)
+{
+    if (checkFailures > 0) {
+        std::cerr << checkFailures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << name << ": all checks passed\n";
+    return 0;
+}